@@ -0,0 +1,108 @@
+#ifndef BASE_HPP
+#define BASE_HPP
+
+// Basic utilities that don't depend on SDL or imgui.
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <chrono>
+#include <memory>
+
+#define CONCAT(x, y) x##y
+#define STR(a) #a
+#define XSTR(a) STR(a)
+
+#define NS_PER_MS 1000000
+#define NS_PER_US 1000
+#define US_PER_MS 1000
+#define US_PER_S  1000000
+
+#define LOGFILE_NAME "spaceinvaders.log"
+
+#ifdef __clang__
+    #define PUSH_WARNINGS _Pragma("clang diagnostic push")
+    #define POP_WARNINGS  _Pragma("clang diagnostic pop")
+    #define IGNORE_WFORMAT_SECURITY \
+    _Pragma("clang diagnostic ignored \"-Wformat-security\"")
+#elif defined(__GNUC__)
+    #define PUSH_WARNINGS _Pragma("GCC diagnostic push")
+    #define POP_WARNINGS  _Pragma("GCC diagnostic pop")
+    #define IGNORE_WFORMAT_SECURITY \
+    _Pragma("GCC diagnostic ignored \"-Wformat-security\"")
+#else
+    #define PUSH_WARNINGS
+    #define POP_WARNINGS
+    #define IGNORE_WFORMAT_SECURITY
+#endif
+
+namespace fs = std::filesystem;
+namespace tim = std::chrono;
+
+using clk = tim::steady_clock;
+using uint = unsigned int;
+
+constexpr bool is_emscripten()
+{
+#ifdef __EMSCRIPTEN__
+    return true;
+#else
+    return false;
+#endif
+}
+
+// this only works if NDEBUG is defined in Release mode
+// (default for CMake)
+constexpr bool is_debug()
+{
+#ifdef NDEBUG
+    return false;
+#else
+    return true;
+#endif
+}
+
+// Open the log file. Returns -1 on error.
+// Until this is called, logs only go to the console.
+int log_init();
+
+// Drop logMESSAGE()s from now on (or not), for tools that print
+// their own results. Warnings and errors still go through.
+void log_quiet(bool quiet);
+
+void logERROR(const char* fmt, ...);
+void logWARNING(const char* fmt, ...);
+void logMESSAGE(const char* fmt, ...);
+
+
+using file_ptr = std::unique_ptr<std::FILE, int(*)(std::FILE*)>;
+
+#define SAFE_FOPENA(fname, mode) file_ptr(std::fopen(fname, mode), std::fclose)
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+#define SAFE_FOPEN(fname, mode) file_ptr(::_wfopen(fname, CONCAT(L, mode)), std::fclose)
+#else
+#define SAFE_FOPEN(fname, mode) SAFE_FOPENA(fname, mode)
+#endif
+
+using malloc_ptr_t = std::unique_ptr<void, void(*)(void*)>;
+
+inline malloc_ptr_t make_malloc_ptr(void* ptr)
+{
+    return { ptr, std::free };
+}
+
+// this has good codegen
+template <typename T>
+inline void set_bit(T* ptr, int bit, bool val)
+{
+    *ptr = (*ptr & ~(0x1 << bit)) | (val << bit);
+}
+
+template <typename T>
+inline bool get_bit(T word, int bit)
+{
+    return (word & (0x1 << bit)) != 0;
+}
+
+#endif
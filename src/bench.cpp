@@ -0,0 +1,752 @@
+// 
+// CPU core benchmark.
+//
+// Runs the game's attract mode for a number of frames, first with 
+// the callback-based i8080 (calls through function pointers), then
+// with basic_i8080<invaders_bus> (calls inlined at compile time),
+// then with the same and the block cache (as in the game), then with
+// the recompiler, the precompiled ROM if available and the native
+// versions of the ROM's loops (HLE), and prints the emulated clock
+// speed of each. Each of the last three is then run side by side
+// with the interpreter, comparing them after every frame.
+//
+// Then plays a game saving and loading the machine's state every
+// frame, prints how long that takes, and checks that running again
+// from an earlier state repeats the same frames. Then does the same
+// with a rewind buffer, and steps back through it checking every frame.
+// Then records a game to a movie, plays it back as fast as it can and
+// seeks around in it, checking every frame it lands on. Then hashes
+// the machine every frame, and checks it against a hash of its whole
+// saved state, timing the frames along with each.
+// Then forks chains of machines from a game in progress, as a search
+// would, and prints how long a fork takes and how many frames a core
+// runs that way, checking against copies made with saved states.
+//
+// Then runs machine_lanes with more and more lanes, all with the
+// same inputs and then each playing with its own, and prints the
+// throughput of all lanes together, how often they ran in lockstep
+// and how much on their own, after that of one machine on its own
+// for comparison.
+// Each lane is checked against the interpreter first.
+//
+// usage: spaceinvaders-bench [asset-dir] [frames]
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "i8080/i8080_opcodes.hpp"
+#include "machine.hpp"
+#include "movie.hpp"
+#include "rewind.hpp"
+
+#define DEFAULT_FRAMES 20000
+
+static inline machine* MACHINE(i8080* cpu) {
+    return static_cast<machine*>(cpu->udata);
+}
+
+static i8080_word_t cpu_mem_read(i8080* cpu, i8080_addr_t addr) {
+    return MACHINE(cpu)->mem[addr % MEM_SIZE];
+}
+
+static void cpu_mem_write(i8080* cpu, i8080_addr_t addr, i8080_word_t word) {
+    addr %= MEM_SIZE;
+    if (addr >= RAM_START_ADDR) {
+        MACHINE(cpu)->mem[addr] = word;
+    }
+}
+
+static i8080_word_t cpu_io_read(i8080* cpu, i8080_word_t port) {
+    return MACHINE(cpu)->io_read(port);
+}
+
+static void cpu_io_write(i8080* cpu, i8080_word_t port, i8080_word_t word) {
+    MACHINE(cpu)->io_write(port, word);
+}
+
+static i8080_word_t cpu_intr_read(i8080* cpu) {
+    return MACHINE(cpu)->intr_opcode;
+}
+
+// Same as machine::run_frame() with its events, for the callback core.
+static void run_frame(i8080& cpu, machine& m, uint64_t frame_idx, uint64_t& target_cycles)
+{
+    uint64_t frame_cycles = FRAME_CYCLES + (frame_idx % FRAME_CYCLES_LONG_EVERY == 0);
+    uint64_t prev_targetcycles = target_cycles;
+
+    cpu.run(prev_targetcycles + MIDSCREEN_CYCLES);
+    m.intr_opcode = i8080_RST_1;
+    cpu.interrupt();
+
+    cpu.run(prev_targetcycles + frame_cycles);
+    m.intr_opcode = i8080_RST_2;
+    cpu.interrupt();
+
+    target_cycles += frame_cycles;
+}
+
+static bool same_state(const machine& m1, const machine& m2)
+{
+    const i8080_state& c1 = m1.cpu;
+    const i8080_state& c2 = m2.cpu;
+    return c1.a == c2.a && c1.b == c2.b && c1.c == c2.c && 
+        c1.d == c2.d && c1.e == c2.e && c1.h == c2.h && c1.l == c2.l &&
+        c1.sp == c2.sp && c1.pc == c2.pc && c1.cycles == c2.cycles &&
+        c1.s == c2.s && c1.z == c2.z && c1.cy == c2.cy && c1.ac == c2.ac && c1.p == c2.p &&
+        c1.int_en == c2.int_en && c1.halt == c2.halt &&
+        m1.shiftreg == m2.shiftreg && m1.shiftreg_off == m2.shiftreg_off &&
+        std::memcmp(&m1.mem[RAM_START_ADDR], &m2.mem[RAM_START_ADDR], RAM_SIZE) == 0;
+}
+
+// Run the interpreter and a machine with native code turned on by 
+// enable (set_jit/set_aot/set_hle) frame by frame. Returns the first frame 
+// they differ after, or -1.
+static int64_t verify_native(const char* assetdir, uint64_t num_frames, int (machine::*enable)(bool))
+{
+    auto m_interp = std::make_unique<machine>();
+    auto m_native = std::make_unique<machine>();
+    if (m_interp->init(assetdir) != 0 || m_native->init(assetdir) != 0 ||
+        ((*m_native).*enable)(true) != 0) {
+        return 0;
+    }
+    for (uint64_t i = 0; i < num_frames; ++i) {
+        m_interp->run_frame();
+        m_native->run_frame();
+        if (!same_state(*m_interp, *m_native)) {
+            return (int64_t)i;
+        }
+    }
+    return -1;
+}
+
+// Inputs (port 1) of a lane that plays: insert a coin and start
+// a game at a time of its own, then move and fire at random.
+static i8080_word_t lane_inputs(int lane, uint64_t frame)
+{
+    uint64_t coin_frame = 60 + 13 * uint64_t(lane);
+    uint64_t start_frame = coin_frame + 120;
+    i8080_word_t port1 = 0x08;
+    if (frame >= coin_frame && frame < coin_frame + 5) {
+        port1 |= 0x01; // credit
+    }
+    if (frame >= start_frame && frame < start_frame + 5) {
+        port1 |= 0x04; // 1P start
+    }
+    if (frame >= start_frame + 60) {
+        uint64_t x = (uint64_t(lane) << 32 | frame / 8) * 0x9e3779b97f4a7c15ull;
+        port1 |= i8080_word_t((x >> 59) & 0x30) | i8080_word_t((x >> 55) & 0x40); // fire, left, right
+    }
+    return port1;
+}
+
+static bool same_lane_state(machine_lanes& ml, int lane, const machine& m)
+{
+    i8080_state c{};
+    ml.cpu.get_lane(lane, &c);
+    const i8080_state& c2 = m.cpu;
+    return c.a == c2.a && c.b == c2.b && c.c == c2.c &&
+        c.d == c2.d && c.e == c2.e && c.h == c2.h && c.l == c2.l &&
+        c.sp == c2.sp && c.pc == c2.pc && c.cycles == c2.cycles &&
+        c.s == c2.s && c.z == c2.z && c.cy == c2.cy && c.ac == c2.ac && c.p == c2.p &&
+        c.int_en == c2.int_en && c.halt == c2.halt &&
+        ml.shiftreg[lane] == m.shiftreg && ml.shiftreg_off[lane] == m.shiftreg_off &&
+        std::memcmp(ml.lane_ram(lane), &m.mem[RAM_START_ADDR], RAM_SIZE) == 0;
+}
+
+// Run num_lanes lanes, each playing, and as many interpreters with the
+// same inputs frame by frame. Returns the first frame a lane differs
+// after, or -1.
+static int64_t verify_lanes(const char* assetdir, uint64_t num_frames, int num_lanes)
+{
+    auto ml = std::make_unique<machine_lanes>();
+    std::vector<std::unique_ptr<machine>> ms(num_lanes);
+    if (ml->init(assetdir, num_lanes) != 0) {
+        return 0;
+    }
+    for (int lane = 0; lane < num_lanes; ++lane) {
+        ms[lane] = std::make_unique<machine>();
+        if (ms[lane]->init(assetdir) != 0) { 
+            return 0; 
+        }
+        // registers aren't set by reset
+        ml->cpu.set_lane(lane, &ms[lane]->cpu);
+    }
+    for (uint64_t i = 0; i < num_frames; ++i) {
+        for (int lane = 0; lane < num_lanes; ++lane) {
+            ml->in_port1[lane] = ms[lane]->in_port1 = lane_inputs(lane, i);
+            ms[lane]->run_frame();
+        }
+        ml->run_frame();
+        for (int lane = 0; lane < num_lanes; ++lane) {
+            if (!same_lane_state(*ml, lane, *ms[lane])) {
+                return (int64_t)i;
+            }
+        }
+    }
+    return -1;
+}
+
+// Run one machine as lane 0 would, without or with the block cache.
+// The baseline for the lanes' throughput.
+static int bench_scalar_lane(const char* assetdir, uint64_t num_frames, bool playing, bool blocks,
+    uint64_t& cycles, clk::duration& time)
+{
+    auto m = std::make_unique<machine>();
+    if (m->init(assetdir) != 0) {
+        return -1;
+    }
+    if (!blocks) {
+        m->cpu.set_block_cache(nullptr);
+    }
+    clk::time_point t_start = clk::now();
+    for (uint64_t i = 0; i < num_frames; ++i) {
+        if (playing) {
+            m->in_port1 = lane_inputs(0, i);
+        }
+        m->run_frame();
+    }
+    time = clk::now() - t_start;
+    cycles = m->cpu.cycles;
+    return 0;
+}
+
+// Play a game for num_frames, saving and loading every frame. Every
+// 600 frames, go back 60 frames and run them again. Returns the first
+// frame that came out differently the second time, or -1.
+static int64_t bench_save_state(const char* assetdir, uint64_t num_frames,
+    clk::duration& save_time, clk::duration& load_time)
+{
+    auto m = std::make_unique<machine>();
+    if (m->init(assetdir) != 0) {
+        return 0;
+    }
+    std::vector<unsigned char> state(MACHINE_SAVE_SIZE);
+    std::vector<unsigned char> checkpoint(MACHINE_SAVE_SIZE);
+    std::vector<unsigned char> first(MACHINE_SAVE_SIZE);
+    uint64_t checkpoint_frame = 0;
+    m->save_state(checkpoint.data(), checkpoint.size());
+
+    for (uint64_t i = 0; i < num_frames; ++i)
+    {
+        m->in_port1 = lane_inputs(0, i);
+        m->run_frame();
+
+        clk::time_point t = clk::now();
+        m->save_state(state.data(), state.size());
+        save_time += clk::now() - t;
+        t = clk::now();
+        if (m->load_state(state.data(), state.size()) != 0) {
+            return (int64_t)i;
+        }
+        load_time += clk::now() - t;
+
+        if (i % 600 == 539) {
+            checkpoint = state;
+            checkpoint_frame = i + 1;
+        }
+        else if (i % 600 == 599) {
+            first = state;
+            m->load_state(checkpoint.data(), checkpoint.size());
+            for (uint64_t j = checkpoint_frame; j <= i; ++j) {
+                m->in_port1 = lane_inputs(0, j);
+                m->run_frame();
+            }
+            m->save_state(state.data(), state.size());
+            if (state != first) {
+                return (int64_t)i;
+            }
+        }
+    }
+    return -1;
+}
+
+// Play a game for num_frames, pushing every frame to a rewind buffer,
+// then step back through the last num_check frames. Returns the first
+// frame (counting back) that loads differently from when it ran, or -1.
+static int64_t bench_rewind(const char* assetdir, uint64_t num_frames,
+    rewind_buffer& rewind, clk::duration& push_time)
+{
+    auto m = std::make_unique<machine>();
+    if (m->init(assetdir) != 0 ||
+        rewind.init(REWIND_DEFAULT_FRAMES, REWIND_DEFAULT_ARENA) != 0) {
+        return 0;
+    }
+    const uint64_t num_check = std::min<uint64_t>(num_frames, 300);
+    std::vector<std::vector<unsigned char>> states(num_check,
+        std::vector<unsigned char>(MACHINE_SAVE_SIZE));
+
+    for (uint64_t i = 0; i < num_frames; ++i)
+    {
+        m->in_port1 = lane_inputs(0, i);
+        m->run_frame();
+
+        clk::time_point t = clk::now();
+        rewind.push(*m);
+        push_time += clk::now() - t;
+
+        m->save_state(states[i % num_check].data(), MACHINE_SAVE_SIZE);
+    }
+    std::vector<unsigned char> state(MACHINE_SAVE_SIZE);
+    for (uint64_t back = 1; back < num_check; ++back)
+    {
+        if (rewind.step_back(*m) != 0) {
+            return (int64_t)back;
+        }
+        m->save_state(state.data(), state.size());
+        if (state != states[(num_frames - 1 - back) % num_check]) {
+            return (int64_t)back;
+        }
+    }
+    return -1;
+}
+
+// Play a game for num_frames on two machines side by side, hashing
+// one after every frame and saving the other's state and hashing all
+// of it. Hashing maps the pages it hashed read-only, so it costs the
+// hash and the frame's slower writes, which is what inc_time gets.
+// Which runs first swaps every frame, so neither gains from going
+// first. Returns the first frame whose hashes differ, or -1.
+static int64_t bench_hash(const char* assetdir, uint64_t num_frames,
+    clk::duration& inc_time, clk::duration& full_time)
+{
+    std::vector<unsigned char> state(MACHINE_SAVE_SIZE);
+    auto m_inc = std::make_unique<machine>();
+    auto m_full = std::make_unique<machine>();
+    if (m_inc->init(assetdir) != 0 || m_full->init(assetdir) != 0) {
+        return 0;
+    }
+    for (uint64_t i = 0; i < num_frames; ++i)
+    {
+        m_inc->in_port1 = m_full->in_port1 = lane_inputs(0, i);
+        uint64_t h = 0, h_full = 0;
+        for (int j = 0; j < 2; ++j)
+        {
+            clk::time_point t = clk::now();
+            if ((i + j) % 2 == 0) {
+                m_inc->run_frame();
+                h = machine_hash(*m_inc);
+                inc_time += clk::now() - t;
+            }
+            else {
+                m_full->run_frame();
+                full_time += clk::now() - t;
+                m_full->save_state(state.data(), state.size());
+                t = clk::now();
+                h_full = machine_hash(state.data());
+                full_time += clk::now() - t;
+            }
+        }
+        if (h != h_full) {
+            return (int64_t)i;
+        }
+    }
+    return -1;
+}
+
+// Record a game of num_frames to a movie, with a DIP switch flipped
+// halfway, then play it back as fast as possible and seek to frames
+// at random. Returns the first frame that plays back differently
+// from how it was recorded, or -1.
+static int64_t bench_movie(const char* assetdir, uint64_t num_frames, clk::duration& play_time,
+    clk::duration& seek_time, uint64_t& num_seeks, uint64_t& file_size)
+{
+    fs::path path = fs::temp_directory_path() / "spaceinvaders-bench.movie";
+    auto m = std::make_unique<machine>();
+    movie_recorder rec;
+    if (m->init(assetdir) != 0 || rec.open(path) != 0) {
+        return 0;
+    }
+    std::vector<uint64_t> hashes;
+    for (uint64_t i = 0; i < num_frames; ++i) {
+        m->in_port1 = lane_inputs(0, i);
+        if (i == num_frames / 2) {
+            m->in_port2 ^= 0x08; // bonus life at 1000
+        }
+        hashes.push_back(machine_hash(*m));
+        rec.frame(*m);
+        m->run_frame();
+    }
+    hashes.push_back(machine_hash(*m));
+    if (rec.close() != 0) {
+        return 0;
+    }
+    file_size = fs::file_size(path);
+
+    int64_t bad_frame = -1;
+    movie_player player;
+    auto m_play = std::make_unique<machine>();
+    if (m_play->init(assetdir) != 0 || player.open(path) != 0 ||
+        player.num_frames() != num_frames) {
+        bad_frame = 0;
+    }
+    else {
+        clk::time_point t = clk::now();
+        player.seek(*m_play, 0);
+        while (player.step(*m_play)) {}
+        play_time += clk::now() - t;
+        if (player.desyncs != 0 || machine_hash(*m_play) != hashes[num_frames]) {
+            bad_frame = int64_t(num_frames);
+        }
+    }
+    for (uint64_t i = 0; bad_frame < 0 && i < 200; ++i)
+    {
+        uint64_t f = (i * 0x9e3779b97f4a7c15ull >> 16) % (num_frames + 1);
+        clk::time_point t = clk::now();
+        if (player.seek(*m_play, f) != 0) {
+            bad_frame = (int64_t)f;
+        }
+        seek_time += clk::now() - t;
+        num_seeks++;
+        if (machine_hash(*m_play) != hashes[f]) {
+            bad_frame = (int64_t)f;
+        }
+    }
+    fs::remove(path);
+    return bad_frame;
+}
+
+#define FORK_DEPTH 4
+#define FORK_FRAMES 8
+#define FORK_CHECK_EVERY 64
+
+// Inputs (port 1) of a branch of a search: move and fire at random.
+static i8080_word_t branch_inputs(uint64_t branch, uint64_t frame)
+{
+    uint64_t x = (branch << 32 | frame / 4) * 0x9e3779b97f4a7c15ull;
+    return i8080_word_t(0x08 | ((x >> 59) & 0x30) | ((x >> 55) & 0x40));
+}
+
+// Search through a game like a planner would: fork a chain of
+// FORK_DEPTH machines from a game in progress, each from the one
+// before, and run each for FORK_FRAMES frames with inputs of its own.
+// Every FORK_CHECK_EVERY rounds, copy the chain with save/load states
+// instead, timing that, and check that it runs the same and that the
+// root doesn't change. Returns the first round that differs, or -1.
+static int64_t bench_fork(const char* assetdir, uint64_t num_rounds, clk::duration& fork_time,
+    clk::duration& copy_time, clk::duration& run_time, uint64_t& ram_copies)
+{
+    auto root = std::make_unique<machine>();
+    auto copy = std::make_unique<machine>();
+    if (root->init(assetdir) != 0 || copy->init(assetdir) != 0) {
+        return 0;
+    }
+    for (uint64_t i = 0; i < 600; ++i) {
+        root->in_port1 = lane_inputs(0, i);
+        root->run_frame();
+    }
+    std::vector<unsigned char> root_state(MACHINE_SAVE_SIZE);
+    std::vector<unsigned char> state(MACHINE_SAVE_SIZE);
+    std::vector<unsigned char> copy_state(MACHINE_SAVE_SIZE);
+    root->save_state(root_state.data(), root_state.size());
+
+    std::unique_ptr<machine> chain[FORK_DEPTH];
+    for (auto& m : chain) {
+        m = std::make_unique<machine>();
+    }
+    clk::time_point t_start = clk::now();
+    for (uint64_t r = 0; r < num_rounds; ++r)
+    {
+        machine* parent = root.get();
+        for (int d = 0; d < FORK_DEPTH; ++d)
+        {
+            machine& m = *chain[d];
+            clk::time_point t = clk::now();
+            if (parent->fork(m) != 0) {
+                return (int64_t)r;
+            }
+            fork_time += clk::now() - t;
+
+            for (int f = 0; f < FORK_FRAMES; ++f) {
+                m.in_port1 = branch_inputs(r * FORK_DEPTH + d, m.frame_idx);
+                m.run_frame();
+            }
+            ram_copies += m.ram_copies;
+            parent = &m;
+        }
+        if (r % FORK_CHECK_EVERY != 0) {
+            continue;
+        }
+        run_time += clk::now() - t_start;
+
+        copy->load_state(root_state.data(), root_state.size());
+        for (int d = 0; d < FORK_DEPTH; ++d)
+        {
+            clk::time_point t = clk::now();
+            copy->save_state(copy_state.data(), copy_state.size());
+            copy->load_state(copy_state.data(), copy_state.size());
+            copy_time += clk::now() - t;
+
+            for (int f = 0; f < FORK_FRAMES; ++f) {
+                copy->in_port1 = branch_inputs(r * FORK_DEPTH + d, copy->frame_idx);
+                copy->run_frame();
+            }
+            copy->save_state(copy_state.data(), copy_state.size());
+            chain[d]->save_state(state.data(), state.size());
+            if (state != copy_state || machine_hash(*chain[d]) != machine_hash(copy_state.data())) {
+                return (int64_t)r;
+            }
+        }
+        root->save_state(state.data(), state.size());
+        if (state != root_state) {
+            return (int64_t)r;
+        }
+        t_start = clk::now();
+    }
+    run_time += clk::now() - t_start;
+    return -1;
+}
+
+static void print_result(const char* name, uint64_t cycles, clk::duration time)
+{
+    double secs = tim::duration<double>(time).count();
+    std::printf("%-10s %8.3f s  %8.2f MHz\n", name, secs, cycles / secs / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* assetdir = argc > 1 ? argv[1] : "assets/";
+    uint64_t num_frames = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : DEFAULT_FRAMES;
+    log_quiet(true); // not a "Loaded ROM" per machine
+
+    std::printf("Running %llu frames, %s dispatch\n", 
+        (unsigned long long)num_frames, i8080::dispatch_mode());
+
+    // callbacks
+    static machine m_cb;
+    if (m_cb.init(assetdir) != 0) {
+        return 1;
+    }
+    i8080 cpu{};
+    for (uint32_t base = 0; base < 0x10000; base += MEM_SIZE) {
+        cpu.map_mem(base, ROM_SIZE, &m_cb.mem[0], I8080_MAP_READ);
+        cpu.map_mem(base + RAM_START_ADDR, RAM_SIZE, &m_cb.mem[RAM_START_ADDR], I8080_MAP_RW);
+    }
+    cpu.mem_read = cpu_mem_read;
+    cpu.mem_write = cpu_mem_write;
+    cpu.io_read = cpu_io_read;
+    cpu.io_write = cpu_io_write;
+    cpu.intr_read = cpu_intr_read;
+    cpu.udata = &m_cb;
+    cpu.reset();
+
+    uint64_t target_cycles = 0;
+    clk::time_point t_start = clk::now();
+    for (uint64_t i = 0; i < num_frames; ++i) {
+        run_frame(cpu, m_cb, i, target_cycles);
+    }
+    print_result("callback", cpu.cycles, clk::now() - t_start);
+
+    // invaders_bus
+    static machine m_si;
+    if (m_si.init(assetdir) != 0) {
+        return 1;
+    }
+    m_si.cpu.set_block_cache(nullptr);
+    t_start = clk::now();
+    for (uint64_t i = 0; i < num_frames; ++i) {
+        m_si.run_frame();
+    }
+    print_result("static", m_si.cpu.cycles, clk::now() - t_start);
+
+    // invaders_bus + block cache
+    static machine m_bc;
+    if (m_bc.init(assetdir) != 0) {
+        return 1;
+    }
+    uint64_t max_idle_frame = 0;
+    t_start = clk::now();
+    for (uint64_t i = 0; i < num_frames; ++i) {
+        m_bc.run_frame();
+        max_idle_frame = std::max(max_idle_frame, m_bc.idle_cycles_frame);
+    }
+    print_result("blocks", m_bc.cpu.cycles, clk::now() - t_start);
+    std::printf("block cache: %llu hits, %llu misses, %llu invalidations\n",
+        (unsigned long long)m_bc.blocks->hits, (unsigned long long)m_bc.blocks->misses,
+        (unsigned long long)m_bc.blocks->invalidations);
+    std::printf("idle loops: %llu cycles skipped per frame (max %llu), %.1f%%\n",
+        (unsigned long long)(m_bc.blocks->idle_cycles / std::max<uint64_t>(num_frames, 1)),
+        (unsigned long long)max_idle_frame,
+        100.0 * m_bc.blocks->idle_cycles / std::max<uint64_t>(m_bc.cpu.cycles, 1));
+
+    if (cpu.cycles != m_si.cpu.cycles || cpu.cycles != m_bc.cpu.cycles ||
+        std::memcmp(&m_cb.mem[RAM_START_ADDR], &m_si.mem[RAM_START_ADDR], RAM_SIZE) != 0 ||
+        std::memcmp(&m_cb.mem[RAM_START_ADDR], &m_bc.mem[RAM_START_ADDR], RAM_SIZE) != 0) {
+        std::printf("Error: results differ!\n");
+        return 1;
+    }
+
+    // invaders_bus + block cache + recompiler or precompiled ROM
+    struct native_mode { const char* name; int (machine::*enable)(bool); bool built; };
+    const native_mode native_modes[] = {
+        { "jit", &machine::set_jit, true },
+        { "aot", &machine::set_aot, machine::has_aot() },
+        { "hle", &machine::set_hle, true }
+    };
+    for (const native_mode& mode : native_modes)
+    {
+        auto m = std::make_unique<machine>();
+        if (m->init(assetdir) != 0) {
+            return 1;
+        }
+        if (!mode.built || ((*m).*mode.enable)(true) != 0) {
+            std::printf("%-10s not available\n", mode.name);
+            continue;
+        }
+        t_start = clk::now();
+        for (uint64_t i = 0; i < num_frames; ++i) {
+            m->run_frame();
+        }
+        print_result(mode.name, m->cpu.cycles, clk::now() - t_start);
+        if (m->jit) {
+            std::printf("jit: %llu translations, %llu flushes, %llu exits\n",
+                (unsigned long long)m->jit->translations, (unsigned long long)m->jit->flushes,
+                (unsigned long long)m->jit->exits);
+        }
+        if (m->aot) {
+            std::printf("aot: %llu exits\n", (unsigned long long)m->aot->exits);
+        }
+        if (m->hle) {
+            std::printf("hle: %llu calls, %.1f%% of cycles\n", (unsigned long long)m->hle->calls,
+                100.0 * m->hle->cycles / std::max<uint64_t>(m->cpu.cycles, 1));
+        }
+
+        int64_t bad_frame = verify_native(assetdir, num_frames, mode.enable);
+        if (bad_frame >= 0) {
+            std::printf("Error: %s differs from interpreter after frame %lld!\n", 
+                mode.name, (long long)bad_frame);
+            return 1;
+        }
+        std::printf("%s matches interpreter for %llu frames\n", 
+            mode.name, (unsigned long long)num_frames);
+    }
+
+    // save states
+    clk::duration save_time{}, load_time{};
+    int64_t bad_frame = bench_save_state(assetdir, num_frames, save_time, load_time);
+    if (bad_frame >= 0) {
+        std::printf("Error: state differs after loading, at frame %lld!\n", (long long)bad_frame);
+        return 1;
+    }
+    std::printf("save state: %d bytes, %.2f us to save, %.2f us to load\n", MACHINE_SAVE_SIZE,
+        tim::duration<double, std::micro>(save_time).count() / std::max<uint64_t>(num_frames, 1),
+        tim::duration<double, std::micro>(load_time).count() / std::max<uint64_t>(num_frames, 1));
+
+    // rewind
+    rewind_buffer rewind;
+    clk::duration push_time{};
+    bad_frame = bench_rewind(assetdir, num_frames, rewind, push_time);
+    if (bad_frame >= 0) {
+        std::printf("Error: rewind differs %lld frames back!\n", (long long)bad_frame);
+        return 1;
+    }
+    std::printf("rewind: %.2f us per frame, %zu frames in %.2f MB, %llu keyframes, %llu deltas\n",
+        tim::duration<double, std::micro>(push_time).count() / std::max<uint64_t>(num_frames, 1),
+        rewind.num_frames(), rewind.bytes_used() / 1048576.0,
+        (unsigned long long)rewind.keyframes, (unsigned long long)rewind.deltas);
+
+    // movie
+    clk::duration play_time{}, seek_time{};
+    uint64_t num_seeks = 0, movie_size = 0;
+    bad_frame = bench_movie(assetdir, num_frames, play_time, seek_time, num_seeks, movie_size);
+    if (bad_frame >= 0) {
+        std::printf("Error: movie plays back differently at frame %lld!\n", (long long)bad_frame);
+        return 1;
+    }
+    std::printf("movie: %llu frames in %.1f KB, played back at %.0fx real time, %.0f us to seek\n",
+        (unsigned long long)num_frames, movie_size / 1024.0,
+        num_frames / 60.0 / tim::duration<double>(play_time).count(),
+        tim::duration<double, std::micro>(seek_time).count() / std::max<uint64_t>(num_seeks, 1));
+
+    // hash
+    clk::duration inc_time{}, full_time{};
+    bad_frame = bench_hash(assetdir, num_frames, inc_time, full_time);
+    if (bad_frame >= 0) {
+        std::printf("Error: state hash differs from a full hash at frame %lld!\n", (long long)bad_frame);
+        return 1;
+    }
+    std::printf("hash: frames %.2f us with a hash after each, %.2f us hashing everything\n",
+        tim::duration<double, std::micro>(inc_time).count() / std::max<uint64_t>(num_frames, 1),
+        tim::duration<double, std::micro>(full_time).count() / std::max<uint64_t>(num_frames, 1));
+
+    // fork
+    uint64_t fork_rounds = std::max<uint64_t>(num_frames / (FORK_DEPTH * FORK_FRAMES), 1);
+    uint64_t copy_rounds = (fork_rounds + FORK_CHECK_EVERY - 1) / FORK_CHECK_EVERY;
+    clk::duration fork_time{}, copy_time{}, run_time{};
+    uint64_t ram_copies = 0;
+    bad_frame = bench_fork(assetdir, fork_rounds, fork_time, copy_time, run_time, ram_copies);
+    if (bad_frame >= 0) {
+        std::printf("Error: fork differs from a copy in round %lld!\n", (long long)bad_frame);
+        return 1;
+    }
+    uint64_t num_forks = fork_rounds * FORK_DEPTH;
+    double run_secs = tim::duration<double>(run_time).count();
+    std::printf("fork: %.0f ns each (%.0f ns to copy by save/load), %.1f pages copied per fork\n",
+        tim::duration<double, std::nano>(fork_time).count() / num_forks,
+        tim::duration<double, std::nano>(copy_time).count() / (copy_rounds * FORK_DEPTH),
+        double(ram_copies) / num_forks);
+    std::printf("fork: %d deep, %d frames each: %.0f forks/s, %.0f frames/s on one core\n",
+        FORK_DEPTH, FORK_FRAMES, num_forks / run_secs, num_forks * FORK_FRAMES / run_secs);
+
+    // machine_lanes. Fewer frames, as each point runs all its lanes.
+    uint64_t lane_frames = std::max<uint64_t>(num_frames / 10, 1);
+    bad_frame = verify_lanes(assetdir, lane_frames, 16);
+    if (bad_frame >= 0) {
+        std::printf("Error: lanes differ from interpreter after frame %lld!\n", (long long)bad_frame);
+        return 1;
+    }
+    std::printf("lanes match interpreter for %llu frames\n", (unsigned long long)lane_frames);
+
+    for (bool playing : { false, true })
+    {
+        std::printf("lanes, %s, %llu frames:\n", playing ? "each playing" : "same inputs",
+            (unsigned long long)lane_frames);
+        double scalar_mhz = 0;
+        for (bool blocks : { false, true }) {
+            uint64_t cycles;
+            clk::duration time;
+            if (bench_scalar_lane(assetdir, lane_frames, playing, blocks, cycles, time) != 0) {
+                return 1;
+            }
+            double secs = tim::duration<double>(time).count();
+            scalar_mhz = cycles / secs / 1e6;
+            std::printf("   %-6s %8.3f s  %8.2f MHz  (one machine, %s)\n", blocks ? "blocks" : "static",
+                secs, scalar_mhz, blocks ? "block cache" : "no block cache");
+        }
+        double lanes_mhz = 0;
+        for (int num_lanes = 1; num_lanes <= I8080_MAX_LANES; num_lanes *= 2)
+        {
+            auto ml = std::make_unique<machine_lanes>();
+            if (ml->init(assetdir, num_lanes) != 0) {
+                return 1;
+            }
+            t_start = clk::now();
+            for (uint64_t i = 0; i < lane_frames; ++i) {
+                if (playing) {
+                    for (int lane = 0; lane < num_lanes; ++lane) {
+                        ml->in_port1[lane] = lane_inputs(lane, i);
+                    }
+                }
+                ml->run_frame();
+            }
+            double secs = tim::duration<double>(clk::now() - t_start).count();
+            uint64_t cycles = 0;
+            for (int lane = 0; lane < num_lanes; ++lane) {
+                cycles += ml->cpu.cycles[lane];
+            }
+            const i8080_lanes_state& c = ml->cpu;
+            lanes_mhz = cycles / secs / 1e6;
+            std::printf("%3d lanes %8.3f s  %8.2f MHz  %5.1f lanes per step, %5.1f%% of steps in lockstep, "
+                "%5.1f%% of cycles alone\n", num_lanes, secs, lanes_mhz,
+                double(c.lane_steps) / std::max<uint64_t>(c.steps, 1),
+                100.0 * c.vector_steps / std::max<uint64_t>(c.steps, 1),
+                100.0 * c.scalar_cycles / std::max<uint64_t>(cycles, 1));
+        }
+        std::printf("   %d lanes: %.2fx one machine with the block cache\n",
+            I8080_MAX_LANES, lanes_mhz / scalar_mhz);
+    }
+    return 0;
+}
@@ -38,6 +38,7 @@ static const char* input_ininame(input type)
     case INPUT_1P_START: return "Input1PStart";
     case INPUT_2P_START: return "Input2PStart";
     case INPUT_CREDIT:   return "InputCredit";
+    case INPUT_REWIND:   return "InputRewind";
     default:
         return nullptr;
     }
@@ -56,6 +57,7 @@ static SDL_Scancode input_dflt_key(input type)
     case INPUT_1P_START: return SDL_SCANCODE_1;
     case INPUT_2P_START: return SDL_SCANCODE_2;
     case INPUT_CREDIT:   return SDL_SCANCODE_RETURN;
+    case INPUT_REWIND:   return SDL_SCANCODE_BACKSPACE;
     default:
         return SDL_SCANCODE_UNKNOWN;
     }
@@ -145,17 +147,8 @@ int emu::resize_window(void)
     return 0;
 }
 
-// like a palette, same order as PIXFMTS
-enum colr_idx : uint8_t
-{
-    COLRIDX_BLACK,
-    COLRIDX_GREEN,
-    COLRIDX_RED,
-    COLRIDX_WHITE,
-};
-
 static const std::array<pix_fmt, 2> PIXFMTS = {
-                                     // black,      green,      red,        white
+                                     // by screen_color: black, green, red, white
     pix_fmt(SDL_PIXELFORMAT_ARGB8888, { 0xFF000000, 0xFF1EFE1E, 0xFFFE1E1E, 0xFFFFFFFF }),
     pix_fmt(SDL_PIXELFORMAT_ABGR8888, { 0xFF000000, 0xFF1EFE1E, 0xFF1E1EFE, 0xFFFFFFFF })
 };
@@ -308,19 +301,18 @@ int emu::init_audio(const fs::path& audio_dir)
     int num_loaded = 0;
     for (int i = 0; i < NUM_SOUNDS; ++i)
     {
-        m.sounds[i] = nullptr;
-        m.sndpins_last[i] = false;
+        m_sounds[i] = nullptr;
 
         for (int j = 0; j < 2; ++j)
         {
             fs::path path = audio_dir / AUDIO_FILENAMES[i][j];
-            m.sounds[i] = Mix_LoadWAV(path.string().c_str());
-            if (m.sounds[i]) {
+            m_sounds[i] = Mix_LoadWAV(path.string().c_str());
+            if (m_sounds[i]) {
                 num_loaded++;
                 break;
             }
         }
-        if (!m.sounds[i]) {
+        if (!m_sounds[i]) {
             logWARNING("Audio file %d (aka %s) is missing", i, AUDIO_FILENAMES[i][1]);
         }
     }
@@ -334,142 +326,21 @@ int emu::init_audio(const fs::path& audio_dir)
     return 0;
 }
 
-static int load_file(const fs::path& path, i8080_word_t* mem, unsigned size)
-{
-    file_ptr file = SAFE_FOPEN(path.c_str(), "rb");
-    if (!file) {
-        logERROR("Could not open file %s", path.string().c_str());
-        return -1;
-    }
-    if (std::fread(mem, 1, size, file.get()) != size) {
-        logERROR("Could not read %u bytes from file %s", size, path.string().c_str());
-        return -1;
-    }
-    std::fgetc(file.get()); // set eof
-    if (!std::feof(file.get())) {
-        logERROR("File %s is larger than %u bytes", path.string().c_str(), size);
-        return -1;
-    }
-    return 0;
-}
+// Machine sound hooks, udata is m_sounds.
 
-int emu::load_rom(const fs::path& dir)
+static void play_sound(void* udata, int idx, bool loop)
 {
-    int e;
-    if (fs::exists(dir / "invaders.rom")) {
-        e = load_file(dir / "invaders.rom", m.mem.get(), 8192);
-        if (e) { return e; }
-        logMESSAGE("Loaded ROM");
-    }
-    else {
-        e = load_file(dir / "invaders.h", &m.mem[0], 2048);    if (e) { return e; }
-        e = load_file(dir / "invaders.g", &m.mem[2048], 2048); if (e) { return e; }
-        e = load_file(dir / "invaders.f", &m.mem[4096], 2048); if (e) { return e; }
-        e = load_file(dir / "invaders.e", &m.mem[6144], 2048); if (e) { return e; }
-
-        logMESSAGE("Loaded ROM files: invaders.e,f,g,h");
-    }
-    return 0;
-}
-
-static inline machine* MACHINE(i8080* cpu) {
-    return static_cast<machine*>(cpu->udata);
-}
-
-// CPU emulation callbacks
-
-static i8080_word_t cpu_mem_read(i8080* cpu, i8080_addr_t addr) {
-    return MACHINE(cpu)->mem[addr];
-}
-
-static void cpu_mem_write(i8080* cpu, i8080_addr_t addr, i8080_word_t word) {
-    MACHINE(cpu)->mem[addr] = word;
-}
-
-static i8080_word_t cpu_intr_read(i8080* cpu) {
-    return MACHINE(cpu)->intr_opcode;
-}
-
-static i8080_word_t cpu_io_read(i8080* cpu, i8080_word_t port)
-{
-    machine* m = MACHINE(cpu);
-    switch (port)
-    {
-    case 0: return m->in_port0;
-    case 1: return m->in_port1;
-    case 2: return m->in_port2;
-
-    case 3: // offset from MSB
-        return i8080_word_t(m->shiftreg >> (8 - m->shiftreg_off));
-
-    default:
-        logWARNING("IO read from unmapped port %d", int(port));
-        return 0;
-    }
-}
-
-static bool snd_is_looping(int idx)
-{
-    return idx == 0 || idx == 9;
-}
-
-// looping: repeat sound while pin is on.
-// non-looping: restart sound every positive edge (off->on)
-static void handle_sound(machine* m, int idx, bool pin_on)
-{
-    if (!m->sounds[idx]) {
-        return;
-    }
-    if (pin_on) {
-        if (!m->sndpins_last[idx]) {
-            int loops = snd_is_looping(idx) ? -1 : 0;
-            Mix_PlayChannel(idx, m->sounds[idx], loops);
-            m->sndpins_last[idx] = true;
-        }
-    }
-    else {
-        if (snd_is_looping(idx)) {
-            Mix_HaltChannel(idx);
-        }
-        m->sndpins_last[idx] = false;
+    Mix_Chunk** sounds = static_cast<Mix_Chunk**>(udata);
+    if (sounds[idx]) {
+        Mix_PlayChannel(idx, sounds[idx], loop ? -1 : 0);
     }
 }
 
-static void cpu_io_write(i8080* cpu, i8080_word_t port, i8080_word_t word)
+static void stop_sound(void* udata, int idx)
 {
-    machine* m = MACHINE(cpu);
-    switch (port)
-    {
-    case 2:
-        m->shiftreg_off = (word & 0x7);
-        break;
-
-    case 4:
-        // shift from MSB
-        m->shiftreg >>= 8;
-        m->shiftreg |= (i8080_dword_t(word) << 8);
-        break;
-
-    case 3:
-        for (int i = 0; i < 4; ++i) {
-            handle_sound(m, i, get_bit(word, i));
-        }
-        handle_sound(m, 9, get_bit(word, 4));
-        break;
-
-    case 5:
-        for (int i = 0; i < 5; ++i) {
-            handle_sound(m, i + 4, get_bit(word, i));
-        }
-        break;
-
-        // Watchdog port. Resets machine if unresponsive, 
-        // not required for an emulator
-    case 6: break;
-
-    default:
-        logWARNING("IO write to unmapped port %d", int(port));
-        break;
+    Mix_Chunk** sounds = static_cast<Mix_Chunk**>(udata);
+    if (sounds[idx]) {
+        Mix_HaltChannel(idx);
     }
 }
 
@@ -496,6 +367,8 @@ void emu::log_dbginfo()
         SDL_MIXER_MAJOR_VERSION, SDL_MIXER_MINOR_VERSION, SDL_MIXER_PATCHLEVEL,
         mix_version->major, mix_version->minor, mix_version->patch);
 
+    logMESSAGE("CPU dispatch: %s", i8080::dispatch_mode());
+
     emu_gui::log_dbginfo();
 }
 
@@ -507,17 +380,26 @@ emu::emu() :
     m_dispsize({ .x = 0,.y = 0 }),
     m_viewportrect({ .x = 0,.y = 0,.w = 0,.h = 0 }),
     m_viewporttex(nullptr),
+    m_runahead(0),
+    m_runahead_frames(0),
+    m_frame_us(0),
+    m_frames_timed(0),
+    m_runahead_state(std::make_unique<unsigned char[]>(MACHINE_SAVE_SIZE)),
+    m_hashlog(nullptr),
+    m_hashlog_frame(0),
     m_volume(0),
     m_audiopaused(false),
     m_delta_t(-1),
     m_hiscore(0),
     m_hiscore_in_vmem(false),
+    m_cputime(0),
+    m_cpucycles(0),
 #ifdef __EMSCRIPTEN__
     m_resizepending(false),
 #endif
     m_ok(false)
 {
-    std::fill_n(m.sounds, NUM_SOUNDS, nullptr);
+    std::fill_n(m_sounds, NUM_SOUNDS, nullptr);
 
     std::fill_n(m_guiinputpressed.begin(), NUM_INPUTS, false);
 
@@ -541,12 +423,15 @@ bool emcc_on_viz_change(int, const EmscriptenVisibilityChangeEvent* event, void*
 }
 #endif
 
-emu::emu(const fs::path& assetdir, const std::string& render_hint, bool enable_ui) :
+emu::emu(const fs::path& assetdir, const std::string& render_hint, bool enable_ui, bool headless) :
     emu()
 {
     log_dbginfo();
 
-    if (init_graphics(assetdir, render_hint, enable_ui) != 0 ||
+    if (headless) {
+        m_pixfmt = &PIXFMTS[0];
+    }
+    else if (init_graphics(assetdir, render_hint, enable_ui) != 0 ||
         init_audio(assetdir) != 0) {
         return;
     }
@@ -571,25 +456,13 @@ emu::emu(const fs::path& assetdir, const std::string& render_hint, bool enable_u
     }
 #endif
 
-    m.mem = std::make_unique<i8080_word_t[]>(65536);
-    if (load_rom(assetdir) != 0) {
+    if (m.init(assetdir) != 0 ||
+        m_rewind.init(REWIND_DEFAULT_FRAMES, REWIND_DEFAULT_ARENA) != 0) {
         return;
     }
-
-    m.cpu.mem_read = cpu_mem_read;
-    m.cpu.mem_write = cpu_mem_write;
-    m.cpu.io_read = cpu_io_read;
-    m.cpu.io_write = cpu_io_write;
-    m.cpu.intr_read = cpu_intr_read;
-    m.cpu.udata = &m;
-    m.cpu.reset();
-
-    m.in_port0 = 0x0e; // debug port
-    m.in_port1 = 0x08;
-    m.in_port2 = 0;
-    m.shiftreg = 0;
-    m.shiftreg_off = 0;
-    m.intr_opcode = i8080_NOP;
+    m.play_sound = play_sound;
+    m.stop_sound = stop_sound;
+    m.snd_udata = m_sounds;
 
     m_ok = true;
 }
@@ -601,8 +474,14 @@ emu::~emu()
     emscripten_set_resize_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, NULL, 0, NULL);
 #endif
 
+    if (m.io_trace) {
+        std::fclose(m.io_trace);
+    }
+    if (m_hashlog) {
+        std::fclose(m_hashlog);
+    }
     for (int i = 0; i < NUM_SOUNDS; ++i) {
-        Mix_FreeChunk(m.sounds[i]);
+        Mix_FreeChunk(m_sounds[i]);
     }
     Mix_CloseAudio();
     SDL_DestroyTexture(m_viewporttex);
@@ -616,6 +495,12 @@ emu::~emu()
 
 void emu::set_switch(int index, bool value)
 {
+    // player 1's switches were sent to player 2 at the start,
+    // and movies set their own. While recording they can change,
+    // the movie records them like any other input.
+    if (netplay_active() || m_player) {
+        return;
+    }
     switch (index)
     {
     case 3: set_bit(&m.in_port2, 0, value); break;
@@ -654,83 +539,252 @@ void emu::set_volume(int new_volume)
     }
 }
 
-void emu::emulate_cpu(uint64_t frame_idx, uint64_t& target_cycles)
+int emu::trace_io(const fs::path& file)
 {
-    // pass input to machine ports
-    set_bit(&m.in_port1, 0, m_keypressed[m_input2key[INPUT_CREDIT]]   || m_guiinputpressed[INPUT_CREDIT]);
-    set_bit(&m.in_port1, 1, m_keypressed[m_input2key[INPUT_2P_START]] || m_guiinputpressed[INPUT_2P_START]);
-    set_bit(&m.in_port1, 2, m_keypressed[m_input2key[INPUT_1P_START]] || m_guiinputpressed[INPUT_1P_START]);
-    set_bit(&m.in_port1, 4, m_keypressed[m_input2key[INPUT_P1_FIRE]]  || m_guiinputpressed[INPUT_P1_FIRE]);
-    set_bit(&m.in_port1, 5, m_keypressed[m_input2key[INPUT_P1_LEFT]]  || m_guiinputpressed[INPUT_P1_LEFT]);
-    set_bit(&m.in_port1, 6, m_keypressed[m_input2key[INPUT_P1_RIGHT]] || m_guiinputpressed[INPUT_P1_RIGHT]);
-    set_bit(&m.in_port2, 4, m_keypressed[m_input2key[INPUT_P2_FIRE]]  || m_guiinputpressed[INPUT_P2_FIRE]);
-    set_bit(&m.in_port2, 5, m_keypressed[m_input2key[INPUT_P2_LEFT]]  || m_guiinputpressed[INPUT_P2_LEFT]);
-    set_bit(&m.in_port2, 6, m_keypressed[m_input2key[INPUT_P2_RIGHT]] || m_guiinputpressed[INPUT_P2_RIGHT]);
-
-    // 33333.33 clk cycles at emulated CPU's 2Mhz clock speed (16667us/0.5us)
-    uint64_t frame_cycles = 33333 + (frame_idx % 3 == 0);
-    uint64_t prev_targetcycles = target_cycles;
-
-    // run till mid-screen
-    // 14286 = (96/224) * (16667us/0.5us)
-    while (m.cpu.cycles - prev_targetcycles < 14286) {
-        m.cpu.step();
-    }
-    m.intr_opcode = i8080_RST_1;
-    m.cpu.interrupt();
-
-    // run till end of screen (start of VBLANK)
-    while (m.cpu.cycles - prev_targetcycles < frame_cycles) {
-        m.cpu.step();
-    }
-    m.intr_opcode = i8080_RST_2;
-    m.cpu.interrupt();
-
-    // extra cycles adjusted in next frame
-    target_cycles += frame_cycles;
+    std::FILE* trace = std::fopen(file.string().c_str(), "w");
+    if (!trace) {
+        logERROR("Could not open %s", file.string().c_str());
+        return -1;
+    }
+    if (m.io_trace) {
+        std::fclose(m.io_trace);
+    }
+    m.io_trace = trace;
+    return 0;
 }
 
-// Pixel color after gel overlay
-// https://tcrf.net/images/a/af/SpaceInvadersArcColorUseTV.png
-static colr_idx pixel_color(uint x, uint y)
+int emu::log_hashes(const fs::path& file)
 {
-    if ((y <= 15 && x > 24 && x < 136) || (y > 15 && y < 71)) {
-        return COLRIDX_GREEN;
+    std::FILE* log = std::fopen(file.string().c_str(), "w");
+    if (!log) {
+        logERROR("Could not open %s", file.string().c_str());
+        return -1;
     }
-    else if (y >= 192 && y < 223) {
-        return COLRIDX_RED;
+    if (m_hashlog) {
+        std::fclose(m_hashlog);
     }
-    else { return COLRIDX_WHITE; }
+    m_hashlog = log;
+    return 0;
 }
 
-void emu::render_screen()
+int emu::record_movie(const fs::path& file)
 {
-    void* pixels; int pitch;
-    SDL_LockTexture(m_viewporttex, NULL, &pixels, &pitch);
+    auto recorder = std::make_unique<movie_recorder>();
+    if (recorder->open(file) != 0) {
+        return -1;
+    }
+    m_recorder = std::move(recorder);
+    return 0;
+}
 
-    const uint texpitch = pitch / 4;
-    uint32_t* texpixels = static_cast<uint32_t*>(pixels);
+void emu::stop_recording()
+{
+    if (m_recorder) {
+        // what spaceinvaders-verify checks (src/verify.cpp)
+        logMESSAGE("Recorded %llu frames, high score %04x, state hash %016llx",
+            (unsigned long long)m_recorder->frames,
+            unsigned(m.read_mem(HISCORE_START_ADDR) | (m.read_mem(HISCORE_START_ADDR + 1) << 8)),
+            (unsigned long long)machine_hash(m));
+        m_recorder->close();
+        m_recorder.reset();
+    }
+}
 
-    uint VRAM_idx = 0;
-    i8080_word_t* VRAM_start = &m.mem[VRAM_START_ADDR];
+int emu::replay_movie(const fs::path& file, uint64_t from)
+{
+    auto player = std::make_unique<movie_player>();
+    if (player->open(file) != 0 || player->seek(m, from) != 0) {
+        return -1;
+    }
+    logMESSAGE("Replaying %s from frame %llu of %llu", file.string().c_str(),
+        (unsigned long long)from, (unsigned long long)player->num_frames());
+    m_player = std::move(player);
+    return 0;
+}
 
-    // Unpack (8 on/off pixels per byte) and rotate counter-clockwise
-    for (uint x = 0; x < RES_NATIVE_X; ++x)
-    {
-        for (uint y = 0; y < RES_NATIVE_Y; y += 8)
-        {
-            i8080_word_t word = VRAM_start[VRAM_idx++];
+#ifndef __EMSCRIPTEN__
+void emu::set_netplay(const netplay_config& config)
+{
+    m_netplaycfg = std::make_unique<netplay_config>(config);
+}
+#endif
 
-            for (int bit = 0; bit < 8; ++bit)
-            {
-                colr_idx colridx = get_bit(word, bit) ? pixel_color(x, y) : COLRIDX_BLACK;
-                uint32_t color = m_pixfmt->colors[colridx];
+bool emu::netplay_active() const
+{
+#ifdef __EMSCRIPTEN__
+    return false;
+#else
+    return m_netplay != nullptr;
+#endif
+}
+
+bool emu::input_pressed(input inp) const
+{
+    return m_keypressed[m_input2key[inp]] || m_guiinputpressed[inp];
+}
 
-                uint idx = texpitch * (RES_NATIVE_Y - y - bit - 1) + x;
-                texpixels[idx] = color;
+void emu::emulate_cpu()
+{
+#ifndef __EMSCRIPTEN__
+    // The other player's inputs come from the network. Runs no
+    // frame (and the screen stays) while they are too far behind.
+    if (m_netplay) {
+        bool p2 = m_netplay->config.player == 2;
+        netplay_input inputs = 0;
+        set_bit(&inputs, 0, input_pressed(INPUT_CREDIT));
+        set_bit(&inputs, 1, input_pressed(INPUT_2P_START));
+        set_bit(&inputs, 2, input_pressed(INPUT_1P_START));
+        set_bit(&inputs, 4, input_pressed(p2 ? INPUT_P2_FIRE : INPUT_P1_FIRE));
+        set_bit(&inputs, 5, input_pressed(p2 ? INPUT_P2_LEFT : INPUT_P1_LEFT));
+        set_bit(&inputs, 6, input_pressed(p2 ? INPUT_P2_RIGHT : INPUT_P1_RIGHT));
+
+        clk::time_point t_start = clk::now();
+        uint64_t start_cycles = m.cpu.cycles;
+        m_netplay->advance(m, inputs);
+        m_cputime += clk::now() - t_start;
+        m_cpucycles += m.cpu.cycles - start_cycles;
+
+        // m ran up to netplay frame m_netplay->frame - 1, but only
+        // the confirmed frames won't be run again
+        for (; m_hashlog && m_hashlog_frame < m_netplay->confirmed_frames(); ++m_hashlog_frame) {
+            uint64_t hash;
+            if (m_netplay->frame_hash(m, m_hashlog_frame, hash)) {
+                uint64_t frame_idx = m.frame_idx - (m_netplay->frame - (m_hashlog_frame + 1));
+                std::fprintf(m_hashlog, "%llu %016llx\n",
+                    (unsigned long long)frame_idx, (unsigned long long)hash);
             }
         }
+        return;
+    }
+#endif
+    // While rewind is held, go back a frame instead. Stays on the
+    // oldest frame once there are no more. Movies only go forward.
+    if (input_pressed(INPUT_REWIND) && !m_recorder && !m_player) {
+        m_rewind.step_back(m);
+        return;
+    }
+
+    if (m_player && m_player->frame == m_player->num_frames()) {
+        logMESSAGE("Replay finished, %llu frames differed from the recording",
+            (unsigned long long)m_player->desyncs);
+        m_player.reset();
+    }
+    if (!m_player) {
+        // pass input to machine ports
+        set_bit(&m.in_port1, 0, input_pressed(INPUT_CREDIT));
+        set_bit(&m.in_port1, 1, input_pressed(INPUT_2P_START));
+        set_bit(&m.in_port1, 2, input_pressed(INPUT_1P_START));
+        set_bit(&m.in_port1, 4, input_pressed(INPUT_P1_FIRE));
+        set_bit(&m.in_port1, 5, input_pressed(INPUT_P1_LEFT));
+        set_bit(&m.in_port1, 6, input_pressed(INPUT_P1_RIGHT));
+        set_bit(&m.in_port2, 4, input_pressed(INPUT_P2_FIRE));
+        set_bit(&m.in_port2, 5, input_pressed(INPUT_P2_LEFT));
+        set_bit(&m.in_port2, 6, input_pressed(INPUT_P2_RIGHT));
+    }
+    // Record from when the high score is in RAM (see run()),
+    // so the movie starts with it.
+    if (m_recorder && m_hiscore_in_vmem) {
+        m_recorder->frame(m);
+    }
+
+    clk::time_point t_start = clk::now();
+    uint64_t start_cycles = m.cpu.cycles;
+
+    if (m_player) {
+        m_player->step(m);
+    }
+    else {
+        m.run_frame();
+    }
+
+    clk::duration frame_time = clk::now() - t_start;
+    m_cputime += frame_time;
+    m_cpucycles += m.cpu.cycles - start_cycles;
+    update_runahead(tim::duration<double, std::micro>(frame_time).count());
+
+    if (m_hashlog) {
+        std::fprintf(m_hashlog, "%llu %016llx\n",
+            (unsigned long long)m.frame_idx, (unsigned long long)machine_hash(m));
+    }
+
+    m_rewind.push(m);
+}
+
+void emu::set_runahead(int frames)
+{
+    frames = std::clamp(frames, 0, RUNAHEAD_MAX_FRAMES);
+    if (frames != m_runahead) {
+        m_runahead = m_runahead_frames = frames;
+        m_frames_timed = 0;
+    }
+}
+
+// The game reads inputs partway through a frame, so a press often
+// only shows a frame later. Run-ahead runs the next frames with the
+// same inputs and draws the last of them, then goes back to the state
+// before them, with their sounds muted. Returns false if it is off
+// (or rewinding) and the current frame should be drawn instead. It
+// stays on while recording, which only sees the frames kept.
+bool emu::run_ahead()
+{
+    if (m_runahead_frames == 0 || input_pressed(INPUT_REWIND) || netplay_active() || m_player) {
+        return false;
+    }
+    m.save_state(m_runahead_state.get(), MACHINE_SAVE_SIZE);
+    m.mute_sound = true;
+    for (int i = 0; i < m_runahead_frames; ++i) {
+        m.run_frame();
+    }
+    render_screen();
+    m.load_state(m_runahead_state.get(), MACHINE_SAVE_SIZE);
+    m.mute_sound = false;
+    return true;
+}
+
+// Fit the frames run ahead to RUNAHEAD_BUDGET_US, by how long the
+// frames emulate_cpu() runs take, over about the last second. A
+// single slow frame (eg. while the window is dragged) counts for at
+// most two budgets, so only a sustained overrun turns run-ahead down,
+// and it goes back up once the frames fit again with some to spare.
+// Either way, only after a second at the current setting.
+void emu::update_runahead(double frame_us)
+{
+    if (m_runahead == 0) {
+        return;
+    }
+    frame_us = std::min(frame_us, 2.0 * RUNAHEAD_BUDGET_US);
+    m_frame_us = m_frame_us > 0 ? m_frame_us + (frame_us - m_frame_us) / 64 : frame_us;
+    if (++m_frames_timed < 64) {
+        return;
     }
+    if (m_runahead_frames > 0 && m_frame_us * m_runahead_frames > RUNAHEAD_BUDGET_US) {
+        m_runahead_frames--;
+        m_frames_timed = 0;
+        logWARNING("Run-ahead is over its %d us budget, reduced to %d frames",
+            RUNAHEAD_BUDGET_US, m_runahead_frames);
+    }
+    else if (m_runahead_frames < m_runahead &&
+        m_frame_us * (m_runahead_frames + 1) < RUNAHEAD_BUDGET_US * 0.75) {
+        m_runahead_frames++;
+        m_frames_timed = 0;
+        logMESSAGE("Run-ahead fits in its %d us budget again, back to %d frames",
+            RUNAHEAD_BUDGET_US, m_runahead_frames);
+    }
+}
+
+// Emulated clock speed, measured over the time spent in emulate_cpu().
+// The real machine runs at 2 MHz.
+double emu::emulated_mhz() const
+{
+    double secs = tim::duration<double>(m_cputime).count();
+    return secs > 0 ? m_cpucycles / secs / 1e6 : 0;
+}
+
+void emu::render_screen()
+{
+    void* pixels; int pitch;
+    SDL_LockTexture(m_viewporttex, NULL, &pixels, &pitch);
+    m.draw_screen(static_cast<uint32_t*>(pixels), pitch / 4, m_pixfmt->colors.data());
     SDL_UnlockTexture(m_viewporttex);
     SDL_RenderCopy(m_renderer, m_viewporttex, NULL, &m_viewportrect);
 }
@@ -853,6 +907,14 @@ int emu::load_udata()
         }
         set_volume(volume.value());
     }
+    auto runahead = ini.get_num<int>("Settings", "RunAhead");
+    if (runahead.has_value()) {
+        if (runahead < 0 || runahead > RUNAHEAD_MAX_FRAMES) {
+            logERROR("%s: Invalid run-ahead", ini.path_cstr());
+            return -1;
+        }
+        set_runahead(runahead.value());
+    }
     for (int i = 3; i < 8; ++i)
     {
         char sw_name[] = { 'D', 'I', 'P', char('0' + i), '\0' };
@@ -902,6 +964,7 @@ int emu::save_udata()
     ini.write_section("Settings");
 
     ini.write_keyvalue("Volume", std::to_string(m_volume));
+    ini.write_keyvalue("RunAhead", std::to_string(m_runahead));
 
     for (int i = 3; i < 8; ++i)
     {
@@ -922,8 +985,8 @@ int emu::save_udata()
 
     if (m_hiscore_in_vmem)
     {
-        uint16_t new_hiscore = m.mem[HISCORE_START_ADDR] |
-            (uint16_t(m.mem[HISCORE_START_ADDR + 1]) << 8);
+        uint16_t new_hiscore = m.read_mem(HISCORE_START_ADDR) |
+            (uint16_t(m.read_mem(HISCORE_START_ADDR + 1)) << 8);
 
         // in case two instances of the game are running, 
         // don't overwrite a higher score set by the other instance
@@ -1128,12 +1191,24 @@ int emu::run()
     int err = load_udata();
     if (err) { return err; }
 
+#ifndef __EMSCRIPTEN__
+    if (m_netplaycfg && (m_recorder || m_player)) {
+        logERROR("Movies can't be recorded or replayed with netplay");
+        return -1;
+    }
+    if (m_netplaycfg) {
+        m_netplay = std::make_unique<netplay>();
+        if (m_netplay->start(*m_netplaycfg, m) != 0) {
+            return -1;
+        }
+    }
+#endif
+
     logMESSAGE("Starting emulator...");
 
     SDL_ShowWindow(m_window);
 
     uint64_t frame_idx = 0;
-    uint64_t target_clkcycles = 0;
     clk::time_point t_start = clk::now();
 
 #ifdef __EMSCRIPTEN__
@@ -1161,19 +1236,23 @@ int emu::run()
             break;
         }
 #endif
-        // nasty workaround, since the score table is erased in frame 0
-        if (frame_idx == 1) [[unlikely]] {
-            m.mem[HISCORE_START_ADDR] = uint8_t(m_hiscore);
-            m.mem[HISCORE_START_ADDR + 1] = uint8_t(m_hiscore >> 8);
+        // nasty workaround, since the score table is erased in frame 0.
+        // Not with netplay, where both machines must stay the same,
+        // or movies, which have the recorded one.
+        if (frame_idx == 1 && !netplay_active() && !m_player) [[unlikely]] {
+            m.write_ram(HISCORE_START_ADDR, uint8_t(m_hiscore));
+            m.write_ram(HISCORE_START_ADDR + 1, uint8_t(m_hiscore >> 8));
             m_hiscore_in_vmem = true;
         }
 
         if (!m_gui || m_gui->current_view() == VIEW_GAME)
         {
             // Emulate CPU for 1 frame.
-            emulate_cpu(frame_idx, target_clkcycles);
-            // Draw game.
-            render_screen();
+            emulate_cpu();
+            // Draw game, or the frames ahead of it.
+            if (!run_ahead()) {
+                render_screen();
+            }
 
             if (m_audiopaused) {
                 Mix_Resume(-1);
@@ -1205,5 +1284,74 @@ int emu::run()
     EMCC_MAINLOOP_END;
 #endif
 
+    logMESSAGE("Emulated CPU speed: %.2f MHz (%s dispatch)",
+        emulated_mhz(), i8080::dispatch_mode());
+    m.log_unmapped_ports();
+    stop_recording();
+#ifndef __EMSCRIPTEN__
+    if (m_netplay) {
+        logMESSAGE("Netplay: %llu frames, %llu rollbacks (%llu frames run again), %llu waits",
+            (unsigned long long)m_netplay->frame, (unsigned long long)m_netplay->rollbacks,
+            (unsigned long long)m_netplay->frames_rerun, (unsigned long long)m_netplay->waits);
+    }
+#endif
+    return 0;
+}
+
+#ifndef __EMSCRIPTEN__
+int emu::run_headless(uint64_t num_frames, bool uncapped, bool render)
+{
+    if (m_netplaycfg) {
+        logERROR("Netplay needs a window");
+        return -1;
+    }
+    // movies start once the saved high score is in,
+    // and headless runs don't load it
+    if (m_recorder) {
+        logERROR("Movies can't be recorded headless");
+        return -1;
+    }
+    if (render) {
+        m_offscreen.assign(RES_NATIVE_X * RES_NATIVE_Y, 0);
+    }
+
+    clk::duration emulate_time(0), render_time(0), wait_time(0);
+    clk::time_point t_run = clk::now();
+    clk::time_point t_frame = t_run;
+
+    for (uint64_t i = 0; i < num_frames; ++i)
+    {
+        clk::time_point t_start = clk::now();
+        emulate_cpu();
+        clk::time_point t_end = clk::now();
+        emulate_time += t_end - t_start;
+
+        if (render) {
+            m.draw_screen(m_offscreen.data(), RES_NATIVE_X, m_pixfmt->colors.data());
+            render_time += clk::now() - t_end;
+        }
+        if (!uncapped) {
+            t_start = clk::now();
+            vsync(t_frame);
+            t_frame = clk::now();
+            wait_time += t_frame - t_start;
+        }
+    }
+    double secs = tim::duration<double>(clk::now() - t_run).count();
+    auto us_per_frame = [=](clk::duration time) {
+        return tim::duration<double, std::micro>(time).count() / std::max<uint64_t>(num_frames, 1);
+    };
+
+    logMESSAGE("Ran %llu frames in %.2f s, %.0f frames/s (%.1fx real time)",
+        (unsigned long long)num_frames, secs, num_frames / std::max(secs, 1e-9),
+        num_frames / std::max(secs, 1e-9) / 60);
+    logMESSAGE("Emulated CPU speed: %.2f MHz (%s dispatch)",
+        emulated_mhz(), i8080::dispatch_mode());
+    logMESSAGE("Per frame: %.1f us machine, %.1f us rewind/replay, %.1f us drawing, %.1f us waiting",
+        us_per_frame(m_cputime), us_per_frame(emulate_time - m_cputime),
+        us_per_frame(render_time), us_per_frame(wait_time));
+    m.log_unmapped_ports();
+    logMESSAGE("State hash: %016llx", (unsigned long long)machine_hash(m));
     return 0;
 }
+#endif
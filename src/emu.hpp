@@ -5,9 +5,15 @@
 #include <array>
 #include <memory>
 #include <bitset>
+#include <vector>
 
-#include "i8080/i8080.hpp"
+#include "machine.hpp"
+#include "movie.hpp"
+#include "rewind.hpp"
 #include "utils.hpp"
+#ifndef __EMSCRIPTEN__
+#include "netplay.hpp"
+#endif
 
 #include <SDL.h>
 #include <SDL_mixer.h>
@@ -16,17 +22,17 @@
 #include <emscripten/html5.h>
 #endif
 
-#define RES_NATIVE_X 224
-#define RES_NATIVE_Y 256
+#define RES_NATIVE_X SCREEN_WIDTH
+#define RES_NATIVE_Y SCREEN_HEIGHT
 #define RES_SCALE_DEFAULT 3
 
-#define NUM_SOUNDS 10
 #define VOLUME_DEFAULT 50
 
-// todo: these assume a compatible ROM
-#define VRAM_START_ADDR 0x2400
-#define GAMEMODE_ADDR 0x20ef
-#define HISCORE_START_ADDR 0x20f4
+// Run-ahead shows up to this many frames after the current one.
+// If they take longer than the budget (on average), fewer are run
+// until they fit again.
+#define RUNAHEAD_MAX_FRAMES 2
+#define RUNAHEAD_BUDGET_US 4000
 
 enum input : uint8_t
 {
@@ -42,36 +48,18 @@ enum input : uint8_t
     INPUT_2P_START,
     INPUT_CREDIT,
 
-    NUM_INPUTS
-};
-
-struct machine
-{
-    i8080 cpu;
-    std::unique_ptr<i8080_word_t[]> mem;
-
-    i8080_word_t in_port0;
-    i8080_word_t in_port1;
-    i8080_word_t in_port2;
-
-    // Video chip interrupts
-    i8080_word_t intr_opcode;
+    // Held to step back through the last minute, see rewind_buffer.
+    INPUT_REWIND,
 
-    // Shift register chip
-    i8080_dword_t shiftreg;
-    i8080_word_t shiftreg_off;
-
-    // Sound chip
-    Mix_Chunk* sounds[NUM_SOUNDS];
-    std::bitset<NUM_SOUNDS> sndpins_last;
+    NUM_INPUTS
 };
 
 struct pix_fmt
 {
     uint32_t fmt;
-    std::array<uint32_t, 4> colors;
+    std::array<uint32_t, NUM_SCREEN_COLORS> colors;
 
-    pix_fmt(uint32_t fmt, std::array<uint32_t, 4> pal) :
+    pix_fmt(uint32_t fmt, std::array<uint32_t, NUM_SCREEN_COLORS> pal) :
         fmt(fmt),
         colors(pal)
     {
@@ -100,6 +88,12 @@ struct emu_interface
     int get_volume() const;
     void set_volume(int volume);
 
+    // Frames to run ahead, see emu::run_ahead(). The frames actually
+    // run may be fewer, if they don't fit in RUNAHEAD_BUDGET_US.
+    int get_runahead() const;
+    void set_runahead(int frames);
+    int runahead_frames() const;
+
     // Delta t for last frame.
     float delta_t() const;
 
@@ -113,18 +107,54 @@ private:
 
 struct emu
 {
+    // If headless, there is no window or sound, see run_headless().
     emu(const fs::path& asset_dir,
         const std::string& render_hint = "",
-        bool enable_ui = true);
+        bool enable_ui = true,
+        bool headless = false);
 
     ~emu();
 
     bool ok() const { return m_ok; }
 
+    // Write every IN/OUT the CPU does to file.
+    int trace_io(const fs::path& file);
+
+    // Write the frame number and machine_hash() to file after every
+    // frame that is kept: not the ones run ahead, and with netplay
+    // once both players' inputs for it are in (not the predicted
+    // frames rollback runs again). Nothing while rewinding.
+    int log_hashes(const fs::path& file);
+
+    // Record the game to a movie (see movie.hpp). It starts on the
+    // first frame with the high score in RAM, and ends on exit.
+    int record_movie(const fs::path& file);
+
+    // Play a movie back from frame from, then go on from
+    // where it ends with the keyboard.
+    int replay_movie(const fs::path& file, uint64_t from);
+
+#ifndef __EMSCRIPTEN__
+    // Play over the network, see netplay.hpp. Starts in run(),
+    // after the settings are loaded. Local keys control config.player
+    // (with that player's key mapping), and the coin/start keys.
+    void set_netplay(const netplay_config& config);
+#endif
+
     // Start running.
     // Returns <0 on error, otherwise 0 when window is closed.
     int run();
 
+#ifndef __EMSCRIPTEN__
+    // Run num_frames frames without a window, sound or settings, as
+    // fast as possible if uncapped, else at 60 fps. With render, each
+    // frame is also drawn to a buffer in memory. Logs how fast each
+    // part ran and the final state hash (see machine_hash()), which
+    // is the same on every host. For an emu constructed headless.
+    // Returns <0 on error.
+    int run_headless(uint64_t num_frames, bool uncapped, bool render);
+#endif
+
 private:
     emu();
 
@@ -133,7 +163,6 @@ private:
     int init_texture(SDL_Renderer* renderer, const SDL_RendererInfo& rend_info);
     int init_graphics(const fs::path& assetdir, const std::string& render_hint, bool enable_ui);
     int init_audio(const fs::path& audiodir);
-    int load_rom(const fs::path& dir);
 
     int read_hiscore(uint16_t& out_hiscore);
     int load_udata();
@@ -153,11 +182,20 @@ private:
     void set_switch(int index, bool value);
     void set_volume(int volume);
 
-    void emulate_cpu(uint64_t frame_idx, uint64_t& target_cycles);
+    void emulate_cpu();
+    bool netplay_active() const;
+    bool run_ahead();
+    void update_runahead(double frame_us);
+    bool input_pressed(input inp) const;
+    void set_runahead(int frames);
     void render_screen();
+    void stop_recording();
+
+    double emulated_mhz() const;
 
 private:
     machine m;
+    rewind_buffer m_rewind;
     SDL_Window* m_window;
     SDL_Renderer* m_renderer;
     
@@ -165,12 +203,35 @@ private:
     SDL_Point m_dispsize;
     SDL_Rect m_viewportrect;
     SDL_Texture* m_viewporttex;
+    std::vector<uint32_t> m_offscreen; // drawn to when headless
     std::unique_ptr<emu_gui> m_gui;
     
     std::array<bool, NUM_INPUTS> m_guiinputpressed;
     std::bitset<SDL_NUM_SCANCODES> m_keypressed;
     std::array<SDL_Scancode, NUM_INPUTS> m_input2key;
 
+    // Run-ahead setting, frames that fit in the budget, average
+    // time a frame takes, frames timed since the last change
+    // and the state to go back to.
+    int m_runahead;
+    int m_runahead_frames;
+    double m_frame_us;
+    int m_frames_timed;
+    std::unique_ptr<unsigned char[]> m_runahead_state;
+
+    // See log_hashes(), and the next netplay frame to log.
+    std::FILE* m_hashlog;
+    uint64_t m_hashlog_frame;
+
+    std::unique_ptr<movie_recorder> m_recorder;
+    std::unique_ptr<movie_player> m_player;
+
+#ifndef __EMSCRIPTEN__
+    std::unique_ptr<netplay_config> m_netplaycfg;
+    std::unique_ptr<netplay> m_netplay;
+#endif
+
+    Mix_Chunk* m_sounds[NUM_SOUNDS];
     int m_volume;
     bool m_audiopaused;
 
@@ -179,6 +240,10 @@ private:
 
     float m_delta_t;
 
+    // Time/cycles spent in emulate_cpu()
+    clk::duration m_cputime;
+    uint64_t m_cpucycles;
+
 #ifdef __EMSCRIPTEN__
     bool m_resizepending;
     bool m_paused;
@@ -211,6 +276,16 @@ inline void emu_interface::set_volume(int volume) {
     m_emu->set_volume(volume); 
 }
 
+inline int emu_interface::get_runahead() const {
+    return m_emu->m_runahead;
+}
+inline void emu_interface::set_runahead(int frames) {
+    m_emu->set_runahead(frames);
+}
+inline int emu_interface::runahead_frames() const {
+    return m_emu->m_runahead_frames;
+}
+
 inline void emu_interface::send_input(input inp, bool pressed) {
     m_emu->send_input(inp, pressed);
 }
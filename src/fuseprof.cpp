@@ -0,0 +1,136 @@
+//
+// Superinstruction profiler.
+//
+// Runs the game's attract mode with the block cache, counting how
+// often each pair of opcodes runs one after the other inside a block,
+// and writes the hottest pairs as an i8080_fused.inc for the core's
+// fused handlers (see fuse_ops() in i8080_impl.hpp). Also prints how
+// many flag updates were dead (see find_live_flags()). Regenerate it
+// with this whenever the core or the game changes:
+//
+//     spaceinvaders-fuseprof assets 20000 src/i8080/i8080_fused.inc
+//
+// usage: spaceinvaders-fuseprof <asset-dir> <frames> <output.inc> [max-pairs]
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "i8080/i8080_impl.hpp"
+#include "machine.hpp"
+
+#define DEFAULT_MAX_PAIRS 24
+// Pairs that run less often than this are not worth a handler.
+#define MIN_SHARE 0.002
+
+struct pair_count
+{
+    unsigned pair; // first << 8 | second
+    std::uint64_t count;
+};
+
+// Opcode name without its operand values, eg. "mvi b" or "lxi h".
+static std::string op_name(unsigned opcode)
+{
+    std::string name = OP_TO_STR[opcode];
+    const char* args = OPARGS_TO_STR[opcode];
+    if (args) {
+        std::string a = args;
+        std::size_t imm = a.find('%');
+        if (imm != std::string::npos) {
+            a.erase(imm);
+        }
+        while (!a.empty() && (a.back() == ' ' || a.back() == ',')) {
+            a.pop_back();
+        }
+        if (!a.empty()) {
+            name += " " + a;
+        }
+    }
+    return name;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 4 && argc != 5) {
+        std::fprintf(stderr, "usage: spaceinvaders-fuseprof <asset-dir> <frames> <output.inc> [max-pairs]\n");
+        return 1;
+    }
+    const char* assetdir = argv[1];
+    uint64_t num_frames = std::strtoull(argv[2], nullptr, 10);
+    const char* out_path = argv[3];
+    std::size_t max_pairs = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : DEFAULT_MAX_PAIRS;
+
+    auto m = std::make_unique<machine>();
+    auto profile = std::make_unique<i8080_profile>();
+    if (m->init(assetdir) != 0) {
+        return 1;
+    }
+    m->blocks->profile = profile.get();
+
+    for (uint64_t i = 0; i < num_frames; ++i) {
+        m->run_frame();
+    }
+
+    std::vector<pair_count> pairs;
+    uint64_t total = 0;
+    for (unsigned i = 0; i < 256 * 256; ++i) {
+        total += profile->pairs[i];
+        if (profile->pairs[i]) {
+            pairs.push_back({ i, profile->pairs[i] });
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const pair_count& p1, const pair_count& p2) {
+        return p1.count > p2.count;
+    });
+    if (pairs.size() > max_pairs) {
+        pairs.resize(max_pairs);
+    }
+    while (!pairs.empty() && pairs.back().count < total * MIN_SHARE) {
+        pairs.pop_back();
+    }
+    if (pairs.empty()) {
+        std::fprintf(stderr, "No opcode pairs ran\n");
+        return 1;
+    }
+
+    std::FILE* out = std::fopen(out_path, "w");
+    if (!out) {
+        std::fprintf(stderr, "Could not open %s for writing\n", out_path);
+        return 1;
+    }
+    std::fprintf(out,
+        "// Generated by spaceinvaders-fuseprof from %llu frames of attract mode, do not edit.\n"
+        "// Opcode pairs to fuse, hottest first: FUSED(index, first, second).\n"
+        "// Percentages are of all pairs run inside blocks.\n\n",
+        (unsigned long long)num_frames);
+
+    for (std::size_t i = 0; i < pairs.size(); ++i) {
+        unsigned first = pairs[i].pair >> 8, second = pairs[i].pair & 0xff;
+        std::string names = op_name(first) + "; " + op_name(second);
+        std::fprintf(out, "FUSED(%2zu, 0x%02x, 0x%02x) // %-16s %5.2f%%\n", i, first, second,
+            names.c_str(), 100.0 * pairs[i].count / total);
+    }
+    if (std::fclose(out) != 0) {
+        std::fprintf(stderr, "Could not write %s\n", out_path);
+        return 1;
+    }
+    std::printf("spaceinvaders-fuseprof: %zu pairs to %s\n", pairs.size(), out_path);
+
+    static const char* const FLAG_GROUPS[3] = { "z/s/p", "ac", "cy" };
+    uint64_t set = 0, dead = 0;
+    std::printf("%-8s %14s %8s\n", "flags", "updates", "dead");
+    for (int g = 0; g < 3; ++g) {
+        uint64_t n = std::max<uint64_t>(profile->flags_set[g], 1);
+        std::printf("%-8s %14llu %7.2f%%\n", FLAG_GROUPS[g],
+            (unsigned long long)profile->flags_set[g], 100.0 * profile->flags_dead[g] / n);
+        set += profile->flags_set[g];
+        dead += profile->flags_dead[g];
+    }
+    set = std::max<uint64_t>(set, 1);
+    std::printf("%-8s %14llu %7.2f%%\n", "all", (unsigned long long)set, 100.0 * dead / set);
+    return 0;
+}
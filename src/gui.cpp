@@ -873,7 +873,7 @@ void emu_gui::draw_settings_content()
         draw_header("Controls");
         ImGui::Dummy(ImVec2(0, 10));
 
-        static constexpr std::pair<const char*, input> inputs[9]
+        static constexpr std::pair<const char*, input> inputs[10]
         {
             { "Left ", INPUT_P1_LEFT },
             { "Right", INPUT_P1_RIGHT },
@@ -883,7 +883,8 @@ void emu_gui::draw_settings_content()
             { "Fire", INPUT_P2_FIRE },
             { "1P Start", INPUT_1P_START },
             { "2P Start", INPUT_2P_START },
-            { "Insert coin", INPUT_CREDIT }
+            { "Insert coin", INPUT_CREDIT },
+            { "Rewind", INPUT_REWIND }
         };
         
         float panelmargin = 8;
@@ -899,7 +900,34 @@ void emu_gui::draw_settings_content()
         ImGui::SetCursorPosY(ImGui::GetCursorPosY() - style.ItemSpacing.y + panelmargin);
         ImGui::SetCursorPosX(ImGui::GetCursorPosX() - style.WindowPadding.x + (ImGui::GetWindowSize().x - panelsizeX) / 2);
 
-        draw_ctrlpanel("inputkeys3", nullptr, inputs + 6, 3, panelsizeX);
+        draw_ctrlpanel("inputkeys3", nullptr, inputs + 6, 4, panelsizeX);
+
+        ImGui::NewLine();
+    }
+
+    // Run-ahead section
+    {
+        draw_header("Run-ahead");
+        ImGui::Dummy(ImVec2(0, 10));
+
+        ImGui::PushTextWrapPos(ImGui::GetWindowSize().x - style.WindowPadding.x);
+        ImGui::TextUnformatted("Shows frames ahead of the game, so the cannon "
+            "responds sooner. Uses more CPU.");
+        ImGui::PopTextWrapPos();
+
+        static constexpr const char* labels[RUNAHEAD_MAX_FRAMES + 1] = { "Off", "1 frame", "2 frames" };
+        int runahead = m_emu.get_runahead();
+        for (int i = 0; i <= RUNAHEAD_MAX_FRAMES; ++i) {
+            if (ImGui::RadioButton(labels[i], runahead == i)) {
+                m_emu.set_runahead(i);
+            }
+            if (i != RUNAHEAD_MAX_FRAMES) {
+                ImGui::SameLine();
+            }
+        }
+        if (m_emu.runahead_frames() < m_emu.get_runahead()) {
+            ImGui::Text("Too slow on this device, running %d ahead", m_emu.runahead_frames());
+        }
 
         ImGui::NewLine();
     }
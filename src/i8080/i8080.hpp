@@ -9,8 +9,10 @@
 // void run_8080(uint64_t num_clk_cycles) 
 // {
 //     i8080 cpu;
-//     cpu.mem_read = my_mem_read_cb;
-//     cpu.mem_write = my_mem_write_cb;
+//     cpu.map_mem(0x0000, 0x2000, my_rom, I8080_MAP_READ); // optional
+//     cpu.map_mem(0x2000, 0x2000, my_ram, I8080_MAP_RW);   // optional
+//     cpu.mem_read = my_mem_read_cb;     // for unmapped pages
+//     cpu.mem_write = my_mem_write_cb;   // for unmapped pages
 //     cpu.io_read = my_io_read_cb;      // optional
 //     cpu.io_write = my_io_write_cb;    // optional
 //     cpu.intr_read = my_intr_read_cb;  // optional
@@ -24,6 +26,13 @@
 //     printf("Done!");
 // }
 //
+// To run many instructions at once, use run() instead:
+//
+//     cpu.run(num_clk_cycles);
+//
+// i8080 calls through function pointers. For speed, use basic_i8080
+// with your own Bus type instead (see below).
+//
 
 #ifndef I8080_HPP
 #define I8080_HPP
@@ -35,7 +44,103 @@ using i8080_word_t = std::uint8_t;
 using i8080_addr_t = std::uint16_t;
 using i8080_dword_t = std::uint16_t; // reg pairs (eg. BC/DE/HL)
 
-struct i8080
+// The address space is split into 1K pages.
+#define I8080_PAGE_SHIFT 10
+#define I8080_PAGE_SIZE (1u << I8080_PAGE_SHIFT)
+#define I8080_NUM_PAGES (0x10000u >> I8080_PAGE_SHIFT)
+
+enum i8080_map_flags : unsigned
+{
+    I8080_MAP_READ = 0x1,
+    I8080_MAP_WRITE = 0x2,
+    I8080_MAP_RW = I8080_MAP_READ | I8080_MAP_WRITE
+};
+
+enum i8080_exit : int
+{
+    I8080_EXIT_BUDGET,      // cycles >= until_cycle
+    I8080_EXIT_HALT,        // CPU is halted, waiting for an interrupt
+    I8080_EXIT_BREAKPOINT,  // pc is at a breakpoint (not yet executed)
+    I8080_EXIT_NO_CALLBACK  // bus could not handle an IO/intr access
+};
+
+#define I8080_MAX_BREAKPOINTS 16
+
+// Bytes written by i8080_state::save_state().
+#define I8080_SAVE_SIZE 20
+
+// Predecoded block cache, see i8080_state::set_block_cache().
+#define I8080_BLOCK_CACHE_BITS 11 // log2 of number of blocks
+#define I8080_BLOCK_MAX_OPS 16
+#define I8080_BLOCK_MAX_BYTES (I8080_BLOCK_MAX_OPS * 3)
+
+// One decoded instruction.
+struct i8080_op
+{
+    i8080_word_t opcode;
+    i8080_word_t len;  // Bytes to advance pc by
+    i8080_addr_t imm;  // Immediate operand, if any
+    // What the interpreter runs: opcode, or I8080_FUSED_BASE + n
+    // to run this op and the next as fused pair n (i8080_fused.inc).
+    std::uint16_t handler;
+};
+
+#define I8080_FUSED_BASE 256
+
+// What ran in blocks, see i8080_block_cache::profile.
+struct i8080_profile
+{
+    // How often each pair of opcodes ran one after the other in a
+    // block, pairs[first << 8 | second]. To choose the pairs to fuse.
+    std::uint64_t pairs[256 * 256];
+
+    // Flag updates by ops that ran, by group (Z/S/P, AC, CY). Dead
+    // ones are set again before anything reads them.
+    std::uint64_t flags_set[3];
+    std::uint64_t flags_dead[3];
+};
+
+// Straight-line run of instructions, ending at the
+// first jump/call/return, IO, HLT or I8080_BLOCK_MAX_OPS.
+struct i8080_block
+{
+    i8080_addr_t pc;         // Address of first instruction
+    std::uint8_t num_ops;    // 0 if unused/invalidated
+    std::uint8_t num_bytes;
+    // If the block is a loop that only jumps back to itself and has
+    // no effects other than on registers (eg. polling RAM until an
+    // interrupt changes it), its cycles per iteration. Else 0.
+    std::uint16_t idle_cycles;
+    std::uint8_t idle_ptrs;  // Register pairs it reads memory through
+    i8080_op ops[I8080_BLOCK_MAX_OPS];
+};
+
+struct i8080_block_cache
+{
+    // Direct-mapped by start address.
+    i8080_block blocks[1u << I8080_BLOCK_CACHE_BITS];
+    // Bit n set if byte n may be part of a block.
+    std::uint8_t code_map[0x10000 / 8];
+    // For code outside mapped pages, which is never cached.
+    i8080_block scratch;
+
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t invalidations; // blocks dropped because of writes
+    std::uint64_t idle_cycles;   // skipped in idle loops, see run()
+
+    // If not null, every block looked up adds its ops here.
+    // Slow, only for profiling.
+    i8080_profile* profile;
+};
+
+struct i8080_jit; // see i8080_jit.hpp
+struct i8080_aot; // see i8080_aot.hpp
+struct i8080_hle; // see i8080_hle.hpp
+
+// Registers, page table and everything else that
+// does not depend on the bus.
+struct i8080_state
 {
     // Working registers
     i8080_word_t a, b, c, d, e, h, l;
@@ -55,34 +160,105 @@ struct i8080
     i8080_word_t int_en : 1; // Interrupts enabled (INTE pin)  
     i8080_word_t int_rq : 1; // Interrupt request
 
+    // Lazy flags, only used if built with I8080_LAZY_FLAGS.
+    // While running, s/z/p/ac/cy are not updated. Instead the
+    // last result is kept here and the flags are worked out when
+    // something reads them. The bitfields above are up to date
+    // again once step()/run() returns (but not inside bus calls).
+    std::uint16_t lf_res; // Sign-extended result (s, z, p)
+    i8080_word_t lf_aux;  // Bit 4 is ac
+    i8080_word_t lf_cy;   // Carry
+
     // Clock cycles elapsed since last reset
     std::uint64_t cycles;
 
-    // ---------- user-defined callbacks --------------
+    // User data, for use by the bus.
+    void* udata;
 
-    i8080_word_t(*mem_read)(i8080*, i8080_addr_t addr);
-    void(*mem_write)(i8080*, i8080_addr_t addr, i8080_word_t word);
+    // Page table. Pages that point to host memory are accessed
+    // directly, null pages go through the bus's mem_read/mem_write.
+    // Use map_mem()/unmap_mem() to change.
+    i8080_word_t* rpages[I8080_NUM_PAGES] = {};
+    i8080_word_t* wpages[I8080_NUM_PAGES] = {};
 
-    i8080_word_t(*io_read)(i8080*, i8080_word_t port);
-    void(*io_write)(i8080*, i8080_word_t port, i8080_word_t word);
+    // Map [addr, addr + size) to host memory at mem, for reads
+    // and/or writes. addr and size must be multiples of I8080_PAGE_SIZE.
+    // Mapping the same host memory at several addresses mirrors it.
+    // Leave ROM unmapped for writes, and IO or watched pages unmapped
+    // entirely, so those accesses reach the bus.
+    void map_mem(std::uint32_t addr, std::uint32_t size, i8080_word_t* mem, unsigned flags);
 
-    i8080_word_t(*intr_read)(i8080*);
+    // Route reads and/or writes to [addr, addr + size) back
+    // through the bus.
+    void unmap_mem(std::uint32_t addr, std::uint32_t size, unsigned flags = I8080_MAP_RW);
 
-    void* udata;
+    // Breakpoints. run() stops before executing an instruction
+    // at one of these addresses, unless it is the first instruction
+    // of the run (so calling run() again resumes).
+    i8080_addr_t bp_addrs[I8080_MAX_BREAKPOINTS] = {};
+    int num_bps = 0;
+    std::uint64_t bp_pages = 0; // bit n set if page n has a breakpoint
 
-    // ------------------------------------------------
+    // Returns -1 if there are already I8080_MAX_BREAKPOINTS.
+    int add_breakpoint(i8080_addr_t addr);
+    void remove_breakpoint(i8080_addr_t addr);
+    bool is_breakpoint(i8080_addr_t addr) const;
+
+    // Predecoded block cache. When set, run()/step() decode each 
+    // straight-line run of code once and then execute it from the
+    // cache. Only code in pages mapped for reads is cached. Writes
+    // through the CPU to cached code drop the blocks containing it.
+    // The cache is not owned, and is flushed by this call, by
+    // map_mem()/unmap_mem() and by flush_blocks(). Pass null to
+    // go back to decoding from memory.
+    i8080_block_cache* blocks = nullptr;
+    std::uint64_t code_pages = 0; // bit n set if page n has cached code
+
+    void set_block_cache(i8080_block_cache* cache);
+
+    // Call if memory behind mapped pages changes other than 
+    // by CPU writes (eg. loading a ROM or a saved state).
+    void flush_blocks();
+
+    // Drop cached blocks that contain addr.
+    void invalidate_code(i8080_addr_t addr);
+
+    // Recompiler (x86-64 only). When set, run() executes blocks as
+    // host code where it can. Needs a block cache, and is flushed
+    // with it. Not owned, pass null to go back to the interpreter.
+    i8080_jit* jit = nullptr;
+
+    void set_jit(i8080_jit* jit);
+
+    // Ahead-of-time compiled code. When set, run() calls its block
+    // functions where it has them, before the JIT or interpreter.
+    // Needs a block cache. Not owned, pass null to go back to the
+    // interpreter.
+    i8080_aot* aot = nullptr;
+
+    void set_aot(i8080_aot* aot);
+
+    // Native versions of guest loops. When set, run() calls them
+    // where it has them, before precompiled code, the JIT or the
+    // interpreter. Needs a block cache. Not owned, pass null to
+    // interpret the loops again.
+    i8080_hle* hle = nullptr;
+
+    void set_hle(i8080_hle* hle);
 
     // Reset chip. Eq. to low on RESET pin.
     void reset();
 
-    // Run one instruction.
-    // Returns 0 on success, or -1 for 
-    // missing IO/intr callback.
-    int step();
+    // Write registers, flags and cycles to buf (I8080_SAVE_SIZE
+    // bytes), or read them back. The layout is little-endian and
+    // does not depend on the host or build options. Memory, page
+    // tables and caches are not included. Not during step()/run().
+    void save_state(std::uint8_t* buf) const;
+    void load_state(const std::uint8_t* buf);
 
     // Send an interrupt request.
     // If interrupts are enabled, the opcode returned by 
-    // intr_read() will be executed.
+    // the bus's intr_read() will be executed.
     // 
     // Interrupts are usually received in the middle of an
     // instruction, but that is not possible with this emulator.
@@ -90,6 +266,53 @@ struct i8080
     // after the target instruction has completed.
     void interrupt();
 
+    // Name of the dispatch engine this core was built with
+    // ("threaded" or "switch").
+    static const char* dispatch_mode();
+};
+
+// CPU core, specialized at compile time for a Bus.
+// Bus is a type with these static functions:
+//
+// struct my_bus
+// {
+//     // Only called for unmapped pages.
+//     static i8080_word_t mem_read(i8080_state* cpu, i8080_addr_t addr);
+//     static void mem_write(i8080_state* cpu, i8080_addr_t addr, i8080_word_t word);
+//
+//     // Return false if the access can't be handled,
+//     // which stops the CPU with an error.
+//     static bool io_read(i8080_state* cpu, i8080_word_t port, i8080_word_t& word);
+//     static bool io_write(i8080_state* cpu, i8080_word_t port, i8080_word_t word);
+//     static bool intr_read(i8080_state* cpu, i8080_word_t& opcode);
+// };
+//
+// Bus calls are direct, so they can be inlined into the interpreter.
+// The member functions are defined in i8080_impl.hpp, include it in 
+// the source file that defines the Bus and explicitly instantiate:
+//
+//     template struct basic_i8080<my_bus>;
+//
+template <class Bus>
+struct basic_i8080 : i8080_state
+{
+    // Run one instruction.
+    // Returns 0 on success, or -1 if the bus
+    // could not handle an IO/intr access.
+    int step();
+
+    // Run instructions until cycles >= until_cycle.
+    // Much faster than calling step() in a loop.
+    // Returns why it stopped, see i8080_exit.
+    //
+    // With a block cache, an idle loop (see i8080_block::idle_cycles)
+    // that comes back to its start with all registers unchanged is
+    // skipped to the last iteration that starts before until_cycle.
+    // Nothing else can change memory during run(), so this ends in
+    // the same state as running it. Reads from unmapped pages in the
+    // loop stop it from being skipped.
+    i8080_exit run(std::uint64_t until_cycle);
+
     // Disassemble one instruction.
     // This can be called before step() to print the
     // instruction that is about to be executed, or in 
@@ -97,4 +320,33 @@ struct i8080
     void disassemble(std::FILE* os);
 };
 
+// Bus that forwards to the callbacks in i8080.
+struct i8080_callback_bus
+{
+    static i8080_word_t mem_read(i8080_state* cpu, i8080_addr_t addr);
+    static void mem_write(i8080_state* cpu, i8080_addr_t addr, i8080_word_t word);
+
+    static bool io_read(i8080_state* cpu, i8080_word_t port, i8080_word_t& word);
+    static bool io_write(i8080_state* cpu, i8080_word_t port, i8080_word_t word);
+    static bool intr_read(i8080_state* cpu, i8080_word_t& opcode);
+};
+
+extern template struct basic_i8080<i8080_callback_bus>;
+
+// CPU with a runtime bus made of function pointers.
+struct i8080 : basic_i8080<i8080_callback_bus>
+{
+    // ---------- user-defined callbacks --------------
+
+    i8080_word_t(*mem_read)(i8080*, i8080_addr_t addr);
+    void(*mem_write)(i8080*, i8080_addr_t addr, i8080_word_t word);
+
+    i8080_word_t(*io_read)(i8080*, i8080_word_t port);
+    void(*io_write)(i8080*, i8080_word_t port, i8080_word_t word);
+
+    i8080_word_t(*intr_read)(i8080*);
+
+    // ------------------------------------------------
+};
+
 #endif /* I8080_H */
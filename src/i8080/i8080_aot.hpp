@@ -0,0 +1,60 @@
+//
+// Ahead-of-time compiled code for the i8080 core.
+//
+// i8080-aotgen (i8080_aotgen.cpp) follows the control flow of a ROM
+// from its reset and RST vectors, and writes out a C++ source file
+// with one function per basic block. Each instruction is the same
+// handler the interpreter runs, expanded for a constant opcode and
+// operand (see i8080_exec_op()), so the compiler can optimize the
+// block as a whole.
+//
+// At block boundaries run() calls the function for pc, if there is
+// one. Blocks keep the interpreter's cycle counts exactly. A block
+// only runs if the budget lasts until its last instruction starts,
+// and it hands back to the interpreter if an IO access fails. Jumps
+// whose target isn't known ahead of time (RET, PCHL) look it up, and
+// run in the interpreter if it has no function.
+//
+// Only use it for code that is never written to, like a ROM. load()
+// checks that the memory mapped at the ROM's addresses still holds
+// what it was compiled from.
+//
+
+#ifndef I8080_AOT_HPP
+#define I8080_AOT_HPP
+
+#include <cstddef>
+#include "i8080.hpp"
+
+// Runs a block at pc. Returns false, without running it, if the
+// interpreter should run it instead.
+using i8080_aot_fn = bool(*)(i8080_state* cpu, std::uint64_t until_cycle);
+
+struct i8080_aot_block
+{
+    i8080_addr_t addr;
+    i8080_aot_fn fn;
+};
+
+// What i8080-aotgen generates.
+struct i8080_aot_program
+{
+    const i8080_word_t* rom;  // What it was compiled from, mapped at 0
+    std::size_t rom_size;
+    const i8080_aot_block* blocks;
+    std::size_t num_blocks;
+};
+
+struct i8080_aot
+{
+    // Function for each guest address, null if none.
+    i8080_aot_fn fns[0x10000];
+
+    std::uint64_t exits; // returns to the interpreter
+
+    // Fill fns from program. Returns -1 if the memory cpu reads at
+    // [0, rom_size) is not the ROM the program was compiled from.
+    int load(const i8080_aot_program& program, const i8080_state* cpu);
+};
+
+#endif /* I8080_AOT_HPP */
@@ -0,0 +1,306 @@
+//
+// i8080-aotgen: compile a ROM's code to C++ ahead of time.
+//
+// Follows control flow from the reset and RST vectors, splits the
+// code it finds into basic blocks, and writes a source file with one
+// function per block plus an i8080_aot_program that lists them.
+// See i8080_aot.hpp.
+//
+// usage: i8080-aotgen <rom> <output.cpp> <name> <bus> <bus-header>
+//
+// The output defines `extern const i8080_aot_program <name>`, with
+// basic_i8080<bus> semantics. <bus-header> is #included to declare
+// <bus>. Compile the output with the same I8080_* definitions as
+// the core.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "i8080_impl.hpp"
+
+// Longer blocks are split, so they don't often have to go to the
+// interpreter because the budget runs out before their end.
+#define MAX_BLOCK_OPS 32
+
+struct rom_image
+{
+    std::vector<i8080_word_t> bytes;
+
+    bool has(std::uint32_t addr, std::uint32_t len) const {
+        return addr + len <= bytes.size();
+    }
+    i8080_addr_t imm(std::uint32_t addr, i8080_word_t opcode) const {
+        switch (LENGTHS[opcode]) {
+        case 2: return bytes[addr + 1];
+        case 3: return (i8080_addr_t)(bytes[addr + 1] | (bytes[addr + 2] << 8));
+        default: return 0;
+        }
+    }
+};
+
+// Does the instruction end a block, and can execution continue
+// after it?
+static bool is_jump(i8080_word_t opcode, bool& falls_through)
+{
+    switch (opcode)
+    {
+    case i8080_JMP: case i8080_UD_JMP:
+    case i8080_RET: case i8080_UD_RET:
+    case i8080_PCHL:
+        falls_through = false;
+        return true;
+
+    case i8080_CALL: case i8080_UD_CALL1:
+    case i8080_UD_CALL2: case i8080_UD_CALL3:
+    case i8080_HLT:
+        falls_through = true; // returns there
+        return true;
+
+    default:
+        falls_through = true;
+        switch (opcode & 0xc7) {
+        case 0xc0: case 0xc2: case 0xc4: case 0xc7: // Rcc, Jcc, Ccc, RST
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+// Target of a jump, call or RST, if known.
+static bool jump_target(const rom_image& rom, std::uint32_t addr, i8080_addr_t& target)
+{
+    i8080_word_t opcode = rom.bytes[addr];
+    switch (opcode)
+    {
+    case i8080_RET: case i8080_UD_RET: case i8080_PCHL: case i8080_HLT:
+        return false;
+    default:
+        if ((opcode & 0xc7) == 0xc0) { return false; }  // Rcc
+        if ((opcode & 0xc7) == 0xc7) {                  // RST
+            target = opcode & 0x38;
+            return true;
+        }
+        target = rom.imm(addr, opcode);
+        return true;
+    }
+}
+
+// Find every instruction reachable from the vectors, and mark the
+// ones that start a block.
+static void find_code(const rom_image& rom, std::vector<bool>& is_code, std::vector<bool>& is_leader)
+{
+    std::vector<std::uint32_t> work;
+    for (std::uint32_t vec = 0; vec < 0x40; vec += 8) {
+        if (rom.has(vec, 1)) {
+            is_leader[vec] = true;
+            work.push_back(vec);
+        }
+    }
+    while (!work.empty())
+    {
+        std::uint32_t addr = work.back();
+        work.pop_back();
+
+        for (;;)
+        {
+            if (is_code[addr]) { break; }
+            i8080_word_t opcode = rom.bytes[addr];
+            if (!rom.has(addr, LENGTHS[opcode])) { break; }
+            is_code[addr] = true;
+
+            std::uint32_t next = addr + LENGTHS[opcode];
+            bool falls_through;
+            if (!is_jump(opcode, falls_through)) {
+                addr = next;
+                if (!rom.has(addr, 1)) { break; }
+                continue;
+            }
+            i8080_addr_t target;
+            if (jump_target(rom, addr, target) && rom.has(target, 1)) {
+                is_leader[target] = true;
+                work.push_back(target);
+            }
+            if (falls_through && rom.has(next, 1)) {
+                is_leader[next] = true;
+                work.push_back(next);
+            }
+            break;
+        }
+    }
+}
+
+static std::string disassemble(i8080_word_t opcode, i8080_addr_t imm)
+{
+    char buf[64];
+    const char* args = OPARGS_TO_STR[opcode];
+    if (!args) {
+        return OP_TO_STR[opcode];
+    }
+    char argbuf[32];
+    std::snprintf(argbuf, sizeof(argbuf), args, unsigned(imm));
+    std::snprintf(buf, sizeof(buf), "%-6s%s", OP_TO_STR[opcode], argbuf);
+    return buf;
+}
+
+// Write the function for the block at start. Marks where it
+// falls through to as a leader, if it was split.
+static void write_block(std::FILE* out, const rom_image& rom, std::uint32_t start,
+    const std::vector<bool>& is_code, std::vector<bool>& is_leader)
+{
+    struct op_info { std::uint32_t addr; i8080_word_t opcode; i8080_addr_t imm; };
+    std::vector<op_info> ops;
+
+    std::uint32_t addr = start;
+    bool ends_in_jump = false;
+    for (;;)
+    {
+        i8080_word_t opcode = rom.bytes[addr];
+        ops.push_back({ addr, opcode, rom.imm(addr, opcode) });
+        addr += LENGTHS[opcode];
+
+        bool falls_through;
+        if (is_jump(opcode, falls_through)) {
+            ends_in_jump = true;
+            break;
+        }
+        if (!rom.has(addr, 1) || !is_code[addr] || is_leader[addr]) {
+            break;
+        }
+        if (ops.size() == MAX_BLOCK_OPS) {
+            is_leader[addr] = true; // later than start, still to be written
+            break;
+        }
+    }
+
+    // Cycles before the last op, for the budget check.
+    std::uint32_t before_last = 0;
+    for (std::size_t i = 0; i + 1 < ops.size(); ++i) {
+        before_last += CYCLES[ops[i].opcode];
+    }
+
+    std::fprintf(out, "static bool block_%04x(i8080_state* cpu, std::uint64_t until_cycle)\n{\n", start);
+    std::fprintf(out, "    if (cpu->cycles + %u >= until_cycle) { return false; }\n", before_last);
+
+    std::uint32_t pending = 0; // cycles not yet added
+    for (std::size_t i = 0; i < ops.size(); ++i)
+    {
+        const op_info& op = ops[i];
+        std::uint32_t next = op.addr + LENGTHS[op.opcode];
+        bool last = i + 1 == ops.size();
+        bool io = op.opcode == i8080_IN || op.opcode == i8080_OUT;
+
+        // The bus sees the same cycle count as with the interpreter.
+        if (io && pending) {
+            std::fprintf(out, "    cpu->cycles += %u;\n", pending);
+            pending = 0;
+        }
+        // Only jumps and IO use pc.
+        if ((last && ends_in_jump) || io) {
+            std::fprintf(out, "    cpu->pc = 0x%04x;\n", next);
+        }
+
+        /* 0x08 is a NOP, but means something else to the interpreter. */
+        i8080_word_t opcode = op.opcode == i8080_UD_NOP1 ? i8080_NOP : op.opcode;
+        std::string text = disassemble(op.opcode, op.imm);
+        if (io) {
+            std::fprintf(out, "    if (!i8080_exec_op<Bus, 0x%02x>(cpu, 0x%04x)) { cpu->pc = 0x%04x; return false; } // %s\n",
+                opcode, op.imm, op.addr, text.c_str());
+        }
+        else {
+            std::fprintf(out, "    i8080_exec_op<Bus, 0x%02x>(cpu, 0x%04x); // %s\n",
+                opcode, op.imm, text.c_str());
+        }
+        pending += CYCLES[op.opcode];
+    }
+    if (!ends_in_jump) {
+        std::fprintf(out, "    cpu->pc = 0x%04x;\n", addr);
+    }
+    if (pending) {
+        std::fprintf(out, "    cpu->cycles += %u;\n", pending);
+    }
+    std::fprintf(out, "    return true;\n}\n\n");
+}
+
+static int read_rom(const char* path, rom_image& rom)
+{
+    std::FILE* file = std::fopen(path, "rb");
+    if (!file) {
+        std::fprintf(stderr, "Could not open %s\n", path);
+        return -1;
+    }
+    int c;
+    while ((c = std::fgetc(file)) != EOF) {
+        rom.bytes.push_back((i8080_word_t)c);
+    }
+    std::fclose(file);
+
+    if (rom.bytes.empty() || rom.bytes.size() > 0x10000) {
+        std::fprintf(stderr, "%s must be 1 to 65536 bytes\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 6) {
+        std::fprintf(stderr, "usage: i8080-aotgen <rom> <output.cpp> <name> <bus> <bus-header>\n");
+        return 1;
+    }
+    const char* rom_path = argv[1];
+    const char* out_path = argv[2];
+    const char* name = argv[3];
+    const char* bus = argv[4];
+    const char* bus_header = argv[5];
+
+    rom_image rom;
+    if (read_rom(rom_path, rom) != 0) {
+        return 1;
+    }
+    std::vector<bool> is_code(rom.bytes.size()), is_leader(rom.bytes.size());
+    find_code(rom, is_code, is_leader);
+
+    std::FILE* out = std::fopen(out_path, "w");
+    if (!out) {
+        std::fprintf(stderr, "Could not open %s for writing\n", out_path);
+        return 1;
+    }
+    std::fprintf(out,
+        "// Generated by i8080-aotgen from %s, do not edit.\n\n"
+        "#include \"%s\"\n"
+        "#include \"i8080/i8080_impl.hpp\"\n\n"
+        "using Bus = %s;\n\n", rom_path, bus_header, bus);
+
+    std::vector<std::uint32_t> blocks;
+    for (std::uint32_t addr = 0; addr < rom.bytes.size(); ++addr) {
+        if (is_leader[addr] && is_code[addr]) {
+            write_block(out, rom, addr, is_code, is_leader);
+            blocks.push_back(addr);
+        }
+    }
+
+    std::fprintf(out, "static const i8080_word_t ROM[] = {");
+    for (std::size_t i = 0; i < rom.bytes.size(); ++i) {
+        std::fprintf(out, "%s0x%02x,", i % 16 ? " " : "\n    ", rom.bytes[i]);
+    }
+    std::fprintf(out, "\n};\n\nstatic const i8080_aot_block BLOCKS[] = {\n");
+    for (std::uint32_t addr : blocks) {
+        std::fprintf(out, "    { 0x%04x, block_%04x },\n", addr, addr);
+    }
+    std::fprintf(out, "};\n\n"
+        "extern const i8080_aot_program %s = {\n"
+        "    ROM, sizeof(ROM), BLOCKS, sizeof(BLOCKS) / sizeof(BLOCKS[0])\n"
+        "};\n", name);
+
+    if (std::fclose(out) != 0) {
+        std::fprintf(stderr, "Could not write %s\n", out_path);
+        return 1;
+    }
+    std::printf("i8080-aotgen: %zu blocks from %s\n", blocks.size(), rom_path);
+    return 0;
+}
@@ -0,0 +1,74 @@
+//
+// High-level emulation (HLE) of guest routines for the i8080 core.
+//
+// Some routines in a ROM are simple loops over memory (copying,
+// clearing, drawing sprites) that run for a large share of the time.
+// Their effect can be worked out natively in one go instead of one
+// instruction at a time. The bus provides a function for each loop,
+// registered at the address of its first instruction.
+//
+// At block boundaries run() calls the function for pc, if there is
+// one, before precompiled or translated code. It runs as many whole
+// iterations of the loop as the interpreter would have run with the
+// same budget, and leaves registers, flags, memory and cycles exactly
+// as they would be at the start of the next iteration (or the first
+// instruction after the loop). Code running in the JIT doesn't come
+// back to the interpreter at every block, so it may run the loop itself.
+//
+// load() checks that the routines' code is what is in memory, so
+// they are only used with the ROM they were written for.
+//
+
+#ifndef I8080_HLE_HPP
+#define I8080_HLE_HPP
+
+#include <cstddef>
+#include "i8080.hpp"
+
+// Runs iterations of the loop at pc. Returns false, without running
+// anything, if the interpreter should run it instead (eg. not even
+// one iteration fits in the budget, or memory it uses isn't mapped).
+using i8080_hle_fn = bool(*)(i8080_state* cpu, std::uint64_t until_cycle);
+
+struct i8080_hle_routine
+{
+    const char* name;
+    i8080_addr_t addr;
+    const i8080_word_t* code; // What the loop's code must be
+    std::size_t code_size;
+    i8080_hle_fn fn;
+};
+
+struct i8080_hle
+{
+    // Function for each guest address, null if none.
+    i8080_hle_fn fns[0x10000];
+
+    std::uint64_t calls;  // functions that ran
+    std::uint64_t cycles; // guest cycles they ran for
+
+    // Fill fns from routines. Returns -1 if the memory cpu reads at
+    // any routine's address is not the code it was written for.
+    int load(const i8080_hle_routine* routines, std::size_t num_routines, const i8080_state* cpu);
+};
+
+// Host memory behind [addr, addr + size), if it is mapped for
+// flags (I8080_MAP_READ and/or I8080_MAP_WRITE) in one contiguous
+// piece. Writable ranges must also not hold cached code, so they can
+// be written without invalidate_code(). Else null.
+i8080_word_t* i8080_hle_mem(const i8080_state* cpu, i8080_addr_t addr, std::uint32_t size, unsigned flags);
+
+// How many iterations of a loop, each iter_cycles long with its last
+// instruction starting last_start cycles in, the interpreter would
+// run from cycles before stopping at until_cycle. At most max_iters.
+static inline std::uint32_t i8080_hle_iters(std::uint64_t cycles, std::uint64_t until_cycle,
+    std::uint32_t iter_cycles, std::uint32_t last_start, std::uint32_t max_iters)
+{
+    if (cycles + last_start >= until_cycle) {
+        return 0;
+    }
+    std::uint64_t n = (until_cycle - cycles - last_start - 1) / iter_cycles + 1;
+    return n < max_iters ? (std::uint32_t)n : max_iters;
+}
+
+#endif /* I8080_HLE_HPP */
@@ -0,0 +1,1552 @@
+// 
+// i8080 core implementation, templated on the Bus.
+//
+// Include this in the source file that defines a Bus's functions,
+// and explicitly instantiate basic_i8080<Bus> there so the Bus
+// calls can be inlined. Only one source file per Bus type.
+//
+// References
+// Intel manual: https://altairclone.com/downloads/manuals/8080%20Programmers%20Manual.pdf
+// Tandy manual: https://archive.org/details/8080-8085_Assembly_Language_Programming_1977_Intel
+// 8080 Data sheet: https://deramp.com/downloads/intel/8080%20Data%20Sheet.pdf
+// opcode table: http://pastraiser.com/cpu/i8080/i8080_opcodes.html
+// 
+
+#ifndef I8080_IMPL_HPP
+#define I8080_IMPL_HPP
+
+#include "i8080.hpp"
+#include "i8080_aot.hpp"
+#include "i8080_hle.hpp"
+#include "i8080_jit.hpp"
+#include "i8080_opcodes.hpp"
+
+#include <cstring>
+
+#ifdef __has_cpp_attribute
+#if __has_cpp_attribute(unlikely)
+#define IF_UNLIKELY(x) if (x) [[unlikely]] 
+#endif
+#endif
+
+#ifndef IF_UNLIKELY
+#if defined(__has_builtin)
+    #if __has_builtin(__builtin_expect)
+    #define HAS_BUILTIN_EXPECT
+    #endif
+#elif __GNUC__ >= 3
+#define HAS_BUILTIN_EXPECT
+#endif
+
+#ifdef HAS_BUILTIN_EXPECT
+    #define IF_UNLIKELY(x) if (__builtin_expect(!!(x), 0))
+#else
+    #define IF_UNLIKELY(x) if (x)
+#endif
+#endif
+
+// Computed goto is a GNU extension, other compilers get the switch.
+// Define I8080_SWITCH_DISPATCH to force the switch on GCC/Clang too.
+#if !defined(I8080_SWITCH_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define I8080_THREADED_DISPATCH
+#endif
+
+#define min2(a, b) (((a) < (b)) ? (a) : (b))
+
+#define CARRY_BIT     0
+#define PARITY_BIT    2
+#define AUX_CARRY_BIT 4
+#define ZERO_BIT      6
+#define SIGN_BIT      7
+
+#define WORD_MAX 0xff
+
+#define word_lo(word) ((word) & 0x0f)
+#define word_hi(word) ((word) >> 4)
+
+#define dword_lo(dword) ((i8080_word_t)((dword) & WORD_MAX))
+#define dword_hi(dword) ((i8080_word_t)((dword) >> 8))
+
+#define get_bit(buf, bit) (((buf) >> (bit)) & 0x1)
+#define set_bit(ptr, bit, val) (*(ptr) = (*(ptr) & ~(0x1 << (bit))) | ((val) << (bit)))
+
+#define concatenate(word1, word2) (((i8080_dword_t)(word1) << 8) | (word2))
+
+
+/* Intel manual, pg 77-79 */
+/* For conditional RETs and CALLs, add 6 if condition is true. */
+static const uint8_t CYCLES[] = {
+/*  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F */
+    4,  10, 7,  5,  5,  5,  7,  4,  4,  10, 7,  5,  5,  5,  7,  4,  /* 0 */
+    4,  10, 7,  5,  5,  5,  7,  4,  4,  10, 7,  5,  5,  5,  7,  4,  /* 1 */
+    4,  10, 16, 5,  5,  5,  7,  4,  4,  10, 16, 5,  5,  5,  7,  4,  /* 2 */
+    4,  10, 13, 5,  10, 10, 10, 4,  4,  10, 13, 5,  5,  5,  7,  4,  /* 3 */
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  /* 4 */
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  /* 5 */
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  /* 6 */
+    7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5,  /* 7 */
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  /* 8 */
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  /* 9 */
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  /* A */
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  /* B */
+    5,  10, 10, 10, 11, 11, 7,  11, 5,  10, 10, 10, 11, 17, 7,  11, /* C */
+    5,  10, 10, 10, 11, 11, 7,  11, 5,  10, 10, 10, 11, 17, 7,  11, /* D */
+    5,  10, 10, 18, 11, 11, 7,  11, 5,  5,  10, 4,  11, 17, 7,  11, /* E */
+    5,  10, 10, 4,  11, 11, 7,  11, 5,  5,  10, 4,  11, 17, 7,  11  /* F */
+};
+
+/* Instruction length in bytes, including the opcode. */
+static const uint8_t LENGTHS[] = {
+/*  0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, /* 0 */
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, /* 1 */
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, /* 2 */
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, /* 3 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 4 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 5 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 6 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 7 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 8 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 9 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* A */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* B */
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 3, 3, 3, 2, 1, /* C */
+    1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, /* D */
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1, /* E */
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1  /* F */
+};
+
+static inline i8080_word_t parity(i8080_word_t w) {
+    /* XNOR all bits (even parity) */
+    w ^= (w >> 4);
+    w ^= (w >> 2);
+    w ^= (w >> 1);
+    w &= 0x1;
+    return !w;
+}
+
+/* Flags as stored in the bitfields. */
+static inline i8080_word_t get_flag_bits(i8080_state* cpu) {
+    /* Bit 1 is always 1, see opcode table */
+    i8080_word_t flags = 0x02;
+    flags |= (
+        (cpu->cy << CARRY_BIT) |
+        (cpu->p << PARITY_BIT) |
+        (cpu->ac << AUX_CARRY_BIT) |
+        (cpu->z << ZERO_BIT) |
+        (cpu->s << SIGN_BIT));
+    return flags;
+}
+
+static inline void set_flag_bits(i8080_state* cpu, i8080_word_t flags) {
+    cpu->cy = get_bit(flags, CARRY_BIT);
+    cpu->p = get_bit(flags, PARITY_BIT);
+    cpu->ac = get_bit(flags, AUX_CARRY_BIT);
+    cpu->z = get_bit(flags, ZERO_BIT);
+    cpu->s = get_bit(flags, SIGN_BIT);
+}
+
+// Flag access inside the execution loop.
+//
+// ALU helpers only record what they computed: update_zsp() the result,
+// set_aux() a word whose bit 4 is the aux carry (for a sum, that is
+// w1 ^ w2 ^ sum), and set_cy() the carry. flag_*() read single flags
+// (conditional jumps etc.), get_flags()/set_flags() convert all of
+// them to/from the PSW byte.
+//
+// With I8080_LAZY_FLAGS these go to the lf_* fields, and z/s/p/ac
+// are only worked out when read, which is rare. Otherwise they go
+// straight to the bitfields. 
+#ifdef I8080_LAZY_FLAGS
+
+/* Sign-extending the result keeps bit 15 == bit 8 == bit 7.
+   set_flags() breaks that to store combinations no result
+   can have, like z and s both set. */
+#define flag_z(cpu) (dword_lo(cpu->lf_res) == 0)
+#define flag_s(cpu) get_bit(cpu->lf_res, 15)
+#define flag_p(cpu) (parity(dword_lo(cpu->lf_res)) ^ \
+    get_bit(cpu->lf_res, 8) ^ get_bit(cpu->lf_res, 15))
+#define flag_ac(cpu) get_bit(cpu->lf_aux, 4)
+#define flag_cy(cpu) (cpu->lf_cy)
+
+#define update_zsp(cpu, word) (cpu->lf_res = (std::uint16_t)(std::int8_t)(word))
+#define set_aux(cpu, word) (cpu->lf_aux = (word))
+#define set_cy(cpu, val) (cpu->lf_cy = (val))
+
+static inline void set_flags(i8080_state* cpu, i8080_word_t flags) {
+    i8080_word_t z = get_bit(flags, ZERO_BIT);
+    i8080_word_t s = get_bit(flags, SIGN_BIT);
+    i8080_word_t p = get_bit(flags, PARITY_BIT);
+    /* 0 has even parity, 1 odd, so parity(res) == z. Bit 8 fixes it up. */
+    cpu->lf_res = (z ? 0x00 : 0x01) | ((z ^ p ^ s) << 8) | (s << 15);
+    cpu->lf_aux = get_bit(flags, AUX_CARRY_BIT) << 4;
+    cpu->lf_cy = get_bit(flags, CARRY_BIT);
+}
+
+/* Move flags between the bitfields and the lazy fields,
+   on entry to and exit from the execution loop. */
+#define load_flags(cpu) set_flags(cpu, get_flag_bits(cpu))
+#define store_flags(cpu) set_flag_bits(cpu, get_flags(cpu))
+
+#else
+
+#define flag_z(cpu) (cpu->z)
+#define flag_s(cpu) (cpu->s)
+#define flag_p(cpu) (cpu->p)
+#define flag_ac(cpu) (cpu->ac)
+#define flag_cy(cpu) (cpu->cy)
+
+/* Update z, s, p flags. */
+static inline void update_zsp(i8080_state* cpu, i8080_word_t word) {
+    cpu->z = (word == 0);
+    cpu->s = get_bit(word, 7);
+    cpu->p = parity(word);
+}
+
+#define set_aux(cpu, word) (cpu->ac = get_bit(word, 4))
+#define set_cy(cpu, val) (cpu->cy = (val))
+
+#define set_flags(cpu, flags) set_flag_bits(cpu, flags)
+
+#define load_flags(cpu) ((void)0)
+#define store_flags(cpu) ((void)0)
+
+#endif
+
+static inline i8080_word_t get_flags(i8080_state* cpu) {
+    /* Bit 1 is always 1, see opcode table */
+    i8080_word_t flags = 0x02;
+    flags |= (
+        (flag_cy(cpu) << CARRY_BIT) |
+        (flag_p(cpu) << PARITY_BIT) |
+        (flag_ac(cpu) << AUX_CARRY_BIT) |
+        (flag_z(cpu) << ZERO_BIT) |
+        (flag_s(cpu) << SIGN_BIT));
+    return flags;
+}
+
+#define get_bc(cpu) concatenate(cpu->b, cpu->c)
+#define get_de(cpu) concatenate(cpu->d, cpu->e)
+#define get_hl(cpu) concatenate(cpu->h, cpu->l)
+
+/* Get program status (A, flags). */
+#define get_psw(cpu) concatenate(cpu->a, get_flags(cpu))
+
+static inline void set_bc(i8080_state* cpu, i8080_dword_t dword) {
+    cpu->b = dword_hi(dword);
+    cpu->c = dword_lo(dword);
+}
+static inline void set_de(i8080_state* cpu, i8080_dword_t dword) {
+    cpu->d = dword_hi(dword);
+    cpu->e = dword_lo(dword);
+}
+static inline void set_hl(i8080_state* cpu, i8080_dword_t dword) {
+    cpu->h = dword_hi(dword);
+    cpu->l = dword_lo(dword);
+}
+
+/* Set program status (A, flags). */
+static inline void set_psw(i8080_state* cpu, i8080_dword_t dword) {
+    cpu->a = dword_hi(dword);
+    set_flags(cpu, dword_lo(dword));
+}
+
+#define PAGE_OFFSET_MASK (I8080_PAGE_SIZE - 1)
+
+/* Read word from a mapped page, or through the callback. */
+template <class Bus>
+static inline i8080_word_t read_mem(i8080_state* cpu, i8080_addr_t addr) {
+    i8080_word_t* page = cpu->rpages[addr >> I8080_PAGE_SHIFT];
+    if (page) {
+        return page[addr & PAGE_OFFSET_MASK];
+    }
+    return Bus::mem_read(cpu, addr);
+}
+
+/* Write word to a mapped page, or through the callback. */
+template <class Bus>
+static inline void write_mem(i8080_state* cpu, i8080_addr_t addr, i8080_word_t word) {
+    IF_UNLIKELY(get_bit(cpu->code_pages, addr >> I8080_PAGE_SHIFT)) {
+        cpu->invalidate_code(addr);
+    }
+    i8080_word_t* page = cpu->wpages[addr >> I8080_PAGE_SHIFT];
+    if (page) {
+        page[addr & PAGE_OFFSET_MASK] = word;
+    } else {
+        Bus::mem_write(cpu, addr, word);
+    }
+}
+
+/* Read word at [HL] */
+#define read_mem_hl(cpu) read_mem<Bus>(cpu, get_hl(cpu))
+
+/* Write word to [HL] */
+#define write_mem_hl(cpu, word) write_mem<Bus>(cpu, get_hl(cpu), word)
+
+/* Read word, advance PC by 1. */
+template <class Bus>
+static inline i8080_word_t read_word_adv(i8080_state* cpu) {
+    i8080_word_t word = read_mem<Bus>(cpu, cpu->pc);
+    cpu->pc += 1;
+    return word;
+}
+
+/* Read address, advance PC by 2. */
+template <class Bus>
+static inline i8080_addr_t read_addr_adv(i8080_state* cpu) {
+    i8080_word_t lo = read_word_adv<Bus>(cpu);
+    i8080_word_t hi = read_word_adv<Bus>(cpu);
+    return concatenate(hi, lo);
+}
+
+static void i8080_add(i8080_state* cpu, i8080_word_t word, i8080_word_t cy) {
+    i8080_dword_t res = (i8080_dword_t)cpu->a + word + cy;
+    set_aux(cpu, cpu->a ^ word ^ res);
+    set_cy(cpu, get_bit(res, 8));
+    cpu->a = dword_lo(res);
+    update_zsp(cpu, cpu->a);
+}
+
+static void i8080_sub(i8080_state* cpu, i8080_word_t word, i8080_word_t cy) {
+    i8080_dword_t res = (i8080_dword_t)cpu->a + (word ^ WORD_MAX) + !cy;
+    set_aux(cpu, cpu->a ^ (word ^ WORD_MAX) ^ res);
+    /* carry is the borrow flag for SUB, SBB etc */
+    set_cy(cpu, !get_bit(res, 8));
+    cpu->a = dword_lo(res);
+    update_zsp(cpu, cpu->a);
+}
+
+static void i8080_ana(i8080_state* cpu, i8080_word_t word) {
+    /* Tandy manual, pg 24 */
+    set_aux(cpu, (cpu->a | word) << 1);
+    /* Tandy manual, pg 63 */
+    set_cy(cpu, 0);
+    cpu->a &= word;
+    update_zsp(cpu, cpu->a);
+}
+
+static void i8080_xra(i8080_state* cpu, i8080_word_t word) {
+    cpu->a ^= word;
+    update_zsp(cpu, cpu->a);
+    /* Tandy manual, pg 122 */
+    set_aux(cpu, 0);
+    set_cy(cpu, 0);
+}
+
+static void i8080_ora(i8080_state* cpu, i8080_word_t word) {
+    cpu->a |= word;
+    update_zsp(cpu, cpu->a);
+    /* Tandy manual, pg 122 */
+    set_aux(cpu, 0);
+    set_cy(cpu, 0);
+}
+
+static void i8080_cmp(i8080_state* cpu, i8080_word_t word) {
+    i8080_dword_t res = (i8080_dword_t)cpu->a + (word ^ WORD_MAX) + 1;
+    set_aux(cpu, cpu->a ^ (word ^ WORD_MAX) ^ res);
+    set_cy(cpu, !get_bit(res, 8));
+    update_zsp(cpu, dword_lo(res));
+}
+
+static i8080_word_t i8080_inr(i8080_state* cpu, i8080_word_t word) {
+    i8080_word_t res = word + 1;
+    set_aux(cpu, word ^ 1 ^ res);
+    update_zsp(cpu, res);
+    return res;
+}
+
+static i8080_word_t i8080_dcr(i8080_state* cpu, i8080_word_t word) {
+    i8080_word_t res = word + WORD_MAX; /* word - 1 */
+    set_aux(cpu, word ^ WORD_MAX ^ res);
+    update_zsp(cpu, res);
+    return res;
+}
+
+static void i8080_dad(i8080_state* cpu, i8080_dword_t dword) {
+    i8080_dword_t old_hl = get_hl(cpu);
+    i8080_dword_t new_hl = old_hl + dword;
+    set_hl(cpu, new_hl);
+    /* check for unsigned overflow */
+    set_cy(cpu, (new_hl < min2(old_hl, dword)) ? 1 : 0);
+}
+
+template <class Bus>
+static inline void i8080_shld(i8080_state* cpu, i8080_addr_t addr) {
+    write_mem<Bus>(cpu, addr, cpu->l);
+    addr += 1;
+    write_mem<Bus>(cpu, addr, cpu->h);
+}
+
+template <class Bus>
+static inline void i8080_lhld(i8080_state* cpu, i8080_addr_t addr) {
+    cpu->l = read_mem<Bus>(cpu, addr);
+    addr += 1;
+    cpu->h = read_mem<Bus>(cpu, addr);
+}
+
+/* Circular shift accumulator left, set carry to old MSB. */
+static inline void i8080_rlc(i8080_state* cpu) {
+    i8080_word_t msb = get_bit(cpu->a, 7);
+    cpu->a <<= 1;
+    set_bit(&cpu->a, 0, msb);
+    set_cy(cpu, msb);
+}
+
+/* Circular shift accumulator right, set carry to old LSB. */
+static inline void i8080_rrc(i8080_state* cpu) {
+    i8080_word_t lsb = get_bit(cpu->a, 0);
+    cpu->a >>= 1;
+    set_bit(&cpu->a, 7, lsb);
+    set_cy(cpu, lsb);
+}
+
+/* Circular shift accumulator left through carry. */
+static inline void i8080_ral(i8080_state* cpu) {
+    i8080_word_t old_cy = flag_cy(cpu);
+    i8080_word_t msb = get_bit(cpu->a, 7);
+    cpu->a <<= 1;
+    set_cy(cpu, msb);
+    set_bit(&cpu->a, 0, old_cy);
+}
+
+/* Circular shift accumulator right through carry. */
+static inline void i8080_rar(i8080_state* cpu) {
+    i8080_word_t old_cy = flag_cy(cpu);
+    i8080_word_t lsb = get_bit(cpu->a, 0);
+    cpu->a >>= 1;
+    set_cy(cpu, lsb);
+    set_bit(&cpu->a, 7, old_cy);
+}
+
+/* Decimal adjust accumulator (convert to 4-bit BCD). */
+static inline void i8080_daa(i8080_state* cpu) {
+    i8080_word_t lo = word_lo(cpu->a);
+    i8080_word_t hi = word_hi(cpu->a);
+    /* units */
+    if (flag_ac(cpu) || lo > 9) {
+        i8080_word_t res = cpu->a + 0x06;
+        set_aux(cpu, cpu->a ^ 0x06 ^ res);
+        cpu->a = res;
+    }
+    /* tens, hundreds */
+    if (flag_cy(cpu) || hi > 9 || (hi == 9 && lo > 9)) {
+        set_cy(cpu, 1);
+        cpu->a += 0x60;
+    }
+    update_zsp(cpu, cpu->a);
+}
+
+template <class Bus>
+static void i8080_push(i8080_state* cpu, i8080_dword_t dword) {
+    i8080_word_t hi = dword_hi(dword);
+    i8080_word_t lo = dword_lo(dword);
+    cpu->sp -= 1;
+    write_mem<Bus>(cpu, cpu->sp, hi);
+    cpu->sp -= 1;
+    write_mem<Bus>(cpu, cpu->sp, lo);
+}
+
+template <class Bus>
+static i8080_dword_t i8080_pop(i8080_state* cpu) {
+    i8080_word_t lo = read_mem<Bus>(cpu, cpu->sp);
+    cpu->sp += 1;
+    i8080_word_t hi = read_mem<Bus>(cpu, cpu->sp);
+    cpu->sp += 1;
+    return concatenate(hi, lo);
+}
+
+template <class Bus>
+static inline void i8080_call_addr(i8080_state* cpu, i8080_addr_t addr) {
+    i8080_push<Bus>(cpu, cpu->pc);
+    cpu->pc = addr;
+}
+
+/* Jump to immediate address. */
+#define i8080_jmp(cpu) (cpu->pc = IMM16)
+
+/* Call immediate address. */
+#define i8080_call(cpu) i8080_call_addr<Bus>(cpu, IMM16)
+
+/* Return from called subroutine. */
+#define i8080_ret(cpu) (cpu->pc = i8080_pop<Bus>(cpu))
+
+/* The address is always read, like on the chip. */
+static inline void i8080_cond_jmp(i8080_state* cpu, i8080_word_t cond, i8080_addr_t addr) {
+    if (cond) { cpu->pc = addr; }
+}
+
+template <class Bus>
+static void i8080_cond_call(i8080_state* cpu, i8080_word_t cond, i8080_addr_t addr) {
+    if (cond) {
+        i8080_call_addr<Bus>(cpu, addr);
+        cpu->cycles += 6;
+    }
+}
+
+template <class Bus>
+static void i8080_cond_ret(i8080_state* cpu, i8080_word_t cond) {
+    if (cond) {
+        i8080_ret(cpu);
+        cpu->cycles += 6;
+    }
+}
+
+/* Exchange HL with top two words on the stack. */
+template <class Bus>
+static inline void i8080_xthl(i8080_state* cpu) {
+    i8080_word_t lo = read_mem<Bus>(cpu, cpu->sp);
+    cpu->sp += 1;
+    i8080_word_t hi = read_mem<Bus>(cpu, cpu->sp);
+    write_mem<Bus>(cpu, cpu->sp, cpu->h);
+    cpu->sp -= 1;
+    write_mem<Bus>(cpu, cpu->sp, cpu->l);
+    cpu->h = hi;
+    cpu->l = lo;
+}
+
+/* Exchange DE and HL. */
+static inline void i8080_xchg(i8080_state* cpu) {
+    i8080_word_t old_h = cpu->h;
+    i8080_word_t old_l = cpu->l;
+    cpu->h = cpu->d;
+    cpu->l = cpu->e;
+    cpu->d = old_h;
+    cpu->e = old_l;
+}
+
+// Block cache.
+//
+// Blocks are decoded from the page table directly, so only code in
+// mapped pages is cached. Ops keep the pc advance and immediate 
+// operand, so the interpreter only needs the opcode to dispatch.
+// Cycles still come from CYCLES[opcode]: a handler's write can 
+// invalidate the op it is running from. See i8080_state::set_block_cache().
+
+static inline std::uint32_t block_index(i8080_addr_t addr) {
+    return (addr ^ (addr >> I8080_BLOCK_CACHE_BITS)) & 
+        ((1u << I8080_BLOCK_CACHE_BITS) - 1);
+}
+
+/* 0x08 (undocumented NOP) is decoded as NOP, which frees it to mark
+   the ops of invalidated blocks. It does not move pc, and makes the
+   interpreter look up the block at pc again. */
+static const i8080_op BLOCK_EXIT_OP = { i8080_UD_NOP1, 0, 0, i8080_UD_NOP1 };
+
+/* Can the instruction change pc? IO also ends a block,
+   the bus may remap memory. */
+static inline bool ends_block(i8080_word_t opcode) {
+    switch (opcode)
+    {
+    case i8080_JMP: case i8080_UD_JMP: case i8080_PCHL:
+    case i8080_CALL: case i8080_UD_CALL1:
+    case i8080_UD_CALL2: case i8080_UD_CALL3:
+    case i8080_RET: case i8080_UD_RET:
+    case i8080_IN: case i8080_OUT: case i8080_HLT:
+        return true;
+    default:
+        /* conditional returns, jumps, calls and RSTs */
+        switch (opcode & 0xc7) {
+        case 0xc0: case 0xc2: case 0xc4: case 0xc7: return true;
+        default: return false;
+        }
+    }
+}
+
+/* Decode opcode, with any operands at addr. 
+   len only counts the operands. */
+template <class Bus>
+static i8080_op decode_op(i8080_state* cpu, i8080_word_t opcode, i8080_addr_t addr) {
+    i8080_op op;
+    op.opcode = (opcode == i8080_UD_NOP1) ? i8080_NOP : opcode;
+    op.handler = op.opcode;
+    op.len = LENGTHS[opcode] - 1;
+    op.imm = 0;
+    if (op.len >= 1) {
+        op.imm = read_mem<Bus>(cpu, addr);
+    }
+    if (op.len == 2) {
+        op.imm |= (i8080_addr_t)(read_mem<Bus>(cpu, addr + 1) << 8);
+    }
+    return op;
+}
+
+// Idle loops.
+//
+// A block is an idle loop if it ends by jumping back to its start
+// and only changes registers. Then if one iteration leaves every
+// register as it was, so will all the rest, until an interrupt.
+
+#define IDLE_PTR_HL 0x1
+#define IDLE_PTR_BC 0x2
+#define IDLE_PTR_DE 0x4
+
+/* Bit per register, as numbered in opcodes (B, C, D, E, H, L, -, A). */
+#define REG_BIT(r) (1u << (r))
+#define PAIR_BITS(rp) ((rp) == 3 ? 0u : 3u << ((rp) * 2)) /* SP: none */
+
+/* Can opcode be in an idle loop? Adds the registers it writes
+   and the pairs it reads memory through. */
+static bool idle_op(i8080_word_t opcode, unsigned& writes, unsigned& ptrs) {
+    unsigned dst = (opcode >> 3) & 7;
+    unsigned src = opcode & 7;
+    unsigned rp = (opcode >> 4) & 3;
+
+    if (opcode >= 0x40 && opcode < 0x80) {  /* MOV, not to memory or HLT */
+        if (dst == 6) { return false; }
+        if (src == 6) { ptrs |= IDLE_PTR_HL; }
+        writes |= REG_BIT(dst);
+        return true;
+    }
+    if (opcode >= 0x80 && opcode < 0xc0) {  /* ALU ops on A */
+        if (src == 6) { ptrs |= IDLE_PTR_HL; }
+        writes |= REG_BIT(7);
+        return true;
+    }
+    switch (opcode)
+    {
+    case i8080_NOP: case i8080_UD_NOP2: case i8080_UD_NOP3: case i8080_UD_NOP4:
+    case i8080_UD_NOP5: case i8080_UD_NOP6: case i8080_UD_NOP7:
+    case i8080_STC: case i8080_CMC:
+        return true;
+
+    case i8080_RLC: case i8080_RRC: case i8080_RAL: case i8080_RAR:
+    case i8080_CMA: case i8080_DAA: case i8080_LDA:
+    case i8080_ADI: case i8080_ACI: case i8080_SUI: case i8080_SBI:
+    case i8080_ANI: case i8080_XRI: case i8080_ORI: case i8080_CPI:
+        writes |= REG_BIT(7);
+        return true;
+
+    case i8080_LDAX_B: ptrs |= IDLE_PTR_BC; writes |= REG_BIT(7); return true;
+    case i8080_LDAX_D: ptrs |= IDLE_PTR_DE; writes |= REG_BIT(7); return true;
+
+    case i8080_LXI_B: case i8080_LXI_D: case i8080_LXI_H: case i8080_LXI_SP:
+    case i8080_INX_B: case i8080_INX_D: case i8080_INX_H: case i8080_INX_SP:
+    case i8080_DCX_B: case i8080_DCX_D: case i8080_DCX_H: case i8080_DCX_SP:
+        writes |= PAIR_BITS(rp);
+        return true;
+
+    case i8080_DAD_B: case i8080_DAD_D: case i8080_DAD_H: case i8080_DAD_SP:
+        writes |= PAIR_BITS(2);
+        return true;
+
+    case i8080_XCHG:
+        writes |= PAIR_BITS(1) | PAIR_BITS(2);
+        return true;
+
+    case i8080_MVI_B: case i8080_MVI_C: case i8080_MVI_D: case i8080_MVI_E:
+    case i8080_MVI_H: case i8080_MVI_L: case i8080_MVI_A:
+    case i8080_INR_B: case i8080_INR_C: case i8080_INR_D: case i8080_INR_E:
+    case i8080_INR_H: case i8080_INR_L: case i8080_INR_A:
+    case i8080_DCR_B: case i8080_DCR_C: case i8080_DCR_D: case i8080_DCR_E:
+    case i8080_DCR_H: case i8080_DCR_L: case i8080_DCR_A:
+        writes |= REG_BIT(dst);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/* Set block->idle_cycles/idle_ptrs. */
+template <class Bus>
+static void find_idle_loop(const i8080_state* cpu, i8080_block* block) {
+    block->idle_cycles = 0;
+    block->idle_ptrs = 0;
+
+    const i8080_op& last = block->ops[block->num_ops - 1];
+    bool is_jump = last.opcode == i8080_JMP || last.opcode == i8080_UD_JMP ||
+        (last.opcode & 0xc7) == 0xc2; /* Jcc */
+    if (!is_jump || last.imm != block->pc) {
+        return;
+    }
+    unsigned writes = 0, ptrs = 0;
+    unsigned cycles = CYCLES[last.opcode];
+    for (int i = 0; i < block->num_ops - 1; ++i) {
+        const i8080_op& op = block->ops[i];
+        if (!idle_op(op.opcode, writes, ptrs)) {
+            return;
+        }
+        /* LDA's address is fixed, and mappings don't change
+           without flushing the cache. */
+        if (op.opcode == i8080_LDA && !cpu->rpages[op.imm >> I8080_PAGE_SHIFT]) {
+            return;
+        }
+        cycles += CYCLES[op.opcode];
+    }
+    /* Memory is read through pairs that don't change, so
+       every iteration reads the same addresses. */
+    if (((ptrs & IDLE_PTR_HL) && (writes & PAIR_BITS(2))) ||
+        ((ptrs & IDLE_PTR_BC) && (writes & PAIR_BITS(0))) ||
+        ((ptrs & IDLE_PTR_DE) && (writes & PAIR_BITS(1)))) {
+        return;
+    }
+    block->idle_cycles = (std::uint16_t)cycles;
+    block->idle_ptrs = (std::uint8_t)ptrs;
+}
+
+/* Registers at the start of an idle loop's last iteration. */
+struct i8080_idle_check
+{
+    const i8080_block* block; /* last block looked up */
+    std::uint64_t cycles;
+    std::uint64_t regs;
+    i8080_addr_t sp;
+};
+
+static inline std::uint64_t idle_regs(i8080_state* cpu) {
+    return std::uint64_t(cpu->a) | (std::uint64_t(cpu->b) << 8) |
+        (std::uint64_t(cpu->c) << 16) | (std::uint64_t(cpu->d) << 24) |
+        (std::uint64_t(cpu->e) << 32) | (std::uint64_t(cpu->h) << 40) |
+        (std::uint64_t(cpu->l) << 48) | (std::uint64_t(get_flags(cpu)) << 56);
+}
+
+static inline bool idle_ptr_mapped(const i8080_state* cpu, i8080_addr_t addr) {
+    return cpu->rpages[addr >> I8080_PAGE_SHIFT] != nullptr;
+}
+
+/* Called when the idle loop block is about to run, at its start. If the
+   last block was the same, one iteration ago, with the same registers,
+   skip to the last iteration that starts before until_cycle. */
+static void skip_idle_loop(i8080_state* cpu, const i8080_block* block,
+    i8080_idle_check& check, std::uint64_t until_cycle, std::uint64_t bp_pages)
+{
+    std::uint64_t regs = idle_regs(cpu);
+    unsigned ptrs = block->idle_ptrs;
+
+    if (check.block == block &&
+        check.cycles + block->idle_cycles == cpu->cycles &&
+        check.regs == regs && check.sp == cpu->sp && cpu->cycles < until_cycle &&
+        !get_bit(bp_pages, cpu->pc >> I8080_PAGE_SHIFT) &&
+        (!(ptrs & IDLE_PTR_HL) || idle_ptr_mapped(cpu, get_hl(cpu))) &&
+        (!(ptrs & IDLE_PTR_BC) || idle_ptr_mapped(cpu, get_bc(cpu))) &&
+        (!(ptrs & IDLE_PTR_DE) || idle_ptr_mapped(cpu, get_de(cpu))))
+    {
+        /* The last iteration starts before until_cycle, as when
+           running it (NEXT stops once cycles >= until_cycle). */
+        std::uint64_t skip = (until_cycle - cpu->cycles - 1) /
+            block->idle_cycles * block->idle_cycles;
+        cpu->cycles += skip;
+        cpu->blocks->idle_cycles += skip;
+    }
+    check.cycles = cpu->cycles;
+    check.regs = regs;
+    check.sp = cpu->sp;
+}
+
+#undef REG_BIT
+#undef PAIR_BITS
+#undef IDLE_PTR_HL
+#undef IDLE_PTR_BC
+#undef IDLE_PTR_DE
+
+// Superinstructions.
+//
+// Pairs of opcodes that often run one after the other get their own
+// handler in the interpreter, which runs both with one dispatch. The
+// pairs come from profiling (see i8080_fused.inc).
+
+static const i8080_word_t FUSED_PAIRS[][2] = {
+#define FUSED(n, first, second) { first, second },
+#include "i8080_fused.inc"
+#undef FUSED
+};
+#define NUM_FUSED (sizeof(FUSED_PAIRS) / sizeof(FUSED_PAIRS[0]))
+
+/* Use fused handlers for the pairs in block, left to right. */
+static void fuse_ops(i8080_block* block) {
+    for (int i = 0; i + 1 < block->num_ops; ++i) {
+        for (unsigned n = 0; n < NUM_FUSED; ++n) {
+            if (block->ops[i].opcode == FUSED_PAIRS[n][0] &&
+                block->ops[i + 1].opcode == FUSED_PAIRS[n][1]) {
+                block->ops[i].handler = (std::uint16_t)(I8080_FUSED_BASE + n);
+                ++i;
+                break;
+            }
+        }
+    }
+}
+
+// Flag liveness, for spaceinvaders-fuseprof.
+//
+// Most flags an ALU op sets are set again by a later op before
+// anything reads them. find_live_flags() finds which ones are read,
+// looking only inside the block. Anything after the block, an
+// interrupt's PUSH PSW, or run()'s caller may read all of them. So
+// may the code after a write to memory, which can invalidate the
+// rest of the block, and after IO, which ends it.
+//
+// The core computes them all anyway: on the game's attract mode only
+// about 4.5% are dead, and following them into the blocks after
+// fixed jumps and fall-throughs only finds 8.4%. Too little to be
+// worth handlers that leave them out.
+
+#define FLAGS_ZSP 0x1
+#define FLAGS_AC 0x2
+#define FLAGS_CY 0x4
+#define FLAGS_ALL 0x7
+
+/* Flag groups opcode reads, and sets. */
+static void flag_use(i8080_word_t opcode, unsigned& reads, unsigned& sets) {
+    unsigned alu = (opcode >> 3) & 7;
+    reads = 0;
+    sets = 0;
+
+    if (opcode >= 0x70 && opcode < 0x78 && opcode != i8080_HLT) {
+        reads = FLAGS_ALL;  /* MOV M,r writes memory */
+        return;
+    }
+    if (opcode >= 0x80 && opcode < 0xc0) {  /* ALU ops on A */
+        sets = FLAGS_ALL;
+        if (alu == 1 || alu == 3) { reads = FLAGS_CY; }  /* ADC, SBB */
+        return;
+    }
+    switch (opcode)
+    {
+    case i8080_ADI: case i8080_SUI: case i8080_ANI:
+    case i8080_XRI: case i8080_ORI: case i8080_CPI:
+    case i8080_POP_PSW:
+        sets = FLAGS_ALL;
+        break;
+    case i8080_ACI: case i8080_SBI:
+        sets = FLAGS_ALL;
+        reads = FLAGS_CY;
+        break;
+    case i8080_DAA:
+        sets = FLAGS_ALL;
+        reads = FLAGS_AC | FLAGS_CY;
+        break;
+
+    case i8080_INR_B: case i8080_INR_C: case i8080_INR_D: case i8080_INR_E:
+    case i8080_INR_H: case i8080_INR_L: case i8080_INR_A:
+    case i8080_DCR_B: case i8080_DCR_C: case i8080_DCR_D: case i8080_DCR_E:
+    case i8080_DCR_H: case i8080_DCR_L: case i8080_DCR_A:
+        sets = FLAGS_ZSP | FLAGS_AC;
+        break;
+    case i8080_INR_M: case i8080_DCR_M:
+        sets = FLAGS_ZSP | FLAGS_AC;
+        reads = FLAGS_ALL;  /* writes memory */
+        break;
+
+    case i8080_DAD_B: case i8080_DAD_D: case i8080_DAD_H: case i8080_DAD_SP:
+    case i8080_RLC: case i8080_RRC: case i8080_STC:
+        sets = FLAGS_CY;
+        break;
+    case i8080_RAL: case i8080_RAR: case i8080_CMC:
+        sets = FLAGS_CY;
+        reads = FLAGS_CY;
+        break;
+
+    /* Memory writes and IO */
+    case i8080_STAX_B: case i8080_STAX_D: case i8080_STA: case i8080_SHLD:
+    case i8080_MVI_M: case i8080_XTHL:
+    case i8080_PUSH_B: case i8080_PUSH_D: case i8080_PUSH_H: case i8080_PUSH_PSW:
+    case i8080_CALL: case i8080_UD_CALL1: case i8080_UD_CALL2: case i8080_UD_CALL3:
+    case i8080_IN: case i8080_OUT:
+        reads = FLAGS_ALL;
+        break;
+
+    default:
+        switch (opcode & 0xc7) {
+        /* Conditional returns, jumps and calls, by condition:
+           Z, CY, P, S. Calls and RSTs also write memory. */
+        case 0xc0: case 0xc2:
+            reads = (alu >> 1) == 1 ? FLAGS_CY : FLAGS_ZSP;
+            break;
+        case 0xc4: case 0xc7:
+            reads = FLAGS_ALL;
+            break;
+        }
+        break;
+    }
+}
+/* Set live[i] to the flag groups ops[i] sets that may be read. */
+static void find_live_flags(const i8080_op* ops, int num_ops, std::uint8_t* live) {
+    unsigned read = FLAGS_ALL;  /* after the block */
+    for (int i = num_ops - 1; i >= 0; --i) {
+        unsigned reads, sets;
+        flag_use(ops[i].opcode, reads, sets);
+        /* INR/DCR M write after setting them. */
+        bool write_after = ops[i].opcode == i8080_INR_M || ops[i].opcode == i8080_DCR_M;
+        live[i] = (std::uint8_t)(sets & (write_after ? FLAGS_ALL : read));
+        read = (read & ~sets) | reads;
+    }
+}
+
+static void profile_block(i8080_profile* profile, const i8080_block* block) {
+    for (int i = 0; i + 1 < block->num_ops; ++i) {
+        profile->pairs[block->ops[i].opcode << 8 | block->ops[i + 1].opcode]++;
+    }
+    std::uint8_t live[I8080_BLOCK_MAX_OPS];
+    find_live_flags(block->ops, block->num_ops, live);
+    for (int i = 0; i < block->num_ops; ++i) {
+        unsigned reads, sets;
+        flag_use(block->ops[i].opcode, reads, sets);
+        for (int g = 0; g < 3; ++g) {
+            if (!(sets & (1u << g))) { continue; }
+            profile->flags_set[g]++;
+            profile->flags_dead[g] += !(live[i] & (1u << g));
+        }
+    }
+}
+
+/* Decode the block at pc into the given cache slot. */
+template <class Bus>
+static const i8080_block* build_block(i8080_state* cpu, i8080_block* block) {
+    i8080_block_cache* cache = cpu->blocks;
+    i8080_addr_t addr = cpu->pc;
+    int num_ops = 0;
+
+    while (num_ops < I8080_BLOCK_MAX_OPS)
+    {
+        i8080_word_t* page = cpu->rpages[addr >> I8080_PAGE_SHIFT];
+        if (!page) { break; }
+        i8080_word_t opcode = page[addr & PAGE_OFFSET_MASK];
+        i8080_addr_t last = addr + LENGTHS[opcode] - 1;
+        if (!cpu->rpages[last >> I8080_PAGE_SHIFT]) { break; }
+
+        i8080_op& op = block->ops[num_ops++];
+        op = decode_op<Bus>(cpu, opcode, addr + 1);
+        op.len += 1;
+
+        for (i8080_addr_t a = addr; a != (i8080_addr_t)(last + 1); ++a) {
+            cache->code_map[a >> 3] |= (1u << (a & 7));
+        }
+        cpu->code_pages |= (std::uint64_t(1) << (addr >> I8080_PAGE_SHIFT));
+        cpu->code_pages |= (std::uint64_t(1) << (last >> I8080_PAGE_SHIFT));
+
+        addr += op.len;
+        if (ends_block(opcode)) { break; }
+    }
+
+    if (num_ops == 0) {
+        /* Not in mapped memory. Decode one instruction 
+           through the bus, every time. */
+        block = &cache->scratch;
+        block->ops[0] = decode_op<Bus>(cpu, read_mem<Bus>(cpu, cpu->pc), cpu->pc + 1);
+        block->ops[0].len += 1;
+        block->num_ops = 1;
+        block->idle_cycles = 0;
+        return block;
+    }
+    block->pc = cpu->pc;
+    block->num_ops = (std::uint8_t)num_ops;
+    block->num_bytes = (std::uint8_t)(addr - cpu->pc);
+    find_idle_loop<Bus>(cpu, block);
+    fuse_ops(block);
+    return block;
+}
+
+/* Get the block at pc, decoding it if needed. */
+template <class Bus>
+static inline const i8080_block* find_block(i8080_state* cpu) {
+    i8080_block_cache* cache = cpu->blocks;
+    i8080_block* slot = &cache->blocks[block_index(cpu->pc)];
+    const i8080_block* block = slot;
+    if (slot->num_ops && slot->pc == cpu->pc) {
+        cache->hits++;
+    }
+    else {
+        cache->misses++;
+        block = build_block<Bus>(cpu, slot);
+    }
+    IF_UNLIKELY(cache->profile) {
+        profile_block(cache->profile, block);
+    }
+    return block;
+}
+
+/* Run HLE loops and precompiled blocks from pc, until both are
+   missing or decline to run. Called at block boundaries. */
+template <class Bus>
+static void run_aot(i8080_state* cpu, std::uint64_t until_cycle) {
+    i8080_aot* aot = cpu->aot;
+    i8080_hle* hle = cpu->hle;
+    if (cpu->bp_pages) {
+        return;
+    }
+    for (;;)
+    {
+        i8080_hle_fn hle_fn = hle ? hle->fns[cpu->pc] : nullptr;
+        if (hle_fn) {
+            std::uint64_t start = cpu->cycles;
+            if (hle_fn(cpu, until_cycle)) {
+                hle->calls++;
+                hle->cycles += cpu->cycles - start;
+                continue;
+            }
+        }
+        i8080_aot_fn fn = aot ? aot->fns[cpu->pc] : nullptr;
+        if (!fn || !fn(cpu, until_cycle) || cpu->halt || cpu->int_rq) {
+            break;
+        }
+    }
+    if (aot) {
+        aot->exits++;
+    }
+}
+
+/* Run translated code from pc, until it needs the interpreter.
+   Called at block boundaries, so no interrupt is pending. */
+template <class Bus>
+static void run_jit(i8080_state* cpu, std::uint64_t until_cycle) {
+    i8080_jit* jit = cpu->jit;
+    if (cpu->bp_pages) {
+        return; /* breakpoints are only checked by the interpreter */
+    }
+    jit->psw = get_flags(cpu);
+
+    std::uint8_t* link_site = nullptr;
+    std::uint64_t link_gen = 0;
+    for (;;)
+    {
+        void* code = jit->code[cpu->pc];
+        if (!code) {
+            i8080_block block;
+            const i8080_block* decoded = build_block<Bus>(cpu, &block);
+            if (decoded == &cpu->blocks->scratch) { decoded = nullptr; }
+            code = jit->compile(cpu, decoded, CYCLES);
+        }
+        if (link_site && link_gen == jit->generation) {
+            jit->link(link_site, code);
+        }
+        jit->update_wpages(cpu);
+
+        i8080_jit_exit exit = jit->enter(cpu, code, until_cycle);
+        if (exit == I8080_JIT_EXIT_INTERP) {
+            break;
+        }
+        link_site = exit == I8080_JIT_EXIT_LINK ? jit->link_site : nullptr;
+        link_gen = jit->generation;
+    }
+    jit->exits++;
+    set_flags(cpu, jit->psw);
+}
+
+template <class Bus, i8080_word_t Opcode>
+static inline bool i8080_exec_op(i8080_state* cpu, i8080_addr_t imm);
+
+// Execution loop.
+//
+// Runs instructions until the cycle budget is used up, the CPU halts,
+// the bus fails, or pc reaches a breakpoint (other than at the first
+// instruction). Pending interrupts are taken between instructions.
+// The budget is only checked between instructions, so
+// until_cycle = cycles + 1 runs exactly one instruction.
+//
+// Handlers are written once and expanded for one of two dispatch engines:
+// - threaded: each handler ends with its own fetch and an indirect jump
+//   through a table of label addresses (GCC/Clang computed goto).
+//   Every opcode gets its own jump site, which the branch predictor
+//   handles much better than the single jump of a switch.
+// - switch: a plain switch in a loop. Portable fallback.
+//
+// With Blocks, instructions come from the block cache instead of
+// memory. pc is moved past the whole instruction before its handler
+// runs, and immediates come from the decoded op (IMM8/IMM16).
+// If precompiled code or a JIT is attached, each block boundary first
+// runs that, and the interpreter only runs the block it stopped at.
+// HLE loops (see i8080_hle.hpp) run the same way, but only where
+// there is one, so the other blocks don't leave the interpreter.
+// Fused pairs (see fuse_ops()) run both handlers from one dispatch,
+// with the same checks in between as two separate ops.
+//
+template <class Bus, bool Blocks>
+static i8080_exit i8080_exec(i8080_state* cpu, std::uint64_t until_cycle)
+{
+    const std::uint64_t bp_pages = cpu->bp_pages;
+    unsigned opcode; /* or fused handler, see i8080_op::handler */
+    i8080_exit exit;
+    bool first = true;
+
+    /* Current op and end of its block. Only used with Blocks. */
+    i8080_op intr_op;
+    const i8080_op* op = &intr_op;
+    const i8080_op* op_end = op + 1;
+    /* HLE, precompiled or JIT code to run at block boundaries. native_skip
+       interprets the next block, after they all gave up on it. */
+    const bool native = Blocks && (cpu->aot || cpu->jit);
+    const i8080_hle* hle = Blocks ? cpu->hle : nullptr;
+    bool native_skip = false;
+    /* Only used with Blocks. */
+    i8080_idle_check idle = {};
+
+    load_flags(cpu);
+
+#define STOP(reason) do { exit = reason; goto done; } while (0)
+
+#define IMM8 (Blocks ? (i8080_word_t)op->imm : read_word_adv<Bus>(cpu))
+#define IMM16 (Blocks ? op->imm : read_addr_adv<Bus>(cpu))
+
+/* Get next opcode, and move pc past it. */
+#define FETCH                                                     \
+    do {                                                          \
+        if (Blocks) {                                             \
+            IF_UNLIKELY(++op == op_end) {                         \
+                if ((native || (hle && hle->fns[cpu->pc])) &&     \
+                    !native_skip) { goto run_native; }            \
+                native_skip = false;                              \
+                const i8080_block* block = find_block<Bus>(cpu);  \
+                IF_UNLIKELY(block->idle_cycles) {                 \
+                    skip_idle_loop(cpu, block, idle,              \
+                        until_cycle, bp_pages);                   \
+                }                                                 \
+                idle.block = block;                               \
+                op = block->ops;                                  \
+                op_end = op + block->num_ops;                     \
+            }                                                     \
+            opcode = op->handler;                                 \
+            cpu->pc += op->len;                                   \
+        }                                                         \
+        else opcode = read_word_adv<Bus>(cpu);                    \
+    } while (0)
+
+#ifdef I8080_THREADED_DISPATCH
+#define L(op) &&L_##op
+    static const void* const DISPATCH_TABLE[I8080_FUSED_BASE + NUM_FUSED] = {
+        L(i8080_NOP), L(i8080_LXI_B), L(i8080_STAX_B), L(i8080_INX_B),
+        L(i8080_INR_B), L(i8080_DCR_B), L(i8080_MVI_B), L(i8080_RLC),
+        L(i8080_UD_NOP1), L(i8080_DAD_B), L(i8080_LDAX_B), L(i8080_DCX_B),
+        L(i8080_INR_C), L(i8080_DCR_C), L(i8080_MVI_C), L(i8080_RRC),
+        L(i8080_UD_NOP2), L(i8080_LXI_D), L(i8080_STAX_D), L(i8080_INX_D),
+        L(i8080_INR_D), L(i8080_DCR_D), L(i8080_MVI_D), L(i8080_RAL),
+        L(i8080_UD_NOP3), L(i8080_DAD_D), L(i8080_LDAX_D), L(i8080_DCX_D),
+        L(i8080_INR_E), L(i8080_DCR_E), L(i8080_MVI_E), L(i8080_RAR),
+        L(i8080_UD_NOP4), L(i8080_LXI_H), L(i8080_SHLD), L(i8080_INX_H),
+        L(i8080_INR_H), L(i8080_DCR_H), L(i8080_MVI_H), L(i8080_DAA),
+        L(i8080_UD_NOP5), L(i8080_DAD_H), L(i8080_LHLD), L(i8080_DCX_H),
+        L(i8080_INR_L), L(i8080_DCR_L), L(i8080_MVI_L), L(i8080_CMA),
+        L(i8080_UD_NOP6), L(i8080_LXI_SP), L(i8080_STA), L(i8080_INX_SP),
+        L(i8080_INR_M), L(i8080_DCR_M), L(i8080_MVI_M), L(i8080_STC),
+        L(i8080_UD_NOP7), L(i8080_DAD_SP), L(i8080_LDA), L(i8080_DCX_SP),
+        L(i8080_INR_A), L(i8080_DCR_A), L(i8080_MVI_A), L(i8080_CMC),
+        L(i8080_MOV_B_B), L(i8080_MOV_B_C), L(i8080_MOV_B_D), L(i8080_MOV_B_E),
+        L(i8080_MOV_B_H), L(i8080_MOV_B_L), L(i8080_MOV_B_M), L(i8080_MOV_B_A),
+        L(i8080_MOV_C_B), L(i8080_MOV_C_C), L(i8080_MOV_C_D), L(i8080_MOV_C_E),
+        L(i8080_MOV_C_H), L(i8080_MOV_C_L), L(i8080_MOV_C_M), L(i8080_MOV_C_A),
+        L(i8080_MOV_D_B), L(i8080_MOV_D_C), L(i8080_MOV_D_D), L(i8080_MOV_D_E),
+        L(i8080_MOV_D_H), L(i8080_MOV_D_L), L(i8080_MOV_D_M), L(i8080_MOV_D_A),
+        L(i8080_MOV_E_B), L(i8080_MOV_E_C), L(i8080_MOV_E_D), L(i8080_MOV_E_E),
+        L(i8080_MOV_E_H), L(i8080_MOV_E_L), L(i8080_MOV_E_M), L(i8080_MOV_E_A),
+        L(i8080_MOV_H_B), L(i8080_MOV_H_C), L(i8080_MOV_H_D), L(i8080_MOV_H_E),
+        L(i8080_MOV_H_H), L(i8080_MOV_H_L), L(i8080_MOV_H_M), L(i8080_MOV_H_A),
+        L(i8080_MOV_L_B), L(i8080_MOV_L_C), L(i8080_MOV_L_D), L(i8080_MOV_L_E),
+        L(i8080_MOV_L_H), L(i8080_MOV_L_L), L(i8080_MOV_L_M), L(i8080_MOV_L_A),
+        L(i8080_MOV_M_B), L(i8080_MOV_M_C), L(i8080_MOV_M_D), L(i8080_MOV_M_E),
+        L(i8080_MOV_M_H), L(i8080_MOV_M_L), L(i8080_HLT), L(i8080_MOV_M_A),
+        L(i8080_MOV_A_B), L(i8080_MOV_A_C), L(i8080_MOV_A_D), L(i8080_MOV_A_E),
+        L(i8080_MOV_A_H), L(i8080_MOV_A_L), L(i8080_MOV_A_M), L(i8080_MOV_A_A),
+        L(i8080_ADD_B), L(i8080_ADD_C), L(i8080_ADD_D), L(i8080_ADD_E),
+        L(i8080_ADD_H), L(i8080_ADD_L), L(i8080_ADD_M), L(i8080_ADD_A),
+        L(i8080_ADC_B), L(i8080_ADC_C), L(i8080_ADC_D), L(i8080_ADC_E),
+        L(i8080_ADC_H), L(i8080_ADC_L), L(i8080_ADC_M), L(i8080_ADC_A),
+        L(i8080_SUB_B), L(i8080_SUB_C), L(i8080_SUB_D), L(i8080_SUB_E),
+        L(i8080_SUB_H), L(i8080_SUB_L), L(i8080_SUB_M), L(i8080_SUB_A),
+        L(i8080_SBB_B), L(i8080_SBB_C), L(i8080_SBB_D), L(i8080_SBB_E),
+        L(i8080_SBB_H), L(i8080_SBB_L), L(i8080_SBB_M), L(i8080_SBB_A),
+        L(i8080_ANA_B), L(i8080_ANA_C), L(i8080_ANA_D), L(i8080_ANA_E),
+        L(i8080_ANA_H), L(i8080_ANA_L), L(i8080_ANA_M), L(i8080_ANA_A),
+        L(i8080_XRA_B), L(i8080_XRA_C), L(i8080_XRA_D), L(i8080_XRA_E),
+        L(i8080_XRA_H), L(i8080_XRA_L), L(i8080_XRA_M), L(i8080_XRA_A),
+        L(i8080_ORA_B), L(i8080_ORA_C), L(i8080_ORA_D), L(i8080_ORA_E),
+        L(i8080_ORA_H), L(i8080_ORA_L), L(i8080_ORA_M), L(i8080_ORA_A),
+        L(i8080_CMP_B), L(i8080_CMP_C), L(i8080_CMP_D), L(i8080_CMP_E),
+        L(i8080_CMP_H), L(i8080_CMP_L), L(i8080_CMP_M), L(i8080_CMP_A),
+        L(i8080_RNZ), L(i8080_POP_B), L(i8080_JNZ), L(i8080_JMP),
+        L(i8080_CNZ), L(i8080_PUSH_B), L(i8080_ADI), L(i8080_RST_0),
+        L(i8080_RZ), L(i8080_RET), L(i8080_JZ), L(i8080_UD_JMP),
+        L(i8080_CZ), L(i8080_CALL), L(i8080_ACI), L(i8080_RST_1),
+        L(i8080_RNC), L(i8080_POP_D), L(i8080_JNC), L(i8080_OUT),
+        L(i8080_CNC), L(i8080_PUSH_D), L(i8080_SUI), L(i8080_RST_2),
+        L(i8080_RC), L(i8080_UD_RET), L(i8080_JC), L(i8080_IN),
+        L(i8080_CC), L(i8080_UD_CALL1), L(i8080_SBI), L(i8080_RST_3),
+        L(i8080_RPO), L(i8080_POP_H), L(i8080_JPO), L(i8080_XTHL),
+        L(i8080_CPO), L(i8080_PUSH_H), L(i8080_ANI), L(i8080_RST_4),
+        L(i8080_RPE), L(i8080_PCHL), L(i8080_JPE), L(i8080_XCHG),
+        L(i8080_CPE), L(i8080_UD_CALL2), L(i8080_XRI), L(i8080_RST_5),
+        L(i8080_RP), L(i8080_POP_PSW), L(i8080_JP), L(i8080_DI),
+        L(i8080_CP), L(i8080_PUSH_PSW), L(i8080_ORI), L(i8080_RST_6),
+        L(i8080_RM), L(i8080_SPHL), L(i8080_JM), L(i8080_EI),
+        L(i8080_CM), L(i8080_UD_CALL3), L(i8080_CPI), L(i8080_RST_7),
+#define FUSED(n, first, second) &&L_FUSED_##n,
+#include "i8080_fused.inc"
+#undef FUSED
+    };
+#undef L
+
+#define OP(op) L_##op:
+#define FUSED_OP(n) L_FUSED_##n:
+#define DISPATCH goto *DISPATCH_TABLE[opcode]
+#define NEXT                                                      \
+    do {                                                          \
+        cpu->cycles += CYCLES[opcode];                            \
+        IF_UNLIKELY(cpu->cycles >= until_cycle ||                 \
+            cpu->halt || cpu->int_rq ||                           \
+            get_bit(bp_pages, cpu->pc >> I8080_PAGE_SHIFT)) {     \
+            goto check;                                           \
+        }                                                         \
+        FETCH;                                                    \
+        DISPATCH;                                                 \
+    } while (0)
+#else
+#define OP(op) case op:
+#define FUSED_OP(n) case I8080_FUSED_BASE + n:
+#define DISPATCH goto dispatch
+#define NEXT break
+#endif
+
+    // Checks between instructions. Follows the state
+    // transitions as closely as possible (datasheet pg 7).
+check:
+    IF_UNLIKELY(cpu->cycles >= until_cycle) {
+        STOP(I8080_EXIT_BUDGET);
+    }
+    if (cpu->int_rq) {
+        i8080_word_t intr_opcode;
+        IF_UNLIKELY(!Bus::intr_read(cpu, intr_opcode)) {
+            STOP(I8080_EXIT_NO_CALLBACK);
+        }
+        opcode = intr_opcode;
+        cpu->int_en = 0;
+        cpu->int_rq = 0;
+        cpu->halt = 0;
+        if (Blocks) {
+            /* Not from memory, so decode it here. */
+            intr_op = decode_op<Bus>(cpu, intr_opcode, cpu->pc);
+            op = &intr_op;
+            op_end = op + 1;
+            opcode = op->opcode;
+            cpu->pc += op->len;
+        }
+    }
+    else {
+        if (cpu->halt) {
+            STOP(I8080_EXIT_HALT);
+        }
+        if (get_bit(bp_pages, cpu->pc >> I8080_PAGE_SHIFT) &&
+            !first && cpu->is_breakpoint(cpu->pc)) {
+            STOP(I8080_EXIT_BREAKPOINT);
+        }
+        FETCH;
+    }
+    first = false;
+
+#ifdef I8080_THREADED_DISPATCH
+    goto *DISPATCH_TABLE[opcode];
+    {
+#else
+    for (;;)
+    {
+    dispatch:
+    switch (opcode)
+    {
+#endif
+    /* Never decoded, marks ops of invalidated blocks (see BLOCK_EXIT_OP). */
+    OP(i8080_UD_NOP1)
+        if (Blocks) {
+            op_end = op + 1;
+            FETCH;
+            DISPATCH;
+        }
+        /* fall through */
+
+#include "i8080_handlers.inc"
+
+    /* Only reached with Blocks. Runs the first op, then the
+       same checks as NEXT, then the second op. Also checks that the
+       second op is still there, the first may have written to it. */
+#define FUSED(n, op1, op2)                                        \
+    FUSED_OP(n)                                                   \
+        i8080_exec_op<Bus, op1>(cpu, op->imm);                    \
+        opcode = op1;                                             \
+        cpu->cycles += CYCLES[op1];                               \
+        IF_UNLIKELY(cpu->cycles >= until_cycle ||                 \
+            cpu->halt || cpu->int_rq || op[1].opcode != op2 ||    \
+            get_bit(bp_pages, cpu->pc >> I8080_PAGE_SHIFT)) {     \
+            goto check;                                           \
+        }                                                         \
+        ++op;                                                     \
+        opcode = op2;                                             \
+        cpu->pc += op->len;                                       \
+        IF_UNLIKELY(!(i8080_exec_op<Bus, op2>(cpu, op->imm))) {   \
+            STOP(I8080_EXIT_NO_CALLBACK);                         \
+        }                                                         \
+        NEXT;
+#include "i8080_fused.inc"
+#undef FUSED
+    }
+
+#ifndef I8080_THREADED_DISPATCH
+    cpu->cycles += CYCLES[opcode];
+    IF_UNLIKELY(cpu->cycles >= until_cycle || 
+        cpu->halt || cpu->int_rq ||
+        get_bit(bp_pages, cpu->pc >> I8080_PAGE_SHIFT)) {
+        goto check;
+    }
+    FETCH;
+    }
+#endif
+
+    /* Only reached with Blocks, from FETCH. */
+run_native:
+    if (cpu->aot || cpu->hle) {
+        run_aot<Bus>(cpu, until_cycle);
+    }
+    if (cpu->jit && !cpu->halt && !cpu->int_rq) {
+        run_jit<Bus>(cpu, until_cycle);
+    }
+    native_skip = true;
+    idle.block = nullptr; /* anything could have run */
+    op = &intr_op;
+    op_end = op + 1;
+    goto check;
+
+done:
+    store_flags(cpu);
+    return exit;
+
+#undef OP
+#undef FUSED_OP
+#undef NEXT
+#undef DISPATCH
+#undef STOP
+#undef IMM8
+#undef IMM16
+#undef FETCH
+}
+
+// Run one instruction whose opcode is known at compile time, with pc
+// already moved past it, using the interpreter's handlers. Everything
+// but the handler folds away. For generated code (see i8080_aot.hpp),
+// which must be inside run(). Cycles are not counted. Returns false if
+// the bus could not handle an IO access.
+template <class Bus, i8080_word_t Opcode>
+static inline bool i8080_exec_op(i8080_state* cpu, i8080_addr_t imm)
+{
+    (void)imm;
+
+#define OP(op) case op:
+#define NEXT return true
+#define STOP(reason) return false
+#define IMM8 ((i8080_word_t)imm)
+#define IMM16 (imm)
+
+    switch (Opcode)
+    {
+    OP(i8080_UD_NOP1)
+#include "i8080_handlers.inc"
+    }
+    return true;
+
+#undef OP
+#undef NEXT
+#undef STOP
+#undef IMM8
+#undef IMM16
+}
+
+template <class Bus>
+int basic_i8080<Bus>::step() 
+{
+    i8080_exit exit = run(cycles + 1);
+    return exit == I8080_EXIT_NO_CALLBACK ? -1 : 0;
+}
+
+template <class Bus>
+i8080_exit basic_i8080<Bus>::run(std::uint64_t until_cycle)
+{
+    if (blocks) {
+        return i8080_exec<Bus, true>(this, until_cycle);
+    }
+    return i8080_exec<Bus, false>(this, until_cycle);
+}
+
+// '?' indicates that the instruction is undocumented
+static const char* OP_TO_STR[] = {
+    "nop",  "lxi", "stax", "inx", "inr", "dcr", "mvi", "rlc",
+    "?nop", "dad", "ldax", "dcx", "inr", "dcr", "mvi", "rrc",
+    "?nop", "lxi", "stax", "inx", "inr", "dcr", "mvi", "ral",
+    "?nop", "dad", "ldax", "dcx", "inr", "dcr", "mvi", "rar",
+    "?nop", "lxi", "shld", "inx", "inr", "dcr", "mvi", "daa",
+    "?nop", "dad", "lhld", "dcx", "inr", "dcr", "mvi", "cma",
+    "?nop", "lxi", "sta",  "inx", "inr", "dcr", "mvi", "stc",
+    "?nop", "dad", "lda",  "dcx", "inr", "dcr", "mvi", "cmc",
+
+    "mov", "mov", "mov", "mov", "mov", "mov", "mov", "mov",
+    "mov", "mov", "mov", "mov", "mov", "mov", "mov", "mov",
+    "mov", "mov", "mov", "mov", "mov", "mov", "mov", "mov",
+    "mov", "mov", "mov", "mov", "mov", "mov", "mov", "mov",
+    "mov", "mov", "mov", "mov", "mov", "mov", "mov", "mov",
+    "mov", "mov", "mov", "mov", "mov", "mov", "mov", "mov",
+    "mov", "mov", "mov", "mov", "mov", "mov", "hlt", "mov",
+    "mov", "mov", "mov", "mov", "mov", "mov", "mov", "mov",
+
+    "add", "add", "add", "add", "add", "add", "add", "add",
+    "adc", "adc", "adc", "adc", "adc", "adc", "adc", "adc",
+    "sub", "sub", "sub", "sub", "sub", "sub", "sub", "sub",
+    "sbb", "sbb", "sbb", "sbb", "sbb", "sbb", "sbb", "sbb",
+
+    "ana", "ana", "ana", "ana", "ana", "ana", "ana", "ana",
+    "xra", "xra", "xra", "xra", "xra", "xra", "xra", "xra",
+    "ora", "ora", "ora", "ora", "ora", "ora", "ora", "ora",
+    "cmp", "cmp", "cmp", "cmp", "cmp", "cmp", "cmp", "cmp",
+
+    "rnz", "pop",  "jnz", "jmp",  "cnz", "push",  "adi", "rst",
+    "rz",  "ret",  "jz",  "?jmp", "cz",  "call",  "aci", "rst",
+    "rnc", "pop",  "jnc", "out",  "cnc", "push",  "sui", "rst",
+    "rc",  "?ret", "jc",  "in",   "cc",  "?call", "sbi", "rst",
+    "rpo", "pop",  "jpo", "xthl", "cpo", "push",  "ani", "rst",
+    "rpe", "pchl", "jpe", "xchg", "cpe", "?call", "xri", "rst",
+    "rp",  "pop",  "jp",  "di",   "cp",  "push",  "ori", "rst",
+    "rm",  "sphl", "jm",  "ei",   "cm",  "?call", "cpi", "rst"
+};
+
+static const char* OPARGS_TO_STR[] = {
+    NULL, "b, %04xh",  "b",     "b",  "b", "b", "b, %02xh", NULL,
+    NULL, "b",         "b",     "b",  "c", "c", "c, %02xh", NULL,
+    NULL, "d, %04xh",  "d",     "d",  "d", "d", "d, %02xh", NULL,
+    NULL, "d",         "d",     "d",  "e", "e", "e, %02xh", NULL,
+    NULL, "h, %04xh",  "%04xh", "h",  "h", "h", "h, %02xh", NULL,
+    NULL, "h",         "%04xh", "h",  "l", "l", "l, %02xh", NULL,
+    NULL, "sp, %04xh", "%04xh", "sp", "m", "m", "m, %02xh", NULL,
+    NULL, "sp",        "%04xh", "sp", "a", "a", "a, %02xh", NULL,
+
+    "b, b", "b, c", "b, d", "b, e", "b, h", "b, l", "b, m", "b, a",
+    "c, b", "c, c", "c, d", "c, e", "c, h", "c, l", "c, m", "c, a",
+    "d, b", "d, c", "d, d", "d, e", "d, h", "d, l", "d, m", "d, a",
+    "e, b", "e, c", "e, d", "e, e", "e, h", "e, l", "e, m", "e, a",
+    "h, b", "h, c", "h, d", "h, e", "h, h", "h, l", "h, m", "h, a",
+    "l, b", "l, c", "l, d", "l, e", "l, h", "l, l", "l, m", "l, a",
+    "m, b", "m, c", "m, d", "m, e", "m, h", "m, l", NULL,   "m, a",
+    "a, b", "a, c", "a, d", "a, e", "a, h", "a, l", "a, m", "a, a",
+
+    "b", "c", "d", "e", "h", "l", "m", "a",
+    "b", "c", "d", "e", "h", "l", "m", "a",
+    "b", "c", "d", "e", "h", "l", "m", "a",
+    "b", "c", "d", "e", "h", "l", "m", "a",
+
+    "b", "c", "d", "e", "h", "l", "m", "a",
+    "b", "c", "d", "e", "h", "l", "m", "a",
+    "b", "c", "d", "e", "h", "l", "m", "a",
+    "b", "c", "d", "e", "h", "l", "m", "a",
+
+    NULL, "b",   "%04xh", "%04xh", "%04xh", "b",     "%02xh", "0",
+    NULL, NULL,  "%04xh", "%04xh", "%04xh", "%04xh", "%02xh", "1",
+    NULL, "d",   "%04xh", "%02xh", "%04xh", "d",     "%02xh", "2",
+    NULL, NULL,  "%04xh", "%02xh", "%04xh", "%04xh", "%02xh", "3",
+    NULL, "h",   "%04xh", NULL,    "%04xh", "h",     "%02xh", "4",
+    NULL, NULL,  "%04xh", NULL,    "%04xh", "%04xh", "%02xh", "5",
+    NULL, "psw", "%04xh", NULL,    "%04xh", "psw",   "%02xh", "6",
+    NULL, NULL,  "%04xh", NULL,    "%04xh", "%04xh", "%02xh", "7"
+};
+
+template <class Bus>
+void basic_i8080<Bus>::disassemble(std::FILE* os)
+{
+    i8080_word_t opcode = read_word_adv<Bus>(this);
+
+    const char* opname = OP_TO_STR[opcode];
+    const char* opargs = OPARGS_TO_STR[opcode];
+
+    std::fprintf(os, "0x%04x\t", pc);
+
+    if (opargs == NULL) {
+        fputs(opname, os);
+    }
+    else { 
+        // requires special formatting
+        char fmtbuf[64];
+        std::strcpy(fmtbuf, "%-6s");
+        std::strcat(fmtbuf, opargs);
+
+        switch (opcode)
+        {
+            // 3 byte instructions
+        case i8080_LXI_B: case i8080_LXI_D:
+        case i8080_LXI_H: case i8080_LXI_SP:
+        case i8080_SHLD: case i8080_LHLD:
+        case i8080_STA: case i8080_LDA:
+        case i8080_JNZ: case i8080_JZ:
+        case i8080_JNC: case i8080_JC:
+        case i8080_JPO: case i8080_JPE:
+        case i8080_JP:  case i8080_JM:
+        case i8080_JMP: case i8080_UD_JMP:
+        case i8080_CNZ: case i8080_CZ:
+        case i8080_CNC: case i8080_CC:
+        case i8080_CPO: case i8080_CPE:
+        case i8080_CP:  case i8080_CM:
+        case i8080_CALL:
+        case i8080_UD_CALL1:
+        case i8080_UD_CALL2:
+        case i8080_UD_CALL3:
+            std::fprintf(os, fmtbuf, opname, read_addr_adv<Bus>(this));
+            break;
+
+            // 2 byte instructions
+        case i8080_MVI_B: case i8080_MVI_C:
+        case i8080_MVI_D: case i8080_MVI_E:
+        case i8080_MVI_H: case i8080_MVI_L:
+        case i8080_MVI_M: case i8080_MVI_A:
+        case i8080_OUT: case i8080_IN:
+        case i8080_ADI: case i8080_ACI:
+        case i8080_SUI: case i8080_SBI:
+        case i8080_ANI: case i8080_XRI:
+        case i8080_ORI: case i8080_CPI:
+            std::fprintf(os, fmtbuf, opname, read_word_adv<Bus>(this));
+            break;
+
+            // 1 byte instructions
+        default:
+            std::fprintf(os, fmtbuf, opname);
+            break;
+        }
+    }
+}
+
+// Don't leak helper macros into the including file.
+#undef IF_UNLIKELY
+#undef HAS_BUILTIN_EXPECT
+#undef min2
+#undef CARRY_BIT
+#undef PARITY_BIT
+#undef AUX_CARRY_BIT
+#undef ZERO_BIT
+#undef SIGN_BIT
+#undef WORD_MAX
+#undef word_lo
+#undef word_hi
+#undef dword_lo
+#undef dword_hi
+#undef get_bit
+#undef set_bit
+#undef concatenate
+#undef get_bc
+#undef get_de
+#undef get_hl
+#undef get_psw
+#undef flag_z
+#undef flag_s
+#undef flag_p
+#undef flag_ac
+#undef flag_cy
+#undef set_aux
+#undef set_cy
+#undef load_flags
+#undef store_flags
+#ifdef I8080_LAZY_FLAGS
+#undef update_zsp
+#else
+#undef set_flags
+#endif
+#undef PAGE_OFFSET_MASK
+#undef NUM_FUSED
+#undef FLAGS_ZSP
+#undef FLAGS_AC
+#undef FLAGS_CY
+#undef FLAGS_ALL
+#undef read_mem_hl
+#undef write_mem_hl
+#undef i8080_jmp
+#undef i8080_call
+#undef i8080_ret
+
+#endif /* I8080_IMPL_HPP */
@@ -0,0 +1,953 @@
+//
+// x86-64 code generation for i8080_jit.
+//
+// Register use in translated code:
+//
+//   al  A          r15  i8080_state*
+//   ah  flags      r12  i8080_jit*
+//   bx  HL         r13  until_cycle
+//   cx  BC         r8-r11, rsi, rdi  scratch
+//   dx  DE
+//   bp  SP
+//
+// The 8080's flag byte has the same layout as x86's LAHF/SAHF, and
+// its ADD/SUB/INC/logic ops set S, Z, P and CY the same way. Aux
+// carry is inverted for subtraction and DCR, and set differently by
+// ANA/XRA/ORA, which is fixed up after LAHF.
+//
+// Only the upper 16 bits of rbx/rcx/rdx/rbp are undefined, so addresses
+// are always zero-extended first. High byte registers (ah, bh, ch, dh)
+// can't be used in instructions with a REX prefix, so memory they
+// touch is only addressed through rdi/rsi.
+//
+
+#include "i8080_jit.hpp"
+#include "i8080_opcodes.hpp"
+
+#include <cassert>
+#include <cstring>
+
+#ifdef I8080_JIT_X64
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+i8080_jit::i8080_jit() :
+    wpages_code(0),
+    wpages_dirty(true),
+    psw(0),
+    link_site(nullptr),
+    translations(0),
+    flushes(0),
+    exits(0),
+    generation(0),
+    m_buf(nullptr),
+    m_used(0),
+    m_base(0),
+    m_enter(nullptr),
+    m_exit(nullptr),
+    m_lookup_exit(nullptr)
+{
+    std::memset(code, 0, sizeof(code));
+    std::memset(wpages, 0, sizeof(wpages));
+    std::memset(code_map, 0, sizeof(code_map));
+}
+
+void i8080_jit::flush()
+{
+    std::memset(code, 0, sizeof(code));
+    std::memset(code_map, 0, sizeof(code_map));
+    m_used = m_base;
+    wpages_dirty = true;
+    generation++;
+    flushes++;
+}
+
+void i8080_jit::link(std::uint8_t* site, void* target)
+{
+    std::int32_t rel = (std::int32_t)((std::uint8_t*)target - site);
+    std::memcpy(site - 4, &rel, 4);
+}
+
+void i8080_jit::update_wpages(const i8080_state* cpu)
+{
+    if (!wpages_dirty && wpages_code == cpu->code_pages) {
+        return;
+    }
+    for (unsigned i = 0; i < I8080_NUM_PAGES; ++i) {
+        wpages[i] = ((cpu->code_pages >> i) & 1) ? nullptr : cpu->wpages[i];
+    }
+    wpages_code = cpu->code_pages;
+    wpages_dirty = false;
+}
+
+i8080_jit_exit i8080_jit::enter(i8080_state* cpu, void* target, std::uint64_t until_cycle)
+{
+    return (i8080_jit_exit)m_enter(cpu, this, target, until_cycle);
+}
+
+#ifndef I8080_JIT_X64
+
+i8080_jit::~i8080_jit() {}
+
+int i8080_jit::init() { return -1; }
+
+void i8080_jit::emit_runtime() {}
+
+void* i8080_jit::compile(const i8080_state*, const i8080_block*, const std::uint8_t*)
+{
+    return nullptr;
+}
+
+#else
+
+namespace {
+
+enum reg : int
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    NO_REG = -1
+};
+
+// Byte registers, as encoded without a REX prefix.
+enum reg8 : int { AL, CL, DL, BL, AH, CH, DH, BH };
+
+#ifdef _WIN32
+const int ARG_REGS[] = { RCX, RDX, R8, R9 };
+#else
+const int ARG_REGS[] = { RDI, RSI, RDX, RCX };
+#endif
+
+// [base + index * 8 + disp]
+struct mem_op
+{
+    int base;
+    std::int32_t disp;
+    int index = NO_REG;
+};
+
+// x86 condition codes
+enum cond : int { CC_B = 0x2, CC_AE = 0x3, CC_Z = 0x4, CC_NZ = 0x5 };
+
+// Group 1 ALU ops, in x86 encoding order.
+enum alu : int { ALU_ADD, ALU_OR, ALU_ADC, ALU_SBB, ALU_AND, ALU_SUB, ALU_XOR, ALU_CMP };
+
+struct emitter
+{
+    std::uint8_t* p;
+
+    void b(std::uint8_t x) { *p++ = x; }
+    void d16(std::uint16_t x) { std::memcpy(p, &x, 2); p += 2; }
+    void d32(std::uint32_t x) { std::memcpy(p, &x, 4); p += 4; }
+    void d64(std::uint64_t x) { std::memcpy(p, &x, 8); p += 8; }
+
+    // byte8: reg is a byte register that would become sil etc. with REX.
+    void rex(bool w, int r, int x, int base, bool byte8 = false) {
+        std::uint8_t v = 0x40 | (w << 3) |
+            (((r >> 3) & 1) << 2) | (((x >> 3) & 1) << 1) | ((base >> 3) & 1);
+        assert(!(byte8 && (r & 7) >= 4 && r < 8 && v != 0x40));
+        (void)byte8;
+        if (v != 0x40) { b(v); }
+    }
+    void rex_m(bool w, int r, const mem_op& m, bool byte8 = false) {
+        rex(w, r, m.index == NO_REG ? 0 : m.index, m.base, byte8);
+    }
+
+    void modrm_rr(int r, int rm) {
+        b(0xc0 | ((r & 7) << 3) | (rm & 7));
+    }
+    void modrm_m(int r, const mem_op& m) {
+        int base = m.base & 7;
+        bool sib = m.index != NO_REG || base == RSP;
+        int mod = 2;
+        if (m.disp == 0 && base != RBP) { mod = 0; }
+        else if (m.disp >= -128 && m.disp <= 127) { mod = 1; }
+
+        b((mod << 6) | ((r & 7) << 3) | (sib ? 4 : base));
+        if (sib) {
+            if (m.index == NO_REG) { b(0x24); } // no index
+            else { b((3 << 6) | ((m.index & 7) << 3) | base); }
+        }
+        if (mod == 1) { b((std::uint8_t)m.disp); }
+        else if (mod == 2) { d32((std::uint32_t)m.disp); }
+    }
+
+    // ---- byte registers (A, B, C, ... are never combined with REX) ----
+
+    void mov8_rr(int dst, int src) { b(0x88); modrm_rr(src, dst); }
+    void mov8_ri(int dst, std::uint8_t imm) { b(0xb0 + dst); b(imm); }
+    void mov8_rm(int dst, const mem_op& m) { rex_m(false, dst, m, true); b(0x8a); modrm_m(dst, m); }
+    void mov8_mr(const mem_op& m, int src) { rex_m(false, src, m, true); b(0x88); modrm_m(src, m); }
+    void mov8_mi(const mem_op& m, std::uint8_t imm) { rex_m(false, 0, m); b(0xc6); modrm_m(0, m); b(imm); }
+
+    void alu8_rr(int op, int dst, int src) { b((std::uint8_t)(op * 8)); modrm_rr(src, dst); }
+    void alu8_rm(int op, int dst, const mem_op& m) {
+        rex_m(false, dst, m, true); b((std::uint8_t)(op * 8 + 2)); modrm_m(dst, m);
+    }
+    void alu8_ri(int op, int dst, std::uint8_t imm) {
+        if (dst == AL) { b((std::uint8_t)(op * 8 + 4)); }
+        else { b(0x80); modrm_rr(op, dst); }
+        b(imm);
+    }
+    // REX byte ops on r8b-r15b
+    void inc8_r(int r, bool dec) { rex(false, 0, 0, r); b(0xfe); modrm_rr(dec ? 1 : 0, r); }
+    void test8_ri(int r, std::uint8_t imm) { b(0xf6); modrm_rr(0, r); b(imm); }
+    void shift8_1(int ext, int r) { b(0xd0); modrm_rr(ext, r); } // rol/ror/rcl/rcr
+    void not8(int r) { b(0xf6); modrm_rr(2, r); }
+    void lahf() { b(0x9f); }
+    void sahf() { b(0x9e); }
+
+    // ---- 16 bit ----
+
+    void inc16(int r, bool dec) { b(0x66); b(0xff); modrm_rr(dec ? 1 : 0, r); }
+    void add16_rr(int dst, int src) { b(0x66); b(0x01); modrm_rr(src, dst); }
+    void xchg16_rr(int r1, int r2) { b(0x66); b(0x87); modrm_rr(r1, r2); }
+    void mov16_mr(const mem_op& m, int src) { b(0x66); rex_m(false, src, m); b(0x89); modrm_m(src, m); }
+    void mov16_mi(const mem_op& m, std::uint16_t imm) {
+        b(0x66); rex_m(false, 0, m); b(0xc7); modrm_m(0, m); d16(imm);
+    }
+
+    // ---- 32/64 bit ----
+
+    void mov_rr(bool w, int dst, int src) { rex(w, src, 0, dst); b(0x89); modrm_rr(src, dst); }
+    void mov_mr(bool w, const mem_op& m, int src) { rex_m(w, src, m); b(0x89); modrm_m(src, m); }
+    void mov_rm(bool w, int dst, const mem_op& m) { rex_m(w, dst, m); b(0x8b); modrm_m(dst, m); }
+    void mov_ri(int dst, std::uint32_t imm) { rex(false, 0, 0, dst); b(0xb8 + (dst & 7)); d32(imm); }
+    void mov_ri64(int dst, std::uint64_t imm) { rex(true, 0, 0, dst); b(0xb8 + (dst & 7)); d64(imm); }
+    void movzx8_rr(int dst, int src8) { rex(false, dst, 0, src8, true); b(0x0f); b(0xb6); modrm_rr(dst, src8); }
+    void movzx8_rm(int dst, const mem_op& m) { rex_m(false, dst, m); b(0x0f); b(0xb6); modrm_m(dst, m); }
+    void movzx16_rr(int dst, int src) { rex(false, dst, 0, src); b(0x0f); b(0xb7); modrm_rr(dst, src); }
+    void movzx16_rm(int dst, const mem_op& m) { rex_m(false, dst, m); b(0x0f); b(0xb7); modrm_m(dst, m); }
+    void lea(bool w, int dst, const mem_op& m) { rex_m(w, dst, m); b(0x8d); modrm_m(dst, m); }
+
+    void alu_rr(bool w, int op, int dst, int src) {
+        rex(w, src, 0, dst); b((std::uint8_t)(op * 8 + 1)); modrm_rr(src, dst);
+    }
+    void alu_ri(bool w, int op, int dst, std::int32_t imm) {
+        rex(w, 0, 0, dst);
+        if (imm >= -128 && imm <= 127) { b(0x83); modrm_rr(op, dst); b((std::uint8_t)imm); }
+        else { b(0x81); modrm_rr(op, dst); d32((std::uint32_t)imm); }
+    }
+    void alu_mi(bool w, int op, const mem_op& m, std::int32_t imm) {
+        rex_m(w, 0, m);
+        if (imm >= -128 && imm <= 127) { b(0x83); modrm_m(op, m); b((std::uint8_t)imm); }
+        else { b(0x81); modrm_m(op, m); d32((std::uint32_t)imm); }
+    }
+    void shift_ri(int ext, int r, std::uint8_t imm) { rex(false, 0, 0, r); b(0xc1); modrm_rr(ext, r); b(imm); }
+    void shl_ri(int r, std::uint8_t imm) { shift_ri(4, r, imm); }
+    void shr_ri(int r, std::uint8_t imm) { shift_ri(5, r, imm); }
+    void test_rr(bool w, int r1, int r2) { rex(w, r2, 0, r1); b(0x85); modrm_rr(r2, r1); }
+    void cmp_rr(bool w, int r1, int r2) { alu_rr(w, ALU_CMP, r1, r2); }
+
+    void push(int r) { rex(false, 0, 0, r); b(0x50 + (r & 7)); }
+    void pop(int r) { rex(false, 0, 0, r); b(0x58 + (r & 7)); }
+    void ret() { b(0xc3); }
+
+    // ---- jumps. Each returns the end of its rel32, for patch(). ----
+
+    std::uint8_t* jmp(const void* target = nullptr) {
+        b(0xe9); d32(0);
+        if (target) { patch(p, target); }
+        return p;
+    }
+    std::uint8_t* jcc(int cc, const void* target = nullptr) {
+        b(0x0f); b((std::uint8_t)(0x80 + cc)); d32(0);
+        if (target) { patch(p, target); }
+        return p;
+    }
+    void jmp_r(int r) { rex(false, 0, 0, r); b(0xff); modrm_rr(4, r); }
+
+    // lea dst, [rip + to target]
+    void lea_rip(int dst, const void* target) {
+        rex(true, dst, 0, 0); b(0x8d); b(((dst & 7) << 3) | 5); d32(0);
+        patch(p, target);
+    }
+
+    static void patch(std::uint8_t* end, const void* target) {
+        std::int32_t rel = (std::int32_t)((const std::uint8_t*)target - end);
+        std::memcpy(end - 4, &rel, 4);
+    }
+    void here(std::uint8_t* end) { patch(end, p); }
+};
+
+#define STATE(field) mem_op{ R15, (std::int32_t)offsetof(i8080_state, field) }
+#define JIT(field) mem_op{ R12, (std::int32_t)offsetof(i8080_jit, field) }
+
+const mem_op AT_RDI = { RDI, 0 };
+const mem_op AT_RSI = { RSI, 0 };
+
+/* Host byte register for the 8080 register in bits 0-2 of an
+   opcode (B, C, D, E, H, L, M, A). */
+const int REG8[8] = { CH, CL, DH, DL, BH, BL, -1, AL };
+#define REG_M 6
+
+/* Host register for the pair in bits 4-5 (BC, DE, HL, SP). */
+const int REG16[4] = { RCX, RDX, RBX, RBP };
+
+/* Flag tested by conditional jumps/calls/returns, by bits 3-5. */
+const std::uint8_t COND_MASK[8] = { 0x40, 0x40, 0x01, 0x01, 0x04, 0x04, 0x80, 0x80 };
+
+#define AUX_CARRY 0x10
+#define CARRY 0x01
+
+// Translates one block.
+struct translator
+{
+    emitter e;
+    std::uint8_t* end;     // of the code buffer, minus slack
+    i8080_jit* jit;
+    const i8080_state* cpu;
+    const std::uint8_t* cycles;
+    std::uint8_t* exit;
+    std::uint8_t* lookup_exit;
+
+    i8080_addr_t pc;        // start of the block
+    std::uint8_t* entry;
+    i8080_addr_t addrs[I8080_BLOCK_MAX_OPS + 1];
+    std::uint32_t pre[I8080_BLOCK_MAX_OPS + 1]; // cycles before each op
+
+    // Jumps to fix up once the body is emitted.
+    struct fixup { std::uint8_t* site; int op; i8080_addr_t target; };
+    fixup bails[I8080_BLOCK_MAX_OPS * 4];
+    int num_bails = 0;
+    fixup links[2];
+    int num_links = 0;
+
+    int cur_op = 0;
+
+    /* Go to the interpreter from the start of the current op. */
+    void bail_if(int cc) {
+        bails[num_bails++] = { e.jcc(cc), cur_op, 0 };
+    }
+
+    void add_cycles(std::uint32_t n) {
+        if (n) { e.alu_mi(true, ALU_ADD, STATE(cycles), (std::int32_t)n); }
+    }
+
+    /* Jump to the translation of target, or a stub that asks for it. */
+    void chain(i8080_addr_t target) {
+        if (target == pc) { e.jmp(entry); }
+        else if (jit->code[target]) { e.jmp(jit->code[target]); }
+        else { links[num_links++] = { e.jmp(), 0, target }; }
+    }
+
+    /* Jump to the address in r10d. */
+    void chain_indirect() {
+        e.mov16_mr(STATE(pc), R10);
+        e.mov_rm(true, R11, mem_op{ R12, (std::int32_t)offsetof(i8080_jit, code), R10 });
+        e.test_rr(true, R11, R11);
+        e.jcc(CC_Z, lookup_exit);
+        e.jmp_r(R11);
+    }
+
+    // Addresses are put in r9d, then resolve() turns them
+    // into a host pointer in ptr, or bails if not mapped.
+
+    void addr_rp(int r16) { e.movzx16_rr(R9, r16); }
+    void addr_sp(int off) {
+        e.lea(false, R9, mem_op{ RBP, off });
+        e.movzx16_rr(R9, R9);
+    }
+    void addr_imm(i8080_addr_t addr) { e.mov_ri(R9, addr); }
+
+    void resolve(bool write, int ptr) {
+        e.mov_rr(false, R8, R9);
+        e.shr_ri(R8, I8080_PAGE_SHIFT);
+        if (write) { e.mov_rm(true, ptr, mem_op{ R12, (std::int32_t)offsetof(i8080_jit, wpages), R8 }); }
+        else { e.mov_rm(true, ptr, mem_op{ R15, (std::int32_t)offsetof(i8080_state, rpages), R8 }); }
+        e.test_rr(true, ptr, ptr);
+        bail_if(CC_Z);
+        e.alu_ri(false, ALU_AND, R9, I8080_PAGE_SIZE - 1);
+        e.alu_rr(true, ALU_ADD, ptr, R9);
+    }
+
+    /* Host pointer to addr if mapped for reads now, else null.
+       Mappings only change through map_mem(), which flushes. */
+    const i8080_word_t* static_read(i8080_addr_t addr) const {
+        const i8080_word_t* page = cpu->rpages[addr >> I8080_PAGE_SHIFT];
+        return page ? page + (addr & (I8080_PAGE_SIZE - 1)) : nullptr;
+    }
+
+    /* Write the 16-bit address to [sp - 2], and move sp. */
+    void push_imm(i8080_addr_t word) {
+        addr_sp(-1); resolve(true, RDI);
+        addr_sp(-2); resolve(true, RSI);
+        e.mov8_mi(AT_RDI, (std::uint8_t)(word >> 8));
+        e.mov8_mi(AT_RSI, (std::uint8_t)word);
+        e.alu_ri(false, ALU_SUB, RBP, 2);
+    }
+
+    /* Pop into r10d. */
+    void pop_r10() {
+        addr_sp(0); resolve(false, RSI);
+        addr_sp(1); resolve(false, RDI);
+        e.movzx8_rm(R10, AT_RSI);
+        e.movzx8_rm(R11, AT_RDI);
+        e.shl_ri(R11, 8);
+        e.alu_rr(false, ALU_OR, R10, R11);
+        e.alu_ri(false, ALU_ADD, RBP, 2);
+    }
+
+    // ALU op on A. src is a register, [rdi] (REG_M) or imm.
+    void alu_op(int op8080, int src, std::uint8_t imm, bool is_imm)
+    {
+        static const int X86_OP[8] = {
+            ALU_ADD, ALU_ADC, ALU_SUB, ALU_SBB, ALU_AND, ALU_XOR, ALU_OR, ALU_CMP
+        };
+        int op = X86_OP[op8080];
+
+        if (op == ALU_ADC || op == ALU_SBB) { e.sahf(); }
+        if (op == ALU_AND) {
+            /* ANA sets aux carry to bit 3 of (A | src) */
+            if (is_imm) { e.mov_ri(RSI, imm); }
+            else if (src == REG_M) { e.movzx8_rm(RSI, AT_RDI); }
+            else { e.movzx8_rr(RSI, REG8[src]); }
+            e.alu_rr(false, ALU_OR, RSI, RAX);
+        }
+
+        if (is_imm) { e.alu8_ri(op, AL, imm); }
+        else if (src == REG_M) { e.alu8_rm(op, AL, AT_RDI); }
+        else { e.alu8_rr(op, AL, REG8[src]); }
+        e.lahf();
+
+        switch (op)
+        {
+        case ALU_SUB: case ALU_SBB: case ALU_CMP:
+            e.alu8_ri(ALU_XOR, AH, AUX_CARRY);
+            break;
+        case ALU_XOR: case ALU_OR:
+            e.alu8_ri(ALU_AND, AH, (std::uint8_t)~AUX_CARRY);
+            break;
+        case ALU_AND:
+            e.alu8_ri(ALU_AND, AH, (std::uint8_t)~AUX_CARRY);
+            e.alu_ri(false, ALU_AND, RSI, 0x08);
+            e.shl_ri(RSI, 9); /* to bit 4 of ah */
+            e.alu_rr(false, ALU_OR, RAX, RSI);
+            break;
+        }
+    }
+
+    void inr_dcr(int r, bool dec) {
+        e.sahf();
+        if (dec) { e.b(0xfe); e.modrm_rr(1, r); }
+        else { e.b(0xfe); e.modrm_rr(0, r); }
+        e.lahf();
+        if (dec) { e.alu8_ri(ALU_XOR, AH, AUX_CARRY); }
+    }
+
+    bool can_translate(const i8080_op& op) const;
+    void emit_op(const i8080_op& op);
+    void* run(const i8080_block* block);
+};
+
+bool translator::can_translate(const i8080_op& op) const
+{
+    switch (op.opcode)
+    {
+    case i8080_DAA:
+    case i8080_IN: case i8080_OUT:
+    case i8080_HLT:
+    case i8080_EI: case i8080_DI:
+        return false;
+
+    case i8080_LDA:
+        return static_read(op.imm) != nullptr;
+    case i8080_LHLD:
+        return static_read(op.imm) && static_read(op.imm + 1);
+
+    default:
+        return true;
+    }
+}
+
+void translator::emit_op(const i8080_op& op)
+{
+    const int k = cur_op;
+    const i8080_word_t opcode = op.opcode;
+    const i8080_addr_t next = addrs[k + 1];
+    const int dst = (opcode >> 3) & 7;
+    const int src = opcode & 7;
+    const int rp = (opcode >> 4) & 3;
+
+    // Register moves and ALU ops
+    if (opcode >= 0x40 && opcode < 0x80) {
+        if (dst == REG_M) {
+            addr_rp(RBX); resolve(true, RDI);
+            e.mov8_mr(AT_RDI, REG8[src]);
+        }
+        else if (src == REG_M) {
+            addr_rp(RBX); resolve(false, RDI);
+            e.mov8_rm(REG8[dst], AT_RDI);
+        }
+        else if (src != dst) {
+            e.mov8_rr(REG8[dst], REG8[src]);
+        }
+        return;
+    }
+    if (opcode >= 0x80 && opcode < 0xc0) {
+        if (src == REG_M) { addr_rp(RBX); resolve(false, RDI); }
+        alu_op(dst, src, 0, false);
+        return;
+    }
+
+    switch (opcode)
+    {
+    case i8080_NOP: case i8080_UD_NOP2: case i8080_UD_NOP3:
+    case i8080_UD_NOP4: case i8080_UD_NOP5: case i8080_UD_NOP6: case i8080_UD_NOP7:
+        break;
+
+    case i8080_LXI_B: case i8080_LXI_D: case i8080_LXI_H: case i8080_LXI_SP:
+        e.mov_ri(REG16[rp], op.imm);
+        break;
+
+    case i8080_INX_B: case i8080_INX_D: case i8080_INX_H: case i8080_INX_SP:
+        e.inc16(REG16[rp], false);
+        break;
+    case i8080_DCX_B: case i8080_DCX_D: case i8080_DCX_H: case i8080_DCX_SP:
+        e.inc16(REG16[rp], true);
+        break;
+
+    case i8080_DAD_B: case i8080_DAD_D: case i8080_DAD_H: case i8080_DAD_SP:
+        e.alu8_ri(ALU_AND, AH, (std::uint8_t)~CARRY);
+        e.add16_rr(RBX, REG16[rp]);
+        e.alu8_ri(ALU_ADC, AH, 0);
+        break;
+
+    case i8080_INR_B: case i8080_INR_C: case i8080_INR_D: case i8080_INR_E:
+    case i8080_INR_H: case i8080_INR_L: case i8080_INR_A:
+        inr_dcr(REG8[dst], false);
+        break;
+    case i8080_DCR_B: case i8080_DCR_C: case i8080_DCR_D: case i8080_DCR_E:
+    case i8080_DCR_H: case i8080_DCR_L: case i8080_DCR_A:
+        inr_dcr(REG8[dst], true);
+        break;
+    case i8080_INR_M: case i8080_DCR_M:
+        addr_rp(RBX); resolve(false, RDI);
+        addr_rp(RBX); resolve(true, RSI);
+        e.movzx8_rm(R10, AT_RDI);
+        e.sahf();
+        e.inc8_r(R10, opcode == i8080_DCR_M);
+        e.lahf();
+        if (opcode == i8080_DCR_M) { e.alu8_ri(ALU_XOR, AH, AUX_CARRY); }
+        e.mov8_mr(AT_RSI, R10);
+        break;
+
+    case i8080_MVI_B: case i8080_MVI_C: case i8080_MVI_D: case i8080_MVI_E:
+    case i8080_MVI_H: case i8080_MVI_L: case i8080_MVI_A:
+        e.mov8_ri(REG8[dst], (std::uint8_t)op.imm);
+        break;
+    case i8080_MVI_M:
+        addr_rp(RBX); resolve(true, RDI);
+        e.mov8_mi(AT_RDI, (std::uint8_t)op.imm);
+        break;
+
+    case i8080_ADI: case i8080_ACI: case i8080_SUI: case i8080_SBI:
+    case i8080_ANI: case i8080_XRI: case i8080_ORI: case i8080_CPI:
+        alu_op(dst, 0, (std::uint8_t)op.imm, true);
+        break;
+
+    case i8080_STAX_B: case i8080_STAX_D:
+        addr_rp(REG16[rp]); resolve(true, RDI);
+        e.mov8_mr(AT_RDI, AL);
+        break;
+    case i8080_LDAX_B: case i8080_LDAX_D:
+        addr_rp(REG16[rp]); resolve(false, RDI);
+        e.mov8_rm(AL, AT_RDI);
+        break;
+    case i8080_STA:
+        addr_imm(op.imm); resolve(true, RDI);
+        e.mov8_mr(AT_RDI, AL);
+        break;
+    case i8080_LDA:
+        e.mov_ri64(RDI, (std::uint64_t)static_read(op.imm));
+        e.mov8_rm(AL, AT_RDI);
+        break;
+    case i8080_SHLD:
+        addr_imm(op.imm); resolve(true, RDI);
+        addr_imm((i8080_addr_t)(op.imm + 1)); resolve(true, RSI);
+        e.mov8_mr(AT_RDI, BL);
+        e.mov8_mr(AT_RSI, BH);
+        break;
+    case i8080_LHLD:
+        e.mov_ri64(RDI, (std::uint64_t)static_read(op.imm));
+        e.mov_ri64(RSI, (std::uint64_t)static_read((i8080_addr_t)(op.imm + 1)));
+        e.mov8_rm(BL, AT_RDI);
+        e.mov8_rm(BH, AT_RSI);
+        break;
+
+    case i8080_RLC: e.sahf(); e.shift8_1(0, AL); e.lahf(); break;
+    case i8080_RRC: e.sahf(); e.shift8_1(1, AL); e.lahf(); break;
+    case i8080_RAL: e.sahf(); e.shift8_1(2, AL); e.lahf(); break;
+    case i8080_RAR: e.sahf(); e.shift8_1(3, AL); e.lahf(); break;
+
+    case i8080_CMA: e.not8(AL); break;
+    case i8080_STC: e.alu8_ri(ALU_OR, AH, CARRY); break;
+    case i8080_CMC: e.alu8_ri(ALU_XOR, AH, CARRY); break;
+
+    case i8080_PUSH_B: case i8080_PUSH_D: case i8080_PUSH_H: case i8080_PUSH_PSW:
+    {
+        static const int HI[4] = { CH, DH, BH, AL };
+        static const int LO[4] = { CL, DL, BL, AH };
+        addr_sp(-1); resolve(true, RDI);
+        addr_sp(-2); resolve(true, RSI);
+        e.mov8_mr(AT_RDI, HI[rp]);
+        e.mov8_mr(AT_RSI, LO[rp]);
+        e.alu_ri(false, ALU_SUB, RBP, 2);
+        break;
+    }
+    case i8080_POP_B: case i8080_POP_D: case i8080_POP_H: case i8080_POP_PSW:
+    {
+        static const int HI[4] = { CH, DH, BH, AL };
+        static const int LO[4] = { CL, DL, BL, AH };
+        addr_sp(0); resolve(false, RSI);
+        addr_sp(1); resolve(false, RDI);
+        e.mov8_rm(LO[rp], AT_RSI);
+        e.mov8_rm(HI[rp], AT_RDI);
+        e.alu_ri(false, ALU_ADD, RBP, 2);
+        if (opcode == i8080_POP_PSW) {
+            /* only S, Z, AC, P, CY are real, bit 1 is always set */
+            e.alu8_ri(ALU_AND, AH, 0xd5);
+            e.alu8_ri(ALU_OR, AH, 0x02);
+        }
+        break;
+    }
+
+    case i8080_XTHL:
+        addr_sp(0); resolve(false, R10);
+        addr_sp(1); resolve(false, R11);
+        addr_sp(0); resolve(true, RDI);
+        addr_sp(1); resolve(true, RSI);
+        e.movzx8_rm(R10, mem_op{ R10, 0 });
+        e.movzx8_rm(R11, mem_op{ R11, 0 });
+        e.mov8_mr(AT_RDI, BL);
+        e.mov8_mr(AT_RSI, BH);
+        e.shl_ri(R11, 8);
+        e.alu_rr(false, ALU_OR, R10, R11);
+        e.b(0x66); e.mov_rr(false, RBX, R10); // mov bx, r10w
+        break;
+
+    case i8080_XCHG: e.xchg16_rr(RDX, RBX); break;
+    case i8080_SPHL: e.mov_rr(false, RBP, RBX); break;
+
+    // Block enders
+
+    case i8080_JMP: case i8080_UD_JMP:
+        add_cycles(pre[k + 1]);
+        chain(op.imm);
+        break;
+
+    case i8080_JNZ: case i8080_JZ: case i8080_JNC: case i8080_JC:
+    case i8080_JPO: case i8080_JPE: case i8080_JP: case i8080_JM:
+    {
+        add_cycles(pre[k + 1]);
+        e.test8_ri(AH, COND_MASK[dst]);
+        std::uint8_t* not_taken = e.jcc((dst & 1) ? CC_Z : CC_NZ);
+        chain(op.imm);
+        e.here(not_taken);
+        chain(next);
+        break;
+    }
+
+    case i8080_CALL: case i8080_UD_CALL1: case i8080_UD_CALL2: case i8080_UD_CALL3:
+        push_imm(next);
+        add_cycles(pre[k + 1]);
+        chain(op.imm);
+        break;
+
+    case i8080_CNZ: case i8080_CZ: case i8080_CNC: case i8080_CC:
+    case i8080_CPO: case i8080_CPE: case i8080_CP: case i8080_CM:
+    {
+        e.test8_ri(AH, COND_MASK[dst]);
+        std::uint8_t* not_taken = e.jcc((dst & 1) ? CC_Z : CC_NZ);
+        push_imm(next);
+        add_cycles(pre[k + 1] + 6);
+        chain(op.imm);
+        e.here(not_taken);
+        add_cycles(pre[k + 1]);
+        chain(next);
+        break;
+    }
+
+    case i8080_RST_0: case i8080_RST_1: case i8080_RST_2: case i8080_RST_3:
+    case i8080_RST_4: case i8080_RST_5: case i8080_RST_6: case i8080_RST_7:
+        push_imm(next);
+        add_cycles(pre[k + 1]);
+        chain((i8080_addr_t)(opcode & 0x38));
+        break;
+
+    case i8080_RET: case i8080_UD_RET:
+        pop_r10();
+        add_cycles(pre[k + 1]);
+        chain_indirect();
+        break;
+
+    case i8080_RNZ: case i8080_RZ: case i8080_RNC: case i8080_RC:
+    case i8080_RPO: case i8080_RPE: case i8080_RP: case i8080_RM:
+    {
+        e.test8_ri(AH, COND_MASK[dst]);
+        std::uint8_t* not_taken = e.jcc((dst & 1) ? CC_Z : CC_NZ);
+        pop_r10();
+        add_cycles(pre[k + 1] + 6);
+        chain_indirect();
+        e.here(not_taken);
+        add_cycles(pre[k + 1]);
+        chain(next);
+        break;
+    }
+
+    case i8080_PCHL:
+        e.movzx16_rr(R10, RBX);
+        add_cycles(pre[k + 1]);
+        chain_indirect();
+        break;
+
+    default:
+        assert(false);
+        break;
+    }
+}
+
+static bool is_block_end(i8080_word_t opcode)
+{
+    switch (opcode)
+    {
+    case i8080_JMP: case i8080_UD_JMP: case i8080_PCHL:
+    case i8080_CALL: case i8080_UD_CALL1:
+    case i8080_UD_CALL2: case i8080_UD_CALL3:
+    case i8080_RET: case i8080_UD_RET:
+        return true;
+    default:
+        switch (opcode & 0xc7) {
+        case 0xc0: case 0xc2: case 0xc4: case 0xc7: return true;
+        default: return false;
+        }
+    }
+}
+
+/* Returns null if it ran out of space. */
+void* translator::run(const i8080_block* block)
+{
+    entry = e.p;
+
+    int num_ops = 0;
+    if (block) {
+        addrs[0] = block->pc;
+        pre[0] = 0;
+        while (num_ops < block->num_ops && can_translate(block->ops[num_ops])) {
+            const i8080_op& op = block->ops[num_ops];
+            addrs[num_ops + 1] = (i8080_addr_t)(addrs[num_ops] + op.len);
+            pre[num_ops + 1] = pre[num_ops] + cycles[op.opcode];
+            num_ops++;
+        }
+    }
+
+    if (num_ops == 0) {
+        e.mov16_mi(STATE(pc), pc);
+        e.mov_ri(R8, I8080_JIT_EXIT_INTERP);
+        e.jmp(exit);
+        return entry;
+    }
+
+    // Only run if the budget lasts until the last op starts,
+    // otherwise the interpreter has to stop partway.
+    std::uint8_t* over_budget;
+    e.mov_rm(true, R11, STATE(cycles));
+    e.alu_ri(true, ALU_ADD, R11, (std::int32_t)pre[num_ops - 1]);
+    e.cmp_rr(true, R11, R13);
+    over_budget = e.jcc(CC_AE);
+
+    for (cur_op = 0; cur_op < num_ops; ++cur_op) {
+        if (e.p > end) { return nullptr; }
+        emit_op(block->ops[cur_op]);
+    }
+    if (!is_block_end(block->ops[num_ops - 1].opcode)) {
+        add_cycles(pre[num_ops]);
+        chain(addrs[num_ops]);
+    }
+
+    // Out of line exits
+    e.here(over_budget);
+    e.mov16_mi(STATE(pc), pc);
+    e.mov_ri(R8, I8080_JIT_EXIT_INTERP);
+    e.jmp(exit);
+
+    for (int i = 0; i < num_bails; ++i) {
+        if (e.p > end) { return nullptr; }
+        const fixup& f = bails[i];
+        e.here(f.site);
+        add_cycles(pre[f.op]);
+        e.mov16_mi(STATE(pc), addrs[f.op]);
+        e.mov_ri(R8, I8080_JIT_EXIT_INTERP);
+        e.jmp(exit);
+    }
+    for (int i = 0; i < num_links; ++i) {
+        const fixup& f = links[i];
+        e.here(f.site);
+        e.mov16_mi(STATE(pc), f.target);
+        e.lea_rip(R9, f.site);
+        e.mov_mr(true, JIT(link_site), R9);
+        e.mov_ri(R8, I8080_JIT_EXIT_LINK);
+        e.jmp(exit);
+    }
+    if (e.p > end) { return nullptr; }
+
+    for (i8080_addr_t a = addrs[0]; a != addrs[num_ops]; ++a) {
+        jit->code_map[a >> 3] |= (1u << (a & 7));
+    }
+    return entry;
+}
+
+bool has_lahf()
+{
+    unsigned regs[4] = {};
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 0x80000001);
+    for (int i = 0; i < 4; ++i) { regs[i] = (unsigned)r[i]; }
+#else
+    if (!__get_cpuid(0x80000001, &regs[0], &regs[1], &regs[2], &regs[3])) {
+        return false;
+    }
+#endif
+    return regs[2] & 1; /* ecx bit 0: LAHF/SAHF in 64-bit mode */
+}
+
+} // namespace
+
+i8080_jit::~i8080_jit()
+{
+    if (m_buf) {
+#ifdef _WIN32
+        VirtualFree(m_buf, 0, MEM_RELEASE);
+#else
+        munmap(m_buf, I8080_JIT_CODE_SIZE);
+#endif
+    }
+}
+
+int i8080_jit::init()
+{
+    if (m_buf) {
+        return 0;
+    }
+    if (!has_lahf()) {
+        return -1;
+    }
+#ifdef _WIN32
+    void* buf = VirtualAlloc(nullptr, I8080_JIT_CODE_SIZE,
+        MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+    if (!buf) {
+        return -1;
+    }
+#else
+    void* buf = mmap(nullptr, I8080_JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        return -1;
+    }
+#endif
+    m_buf = (std::uint8_t*)buf;
+    emit_runtime();
+    flush();
+    flushes = 0;
+    return 0;
+}
+
+// Entry and exit code, shared by all blocks.
+void i8080_jit::emit_runtime()
+{
+    static const int SAVED[] = { RBX, RBP, RSI, RDI, R12, R13, R14, R15 };
+    emitter e = { m_buf };
+
+    // int enter(i8080_state* cpu, i8080_jit* jit, void* code, uint64_t until_cycle)
+    m_enter = (enter_fn)(void*)e.p;
+    for (int r : SAVED) { e.push(r); }
+    e.mov_rr(true, R15, ARG_REGS[0]);
+    e.mov_rr(true, R12, ARG_REGS[1]);
+    e.mov_rr(true, R11, ARG_REGS[2]);
+    e.mov_rr(true, R13, ARG_REGS[3]);
+    e.mov_rr(true, RDI, R15);
+    e.mov_rr(true, RSI, R12);
+    e.mov8_rm(AL, mem_op{ RDI, offsetof(i8080_state, a) });
+    e.mov8_rm(AH, mem_op{ RSI, offsetof(i8080_jit, psw) });
+    e.mov8_rm(CH, mem_op{ RDI, offsetof(i8080_state, b) });
+    e.mov8_rm(CL, mem_op{ RDI, offsetof(i8080_state, c) });
+    e.mov8_rm(DH, mem_op{ RDI, offsetof(i8080_state, d) });
+    e.mov8_rm(DL, mem_op{ RDI, offsetof(i8080_state, e) });
+    e.mov8_rm(BH, mem_op{ RDI, offsetof(i8080_state, h) });
+    e.mov8_rm(BL, mem_op{ RDI, offsetof(i8080_state, l) });
+    e.movzx16_rm(RBP, mem_op{ RDI, offsetof(i8080_state, sp) });
+    e.jmp_r(R11);
+
+    // Exit code in r8d.
+    m_exit = e.p;
+    e.mov_rr(true, RDI, R15);
+    e.mov_rr(true, RSI, R12);
+    e.mov8_mr(mem_op{ RDI, offsetof(i8080_state, a) }, AL);
+    e.mov8_mr(mem_op{ RSI, offsetof(i8080_jit, psw) }, AH);
+    e.mov8_mr(mem_op{ RDI, offsetof(i8080_state, b) }, CH);
+    e.mov8_mr(mem_op{ RDI, offsetof(i8080_state, c) }, CL);
+    e.mov8_mr(mem_op{ RDI, offsetof(i8080_state, d) }, DH);
+    e.mov8_mr(mem_op{ RDI, offsetof(i8080_state, e) }, DL);
+    e.mov8_mr(mem_op{ RDI, offsetof(i8080_state, h) }, BH);
+    e.mov8_mr(mem_op{ RDI, offsetof(i8080_state, l) }, BL);
+    e.mov16_mr(mem_op{ RDI, offsetof(i8080_state, sp) }, RBP);
+    e.mov_rr(false, RAX, R8);
+    for (int i = 7; i >= 0; --i) { e.pop(SAVED[i]); }
+    e.ret();
+
+    // pc is set, but has no translation.
+    m_lookup_exit = e.p;
+    e.mov_ri(R8, I8080_JIT_EXIT_LOOKUP);
+    e.jmp(m_exit);
+
+    m_base = (std::size_t)(e.p - m_buf);
+}
+
+void* i8080_jit::compile(const i8080_state* cpu, const i8080_block* block, const std::uint8_t* cycles)
+{
+    if (block && (block->num_ops == 0 || block->pc != cpu->pc)) {
+        block = nullptr;
+    }
+    for (int tries = 0; tries < 2; ++tries)
+    {
+        translator t;
+        t.e.p = m_buf + m_used;
+        t.end = m_buf + I8080_JIT_CODE_SIZE - 1024; /* room for one op or the exits */
+        t.jit = this;
+        t.cpu = cpu;
+        t.cycles = cycles;
+        t.exit = m_exit;
+        t.lookup_exit = m_lookup_exit;
+        t.pc = cpu->pc;
+
+        void* entry = t.run(block);
+        if (entry) {
+            m_used = (std::size_t)(t.e.p - m_buf);
+            code[cpu->pc] = entry;
+            translations++;
+            return entry;
+        }
+        flush();
+    }
+    assert(false); /* a block can't be bigger than the whole buffer */
+    return nullptr;
+}
+
+#undef STATE
+#undef JIT
+#undef REG_M
+#undef AUX_CARRY
+#undef CARRY
+
+#endif /* I8080_JIT_X64 */
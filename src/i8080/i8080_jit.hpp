@@ -0,0 +1,119 @@
+//
+// x86-64 recompiler for the i8080 core.
+//
+// Translates blocks into host code, with A/flags, BC, DE, HL and SP
+// kept in host registers. Blocks jump straight to each other once
+// both are translated, and returns/PCHL look up their target in a
+// table without leaving host code. Anything it does not translate
+// (IO, HLT, EI/DI, DAA, accesses to unmapped pages and writes to
+// pages holding code) goes back to the interpreter.
+//
+// Cycles are counted like the interpreter does: a block only runs
+// if the budget lasts until its last instruction starts, otherwise
+// the interpreter runs it. So run() stops at exactly the same
+// instruction with or without the JIT.
+//
+// Usage (needs a block cache):
+//
+//     i8080_jit* jit = new i8080_jit;
+//     if (jit->init() == 0) {
+//         cpu.set_block_cache(cache);
+//         cpu.set_jit(jit);
+//     }
+//
+// On other hosts init() fails and the interpreter is used.
+//
+
+#ifndef I8080_JIT_HPP
+#define I8080_JIT_HPP
+
+#include <cstddef>
+#include "i8080.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define I8080_JIT_X64
+#endif
+
+#define I8080_JIT_CODE_SIZE (4u << 20)
+
+// Why translated code returned.
+enum i8080_jit_exit : int
+{
+    I8080_JIT_EXIT_INTERP,  // interpreter must run the block at pc
+    I8080_JIT_EXIT_LOOKUP,  // jumped to pc, which is not translated yet
+    I8080_JIT_EXIT_LINK     // same, and link_site can be patched to it
+};
+
+struct i8080_jit
+{
+    // Host code for each guest address, null if not translated.
+    void* code[0x10000];
+
+    // Page table for writes from host code. Same as the CPU's, except
+    // pages with code are null, so writes there go to the interpreter.
+    i8080_word_t* wpages[I8080_NUM_PAGES];
+    std::uint64_t wpages_code; // code_pages the table was built for
+    bool wpages_dirty;
+
+    // Bit n set if byte n is part of a translated block.
+    std::uint8_t code_map[0x10000 / 8];
+
+    // Flags (as in PUSH PSW) while host code runs.
+    i8080_word_t psw;
+    // End of the jump to patch after I8080_JIT_EXIT_LINK.
+    std::uint8_t* link_site;
+
+    std::uint64_t translations;
+    std::uint64_t flushes;
+    std::uint64_t exits; // returns to the interpreter
+
+    i8080_jit();
+    ~i8080_jit();
+
+    i8080_jit(const i8080_jit&) = delete;
+    i8080_jit& operator=(const i8080_jit&) = delete;
+
+    // Allocate the code buffer. Returns 0 on success, -1 if the
+    // host is not x86-64 or has no executable memory to give.
+    int init();
+
+    // Drop all translations.
+    void flush();
+
+    // Translate block, decoded at cpu->pc. Blocks from outside the
+    // page table (num_ops == 0 or not at pc) become a stub that
+    // returns I8080_JIT_EXIT_INTERP. cycles is the CYCLES table.
+    // Never fails, flushes if the buffer is full.
+    void* compile(const i8080_state* cpu, const i8080_block* block, const std::uint8_t* cycles);
+
+    // Make the jump ending at site go to code.
+    void link(std::uint8_t* site, void* code);
+
+    // Rebuild wpages if the CPU's page table or code pages changed.
+    void update_wpages(const i8080_state* cpu);
+
+    // Run host code until it returns, see i8080_jit_exit.
+    i8080_jit_exit enter(i8080_state* cpu, void* code, std::uint64_t until_cycle);
+
+    bool is_code(i8080_addr_t addr) const {
+        return code_map[addr >> 3] & (1u << (addr & 7));
+    }
+
+    // Bumped by flush(), so stale link sites can be ignored.
+    std::uint64_t generation;
+
+    // Internal. Public so host code can address the fields above
+    // with offsetof, which needs a standard-layout type.
+    using enter_fn = int(*)(i8080_state*, i8080_jit*, void*, std::uint64_t);
+
+    std::uint8_t* m_buf;
+    std::size_t m_used;
+    std::size_t m_base;         // end of the entry/exit code
+    enter_fn m_enter;
+    std::uint8_t* m_exit;       // saves registers and returns
+    std::uint8_t* m_lookup_exit;
+
+    void emit_runtime();
+};
+
+#endif /* I8080_JIT_HPP */
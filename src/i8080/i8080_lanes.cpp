@@ -0,0 +1,101 @@
+
+#include "i8080_lanes.hpp"
+
+i8080_lanes_state::i8080_lanes_state() :
+    r(), sp(), s(), z(), cy(), ac(), p()
+{
+    for (unsigned page = 0; page < I8080_NUM_PAGES; ++page) {
+        lane_rpages[page] = -1;
+        lane_wpages[page] = -1;
+    }
+    reset();
+}
+
+void i8080_lanes_state::map_shared(std::uint32_t addr, std::uint32_t size, const i8080_word_t* mem)
+{
+    for (std::uint32_t off = 0; off < size; off += I8080_PAGE_SIZE) {
+        shared_pages[(addr + off) >> I8080_PAGE_SHIFT] = mem ? mem + off : nullptr;
+    }
+}
+
+void i8080_lanes_state::map_lanes(std::uint32_t addr, std::uint32_t size, std::uint32_t offset, unsigned flags)
+{
+    for (std::uint32_t off = 0; off < size; off += I8080_PAGE_SIZE) 
+    {
+        std::uint32_t page = (addr + off) >> I8080_PAGE_SHIFT;
+        if (flags & I8080_MAP_READ) { lane_rpages[page] = std::int32_t(offset + off); }
+        if (flags & I8080_MAP_WRITE) { lane_wpages[page] = std::int32_t(offset + off); }
+    }
+}
+
+void i8080_lanes_state::reset()
+{
+    for (int i = 0; i < I8080_MAX_LANES; ++i) {
+        pc[i] = 0;
+        int_en[i] = 0;
+        int_rq[i] = 0;
+        halt[i] = 0;
+        cycles[i] = 0;
+        exits[i] = I8080_EXIT_BUDGET;
+    }
+}
+
+void i8080_lanes_state::interrupt(int lane) { int_rq[lane] = 1; }
+
+void i8080_lanes_state::get_lane(int lane, i8080_state* cpu) const
+{
+    cpu->b = r[0][lane]; cpu->c = r[1][lane];
+    cpu->d = r[2][lane]; cpu->e = r[3][lane];
+    cpu->h = r[4][lane]; cpu->l = r[5][lane];
+    cpu->a = r[7][lane];
+    cpu->sp = sp[lane];
+    cpu->pc = pc[lane];
+    cpu->s = s[lane];
+    cpu->z = z[lane];
+    cpu->cy = cy[lane];
+    cpu->ac = ac[lane];
+    cpu->p = p[lane];
+    cpu->halt = halt[lane];
+    cpu->int_en = int_en[lane];
+    cpu->int_rq = int_rq[lane];
+    cpu->cycles = cycles[lane];
+}
+
+void i8080_lanes_state::set_lane(int lane, const i8080_state* cpu)
+{
+    r[0][lane] = cpu->b; r[1][lane] = cpu->c;
+    r[2][lane] = cpu->d; r[3][lane] = cpu->e;
+    r[4][lane] = cpu->h; r[5][lane] = cpu->l;
+    r[7][lane] = cpu->a;
+    sp[lane] = cpu->sp;
+    pc[lane] = cpu->pc;
+    s[lane] = cpu->s;
+    z[lane] = cpu->z;
+    cy[lane] = cpu->cy;
+    ac[lane] = cpu->ac;
+    p[lane] = cpu->p;
+    halt[lane] = cpu->halt;
+    int_en[lane] = cpu->int_en;
+    int_rq[lane] = cpu->int_rq;
+    cycles[lane] = cpu->cycles;
+}
+
+bool i8080_lanes_state::map_lane(int lane, i8080_state* cpu) const
+{
+    bool stale = false;
+    for (unsigned page = 0; page < I8080_NUM_PAGES; ++page)
+    {
+        // only ever read, see lane_read()
+        i8080_word_t* rpage = const_cast<i8080_word_t*>(shared_pages[page]);
+        if (!rpage && lane_rpages[page] >= 0) {
+            rpage = lane_mem[lane] + lane_rpages[page];
+        }
+        // Lane memory may have changed since, even the same lane's.
+        if ((cpu->code_pages >> page) & 1) {
+            stale |= rpage != cpu->rpages[page] || !shared_pages[page];
+        }
+        cpu->rpages[page] = rpage;
+        cpu->wpages[page] = lane_wpages[page] >= 0 ? lane_mem[lane] + lane_wpages[page] : nullptr;
+    }
+    return stale;
+}
@@ -0,0 +1,166 @@
+//
+// Many i8080s running the same code in lockstep.
+//
+// For running thousands of machines with the same ROM (eg. searching
+// over inputs), each with its own RAM and devices. Registers are kept
+// as structure-of-arrays, one array per register with an entry per
+// lane, so one instruction can be run for all lanes as a loop that
+// the compiler turns into SIMD code (at -O3).
+//
+// run() repeatedly picks the lowest pc of any lane, and runs every
+// lane at that pc until they split up or catch up with another lane.
+// While all lanes agree (eg. the same game with the same inputs, or
+// the same idle loop) that is every lane, in lane order, and it
+// vectorizes. Once they diverge, each group runs on its own through
+// a list of its lanes. A lane on its own, or a group with less than
+// half of them (see I8080_LANES_MIN_SHARE), runs one lane at a time
+// on a scalar basic_i8080 with a block cache instead, to the end of
+// the run, as running them together no longer pays. Lanes are
+// independent, so this gives every lane exactly what
+// basic_i8080::run() would.
+//
+// Code is only shared, and so only run in lockstep, from pages mapped
+// with map_shared(), which must hold the same (read-only) memory for
+// every lane. There is no recompiler or breakpoints.
+//
+// Example usage:
+//
+//     basic_i8080_lanes<my_bus> cpu;
+//     cpu.num_lanes = 32;
+//     cpu.map_shared(0x0000, 0x2000, my_rom);
+//     for (int i = 0; i < 32; ++i) {
+//         cpu.lane_mem[i] = &my_ram[i * 0x2000];
+//     }
+//     cpu.map_lanes(0x2000, 0x2000, 0, I8080_MAP_RW);
+//     cpu.reset();
+//     cpu.run(num_clk_cycles);
+//
+
+#ifndef I8080_LANES_HPP
+#define I8080_LANES_HPP
+
+#include <memory>
+
+#include "i8080.hpp"
+
+#define I8080_MAX_LANES 64
+
+// A group with fewer than 1 / I8080_LANES_MIN_SHARE of the lanes
+// (or just one) runs on the scalar core, see run().
+#define I8080_LANES_MIN_SHARE 2
+
+// Registers and memory map of every lane, and everything
+// else that does not depend on the bus.
+struct i8080_lanes_state
+{
+    int num_lanes = 1;
+
+    // Working registers, B C D E H L - A as numbered in opcodes
+    // (row 6 is unused, M is memory). r[reg][lane].
+    i8080_word_t r[8][I8080_MAX_LANES];
+
+    i8080_addr_t sp[I8080_MAX_LANES];
+    i8080_addr_t pc[I8080_MAX_LANES];
+
+    // Flags, 0 or 1
+    i8080_word_t s[I8080_MAX_LANES];
+    i8080_word_t z[I8080_MAX_LANES];
+    i8080_word_t cy[I8080_MAX_LANES];
+    i8080_word_t ac[I8080_MAX_LANES];
+    i8080_word_t p[I8080_MAX_LANES];
+
+    i8080_word_t halt[I8080_MAX_LANES];
+    i8080_word_t int_en[I8080_MAX_LANES];
+    i8080_word_t int_rq[I8080_MAX_LANES];
+
+    std::uint64_t cycles[I8080_MAX_LANES];
+
+    // Why each lane stopped in the last run().
+    i8080_exit exits[I8080_MAX_LANES];
+
+    // User data, for use by the bus.
+    void* udata;
+
+    // Memory of each lane, see map_lanes().
+    i8080_word_t* lane_mem[I8080_MAX_LANES] = {};
+
+    // Page tables. Shared pages point to memory all lanes read,
+    // lane pages are offsets into lane_mem (-1 if not mapped). Pages
+    // that are neither go through the bus's mem_read/mem_write.
+    const i8080_word_t* shared_pages[I8080_NUM_PAGES] = {};
+    std::int32_t lane_rpages[I8080_NUM_PAGES];
+    std::int32_t lane_wpages[I8080_NUM_PAGES];
+
+    // Instructions run, once for a group of lanes.
+    std::uint64_t steps = 0;
+    std::uint64_t vector_steps = 0; // by every lane at once
+    std::uint64_t lane_steps = 0;   // by each lane, in all
+    // Cycles run by lanes on their own, on the scalar core.
+    std::uint64_t scalar_cycles = 0;
+
+    i8080_lanes_state();
+
+    // Map [addr, addr + size) to mem for reads by every lane. addr
+    // and size must be multiples of I8080_PAGE_SIZE. mem must not
+    // change while running.
+    void map_shared(std::uint32_t addr, std::uint32_t size, const i8080_word_t* mem);
+
+    // Map [addr, addr + size) to each lane's lane_mem + offset, for
+    // reads and/or writes. Mapping the same offset at several
+    // addresses mirrors it.
+    void map_lanes(std::uint32_t addr, std::uint32_t size, std::uint32_t offset, unsigned flags);
+
+    // Reset every lane's chip. Eq. to low on RESET pin.
+    void reset();
+
+    // Send an interrupt request to lane, see i8080_state::interrupt().
+    // Only between calls to run(), which takes it first thing.
+    void interrupt(int lane);
+
+    // Copy a lane's registers and flags to/from a single CPU.
+    void get_lane(int lane, i8080_state* cpu) const;
+    void set_lane(int lane, const i8080_state* cpu);
+
+    // Point cpu's page tables at lane's memory, as the lane sees
+    // it. Returns true if code cpu's block cache holds may have
+    // come from other memory (see i8080_state::flush_blocks()).
+    bool map_lane(int lane, i8080_state* cpu) const;
+};
+
+// Lanes, specialized at compile time for a Bus. Bus is a type with
+// the same functions as for basic_i8080 (see i8080.hpp), but taking
+// (i8080_lanes_state* cpu, int lane) instead of (i8080_state* cpu).
+// mem_read/mem_write may see a lane's pc and cycles as they were at
+// its last jump, call or return (see run_group()), the others see
+// them up to date. While a lane runs on the scalar core, the bus
+// sees its registers as they were when it started.
+//
+// The member functions are defined in i8080_lanes_impl.hpp, include
+// it in the source file that defines the Bus and explicitly instantiate:
+//
+//     template struct basic_i8080_lanes<my_bus>;
+//
+template <class Bus>
+struct basic_i8080_lanes : i8080_lanes_state
+{
+    // Run every lane until its cycles >= until_cycle, it halts or
+    // its bus could not handle an IO/intr access (see exits).
+    void run(std::uint64_t until_cycle);
+
+private:
+    // Scalar core for lanes that run on their own (see run_lane()),
+    // with a bus that forwards to Bus for scalar_lane.
+    struct lane_bus;
+    basic_i8080<lane_bus> scalar;
+    std::unique_ptr<i8080_block_cache> scalar_blocks;
+    int scalar_lane = 0;
+
+    template <bool Count, class Lanes>
+    void exec(i8080_word_t opcode, i8080_addr_t imm, Lanes lanes);
+    template <class Lanes>
+    void run_group(Lanes lanes, int count, std::uint64_t until_cycle, std::uint32_t next_pc);
+    void interrupt_lane(int lane);
+    void run_lane(int lane, std::uint64_t until_cycle);
+};
+
+#endif /* I8080_LANES_HPP */
@@ -0,0 +1,698 @@
+//
+// i8080 lanes implementation, templated on the Bus.
+//
+// Include this in the source file that defines a lanes Bus's
+// functions, and explicitly instantiate basic_i8080_lanes<Bus> there.
+//
+// Each instruction is written once, for lane i, and run over a set of
+// lanes by a Lanes functor: every lane in order (vectorized), or a
+// list of them. Flags are kept eagerly, one byte per flag per lane,
+// which vectorizes better than the lazy flags of the scalar core.
+// Semantics and cycle counts are the same as i8080_handlers.inc.
+//
+
+#ifndef I8080_LANES_IMPL_HPP
+#define I8080_LANES_IMPL_HPP
+
+#include "i8080_lanes.hpp"
+#include "i8080_impl.hpp" // CYCLES, LENGTHS, parity()
+
+#include <type_traits>
+
+#define LANE_M 6  // register number of memory at HL
+#define LANE_SP 3 // register pair number of SP (PSW for push/pop)
+
+#define LANE_PAGE_MASK (I8080_PAGE_SIZE - 1)
+
+// exec() is too big for the compiler to inline the helpers it calls
+// for each lane, or the op itself into the loop over the lanes, on
+// its own. A loop that calls them isn't vectorized.
+#if defined(__GNUC__) || defined(__clang__)
+    #define LANE_INLINE inline __attribute__((always_inline))
+    #define LANE_FLATTEN __attribute__((flatten))
+#elif defined(_MSC_VER)
+    #define LANE_INLINE __forceinline
+    #define LANE_FLATTEN
+#else
+    #define LANE_INLINE inline
+    #define LANE_FLATTEN
+#endif
+
+// Every lane, in order.
+struct i8080_all_lanes
+{
+    int n;
+    int first() const { return 0; }
+    template <class F> LANE_FLATTEN void operator()(F f) const {
+        for (int i = 0; i < n; ++i) { f(i); }
+    }
+};
+
+// Some lanes, by number.
+struct i8080_lane_list
+{
+    const int* lanes;
+    int n;
+    int first() const { return lanes[0]; }
+    template <class F> LANE_FLATTEN void operator()(F f) const {
+        for (int k = 0; k < n; ++k) { f(lanes[k]); }
+    }
+};
+
+template <class Bus>
+static LANE_INLINE i8080_word_t lane_read(i8080_lanes_state* cpu, int i, i8080_addr_t addr) {
+    unsigned page = addr >> I8080_PAGE_SHIFT;
+    if (cpu->shared_pages[page]) {
+        return cpu->shared_pages[page][addr & LANE_PAGE_MASK];
+    }
+    if (cpu->lane_rpages[page] >= 0) {
+        return cpu->lane_mem[i][cpu->lane_rpages[page] + (addr & LANE_PAGE_MASK)];
+    }
+    return Bus::mem_read(cpu, i, addr);
+}
+
+template <class Bus>
+static LANE_INLINE void lane_write(i8080_lanes_state* cpu, int i, i8080_addr_t addr, i8080_word_t word) {
+    unsigned page = addr >> I8080_PAGE_SHIFT;
+    if (cpu->lane_wpages[page] >= 0) {
+        cpu->lane_mem[i][cpu->lane_wpages[page] + (addr & LANE_PAGE_MASK)] = word;
+    } else {
+        Bus::mem_write(cpu, i, addr, word);
+    }
+}
+
+static LANE_INLINE i8080_dword_t lane_pair(const i8080_lanes_state* cpu, int hi, int lo, int i) {
+    return i8080_dword_t(cpu->r[hi][i] << 8 | cpu->r[lo][i]);
+}
+
+#define lane_hl(cpu, i) lane_pair(cpu, 4, 5, i)
+
+// Register R (B C D E H L M A) of lane i.
+template <class Bus, int R>
+static LANE_INLINE i8080_word_t lane_get_reg(i8080_lanes_state* cpu, int i) {
+    if constexpr (R == LANE_M) {
+        return lane_read<Bus>(cpu, i, lane_hl(cpu, i));
+    } else {
+        return cpu->r[R][i];
+    }
+}
+
+template <class Bus, int R>
+static LANE_INLINE void lane_set_reg(i8080_lanes_state* cpu, int i, i8080_word_t word) {
+    if constexpr (R == LANE_M) {
+        lane_write<Bus>(cpu, i, lane_hl(cpu, i), word);
+    } else {
+        cpu->r[R][i] = word;
+    }
+}
+
+// Register pair RP (BC DE HL SP) of lane i.
+template <int RP>
+static LANE_INLINE i8080_dword_t lane_get_pair(const i8080_lanes_state* cpu, int i) {
+    if constexpr (RP == LANE_SP) {
+        return cpu->sp[i];
+    } else {
+        return lane_pair(cpu, RP * 2, RP * 2 + 1, i);
+    }
+}
+
+template <int RP>
+static LANE_INLINE void lane_set_pair(i8080_lanes_state* cpu, int i, i8080_dword_t dword) {
+    if constexpr (RP == LANE_SP) {
+        cpu->sp[i] = dword;
+    } else {
+        cpu->r[RP * 2][i] = i8080_word_t(dword >> 8);
+        cpu->r[RP * 2 + 1][i] = i8080_word_t(dword);
+    }
+}
+
+static LANE_INLINE void lane_zsp(i8080_lanes_state* cpu, int i, i8080_word_t word) {
+    cpu->z[i] = (word == 0);
+    cpu->s[i] = word >> 7;
+    cpu->p[i] = parity(word);
+}
+
+static LANE_INLINE i8080_word_t lane_get_flags(const i8080_lanes_state* cpu, int i) {
+    /* Bit 1 is always 1, see opcode table */
+    return i8080_word_t(0x02 | cpu->cy[i] | cpu->p[i] << 2 |
+        cpu->ac[i] << 4 | cpu->z[i] << 6 | cpu->s[i] << 7);
+}
+
+static LANE_INLINE void lane_set_flags(i8080_lanes_state* cpu, int i, i8080_word_t flags) {
+    cpu->cy[i] = flags & 1;
+    cpu->p[i] = (flags >> 2) & 1;
+    cpu->ac[i] = (flags >> 4) & 1;
+    cpu->z[i] = (flags >> 6) & 1;
+    cpu->s[i] = (flags >> 7) & 1;
+}
+
+// ALU op OP (ADD ADC SUB SBB ANA XRA ORA CMP) on A and word.
+template <int Op>
+static LANE_INLINE void lane_alu(i8080_lanes_state* cpu, int i, i8080_word_t word) {
+    i8080_word_t a = cpu->r[7][i];
+    if constexpr (Op <= 3 || Op == 7) {
+        /* SUB/SBB/CMP add the complement, and carry is the borrow */
+        constexpr bool sub = (Op >= 2);
+        i8080_word_t w = sub ? i8080_word_t(~word) : word;
+        i8080_word_t cy_in = (Op == 1 || Op == 3) ? cpu->cy[i] : 0;
+        i8080_dword_t res = i8080_dword_t(a + w + (sub ? !cy_in : cy_in));
+        cpu->ac[i] = ((a ^ w ^ res) >> 4) & 1;
+        cpu->cy[i] = ((res >> 8) & 1) ^ sub;
+        if constexpr (Op != 7) { cpu->r[7][i] = i8080_word_t(res); }
+        lane_zsp(cpu, i, i8080_word_t(res));
+    } else {
+        /* Tandy manual, pg 24, 63, 122 */
+        if constexpr (Op == 4) { cpu->ac[i] = ((a | word) >> 3) & 1; a &= word; }
+        if constexpr (Op == 5) { cpu->ac[i] = 0; a ^= word; }
+        if constexpr (Op == 6) { cpu->ac[i] = 0; a |= word; }
+        cpu->cy[i] = 0;
+        cpu->r[7][i] = a;
+        lane_zsp(cpu, i, a);
+    }
+}
+
+// Condition CC (NZ Z NC C PO PE P M) of lane i.
+template <int CC>
+static LANE_INLINE i8080_word_t lane_cond(const i8080_lanes_state* cpu, int i) {
+    constexpr int flag = CC >> 1;
+    i8080_word_t val = flag == 0 ? cpu->z[i] : flag == 1 ? cpu->cy[i] : flag == 2 ? cpu->p[i] : cpu->s[i];
+    return (CC & 1) ? val : !val;
+}
+
+template <class Bus>
+static LANE_INLINE void lane_push(i8080_lanes_state* cpu, int i, i8080_dword_t dword) {
+    cpu->sp[i] -= 1;
+    lane_write<Bus>(cpu, i, cpu->sp[i], i8080_word_t(dword >> 8));
+    cpu->sp[i] -= 1;
+    lane_write<Bus>(cpu, i, cpu->sp[i], i8080_word_t(dword));
+}
+
+template <class Bus>
+static LANE_INLINE i8080_dword_t lane_pop(i8080_lanes_state* cpu, int i) {
+    i8080_word_t lo = lane_read<Bus>(cpu, i, cpu->sp[i]);
+    cpu->sp[i] += 1;
+    i8080_word_t hi = lane_read<Bus>(cpu, i, cpu->sp[i]);
+    cpu->sp[i] += 1;
+    return i8080_dword_t(hi << 8 | lo);
+}
+
+template <class Bus>
+static LANE_INLINE void lane_call(i8080_lanes_state* cpu, int i, i8080_addr_t addr) {
+    lane_push<Bus>(cpu, i, cpu->pc[i]);
+    cpu->pc[i] = addr;
+}
+
+/* Decimal adjust accumulator (convert to 4-bit BCD). */
+static LANE_INLINE void lane_daa(i8080_lanes_state* cpu, int i) {
+    i8080_word_t a = cpu->r[7][i];
+    i8080_word_t lo = a & 0x0f;
+    i8080_word_t hi = a >> 4;
+    if (cpu->ac[i] || lo > 9) {
+        i8080_word_t res = i8080_word_t(a + 0x06);
+        cpu->ac[i] = ((a ^ 0x06 ^ res) >> 4) & 1;
+        a = res;
+    }
+    if (cpu->cy[i] || hi > 9 || (hi == 9 && lo > 9)) {
+        cpu->cy[i] = 1;
+        a += 0x60;
+    }
+    cpu->r[7][i] = a;
+    lane_zsp(cpu, i, a);
+}
+
+// Run lanes(f) with f(i) running stmt for lane i.
+#define EACH(...) lanes([&](int i) { __VA_ARGS__; })
+
+#define REG(r) lane_get_reg<Bus, r>(cpu, i)
+#define SET_REG(r, word) lane_set_reg<Bus, r>(cpu, i, word)
+
+#define MOV(d, s) case 0x40 | (d) << 3 | (s):                     \
+    if constexpr ((d) == LANE_M && (s) == LANE_M) {               \
+        EACH(cpu->halt[i] = 1); /* HLT */                         \
+    } else {                                                      \
+        EACH(SET_REG(d, REG(s)));                                 \
+    }                                                             \
+    break;
+
+#define ALU(op, s) case 0x80 | (op) << 3 | (s):                   \
+    EACH(lane_alu<op>(cpu, i, REG(s))); break;
+
+#define ALL_REGS(X, arg) \
+    X(arg, 0) X(arg, 1) X(arg, 2) X(arg, 3) X(arg, 4) X(arg, 5) X(arg, 6) X(arg, 7)
+
+#define REG_OPS(x, r)                                             \
+    case 0x04 | (r) << 3: /* INR */                               \
+        EACH(i8080_word_t w = REG(r); i8080_word_t res = w + 1;   \
+            cpu->ac[i] = ((w ^ 1 ^ res) >> 4) & 1;                \
+            lane_zsp(cpu, i, res); SET_REG(r, res));              \
+        break;                                                    \
+    case 0x05 | (r) << 3: /* DCR */                               \
+        EACH(i8080_word_t w = REG(r); i8080_word_t res = w + 0xff;\
+            cpu->ac[i] = ((w ^ 0xff ^ res) >> 4) & 1;             \
+            lane_zsp(cpu, i, res); SET_REG(r, res));              \
+        break;                                                    \
+    case 0x06 | (r) << 3: /* MVI */                               \
+        EACH(SET_REG(r, i8080_word_t(imm))); break;               \
+    case 0xc6 | (r) << 3: /* ADI ACI SUI SBI ANI XRI ORI CPI */   \
+        EACH(lane_alu<r>(cpu, i, i8080_word_t(imm))); break;      \
+    case 0xc2 | (r) << 3: /* Jcc */                               \
+        EACH(cpu->pc[i] = lane_cond<r>(cpu, i) ? imm : cpu->pc[i]); break; \
+    case 0xc4 | (r) << 3: /* Ccc */                               \
+        EACH(if (lane_cond<r>(cpu, i)) {                          \
+            lane_call<Bus>(cpu, i, imm); cpu->cycles[i] += 6; }); \
+        break;                                                    \
+    case 0xc0 | (r) << 3: /* Rcc */                               \
+        EACH(if (lane_cond<r>(cpu, i)) {                          \
+            cpu->pc[i] = lane_pop<Bus>(cpu, i); cpu->cycles[i] += 6; }); \
+        break;                                                    \
+    case 0xc7 | (r) << 3: /* RST */                               \
+        EACH(lane_call<Bus>(cpu, i, (r) * 8)); break;
+
+#define PAIR_OPS(rp)                                              \
+    case 0x01 | (rp) << 4: /* LXI */                              \
+        EACH(lane_set_pair<rp>(cpu, i, imm)); break;              \
+    case 0x03 | (rp) << 4: /* INX */                              \
+        EACH(lane_set_pair<rp>(cpu, i, lane_get_pair<rp>(cpu, i) + 1)); break; \
+    case 0x0b | (rp) << 4: /* DCX */                              \
+        EACH(lane_set_pair<rp>(cpu, i, lane_get_pair<rp>(cpu, i) - 1)); break; \
+    case 0x09 | (rp) << 4: /* DAD */                              \
+        EACH(std::uint32_t res = std::uint32_t(lane_hl(cpu, i)) + lane_get_pair<rp>(cpu, i); \
+            cpu->cy[i] = (res >> 16) & 1;                         \
+            lane_set_pair<2>(cpu, i, i8080_dword_t(res)));        \
+        break;                                                    \
+    case 0xc5 | (rp) << 4: /* PUSH */                             \
+        if constexpr ((rp) == LANE_SP) {                          \
+            EACH(lane_push<Bus>(cpu, i, i8080_dword_t(cpu->r[7][i] << 8 | lane_get_flags(cpu, i)))); \
+        } else {                                                  \
+            EACH(lane_push<Bus>(cpu, i, lane_get_pair<rp>(cpu, i))); \
+        }                                                         \
+        break;                                                    \
+    case 0xc1 | (rp) << 4: /* POP */                              \
+        if constexpr ((rp) == LANE_SP) {                          \
+            EACH(i8080_dword_t psw = lane_pop<Bus>(cpu, i);       \
+                cpu->r[7][i] = i8080_word_t(psw >> 8);            \
+                lane_set_flags(cpu, i, i8080_word_t(psw)));       \
+        } else {                                                  \
+            EACH(lane_set_pair<rp>(cpu, i, lane_pop<Bus>(cpu, i))); \
+        }                                                         \
+        break;
+
+// Run opcode, with pc already past it, for lanes, and count its
+// cycles. Without Count, the caller counts them, except for the ones
+// IO and taken conditional calls and returns add.
+template <class Bus>
+template <bool Count, class Lanes>
+void basic_i8080_lanes<Bus>::exec(i8080_word_t opcode, i8080_addr_t imm, Lanes lanes)
+{
+    i8080_lanes_state* cpu = this;
+
+    switch (opcode)
+    {
+    ALL_REGS(MOV, 0) ALL_REGS(MOV, 1) ALL_REGS(MOV, 2) ALL_REGS(MOV, 3)
+    ALL_REGS(MOV, 4) ALL_REGS(MOV, 5) ALL_REGS(MOV, 6) ALL_REGS(MOV, 7)
+
+    ALL_REGS(ALU, 0) ALL_REGS(ALU, 1) ALL_REGS(ALU, 2) ALL_REGS(ALU, 3)
+    ALL_REGS(ALU, 4) ALL_REGS(ALU, 5) ALL_REGS(ALU, 6) ALL_REGS(ALU, 7)
+
+    ALL_REGS(REG_OPS, 0)
+
+    PAIR_OPS(0) PAIR_OPS(1) PAIR_OPS(2) PAIR_OPS(3)
+
+    /* NOPs */
+    case i8080_NOP: case i8080_UD_NOP1: case i8080_UD_NOP2: case i8080_UD_NOP3:
+    case i8080_UD_NOP4: case i8080_UD_NOP5: case i8080_UD_NOP6: case i8080_UD_NOP7:
+        break;
+
+    /* Indirect load/store accumulator */
+    case i8080_STAX_B: EACH(lane_write<Bus>(cpu, i, lane_get_pair<0>(cpu, i), cpu->r[7][i])); break;
+    case i8080_STAX_D: EACH(lane_write<Bus>(cpu, i, lane_get_pair<1>(cpu, i), cpu->r[7][i])); break;
+    case i8080_LDAX_B: EACH(cpu->r[7][i] = lane_read<Bus>(cpu, i, lane_get_pair<0>(cpu, i))); break;
+    case i8080_LDAX_D: EACH(cpu->r[7][i] = lane_read<Bus>(cpu, i, lane_get_pair<1>(cpu, i))); break;
+    case i8080_STA: EACH(lane_write<Bus>(cpu, i, imm, cpu->r[7][i])); break;
+    case i8080_LDA: EACH(cpu->r[7][i] = lane_read<Bus>(cpu, i, imm)); break;
+    case i8080_SHLD:
+        EACH(lane_write<Bus>(cpu, i, imm, cpu->r[5][i]);
+            lane_write<Bus>(cpu, i, i8080_addr_t(imm + 1), cpu->r[4][i]));
+        break;
+    case i8080_LHLD:
+        EACH(cpu->r[5][i] = lane_read<Bus>(cpu, i, imm);
+            cpu->r[4][i] = lane_read<Bus>(cpu, i, i8080_addr_t(imm + 1)));
+        break;
+
+    /* Rotate */
+    case i8080_RLC:
+        EACH(i8080_word_t a = cpu->r[7][i]; cpu->cy[i] = a >> 7;
+            cpu->r[7][i] = i8080_word_t(a << 1 | a >> 7));
+        break;
+    case i8080_RRC:
+        EACH(i8080_word_t a = cpu->r[7][i]; cpu->cy[i] = a & 1;
+            cpu->r[7][i] = i8080_word_t(a >> 1 | a << 7));
+        break;
+    case i8080_RAL:
+        EACH(i8080_word_t a = cpu->r[7][i];
+            cpu->r[7][i] = i8080_word_t(a << 1 | cpu->cy[i]); cpu->cy[i] = a >> 7);
+        break;
+    case i8080_RAR:
+        EACH(i8080_word_t a = cpu->r[7][i];
+            cpu->r[7][i] = i8080_word_t(a >> 1 | cpu->cy[i] << 7); cpu->cy[i] = a & 1);
+        break;
+
+    /* Special instructions */
+    case i8080_DAA: EACH(lane_daa(cpu, i)); break;
+    case i8080_CMA: EACH(cpu->r[7][i] = i8080_word_t(~cpu->r[7][i])); break;
+    case i8080_STC: EACH(cpu->cy[i] = 1); break;
+    case i8080_CMC: EACH(cpu->cy[i] ^= 1); break;
+    case i8080_PCHL: EACH(cpu->pc[i] = lane_hl(cpu, i)); break;
+    case i8080_SPHL: EACH(cpu->sp[i] = lane_hl(cpu, i)); break;
+    case i8080_XCHG:
+        EACH(i8080_word_t h = cpu->r[4][i]; i8080_word_t l = cpu->r[5][i];
+            cpu->r[4][i] = cpu->r[2][i]; cpu->r[5][i] = cpu->r[3][i];
+            cpu->r[2][i] = h; cpu->r[3][i] = l);
+        break;
+    case i8080_XTHL:
+        EACH(i8080_addr_t sp = cpu->sp[i];
+            i8080_word_t lo = lane_read<Bus>(cpu, i, sp);
+            i8080_word_t hi = lane_read<Bus>(cpu, i, i8080_addr_t(sp + 1));
+            lane_write<Bus>(cpu, i, i8080_addr_t(sp + 1), cpu->r[4][i]);
+            lane_write<Bus>(cpu, i, sp, cpu->r[5][i]);
+            cpu->r[4][i] = hi; cpu->r[5][i] = lo);
+        break;
+
+    /* Jump, call, return */
+    case i8080_JMP: case i8080_UD_JMP: EACH(cpu->pc[i] = imm); break;
+    case i8080_CALL: case i8080_UD_CALL1: case i8080_UD_CALL2: case i8080_UD_CALL3:
+        EACH(lane_call<Bus>(cpu, i, imm));
+        break;
+    case i8080_RET: case i8080_UD_RET: EACH(cpu->pc[i] = lane_pop<Bus>(cpu, i)); break;
+
+    /* IO. A lane whose bus fails stops before counting cycles. */
+    case i8080_IN:
+        EACH(if (Bus::io_read(cpu, i, i8080_word_t(imm), cpu->r[7][i])) {
+                cpu->cycles[i] += CYCLES[i8080_IN];
+            } else {
+                cpu->exits[i] = I8080_EXIT_NO_CALLBACK;
+            });
+        return;
+    case i8080_OUT:
+        EACH(if (Bus::io_write(cpu, i, i8080_word_t(imm), cpu->r[7][i])) {
+                cpu->cycles[i] += CYCLES[i8080_OUT];
+            } else {
+                cpu->exits[i] = I8080_EXIT_NO_CALLBACK;
+            });
+        return;
+
+    /* Enable / disable interrupts */
+    case i8080_EI: EACH(cpu->int_en[i] = 1); break;
+    case i8080_DI: EACH(cpu->int_en[i] = 0); break;
+    }
+
+    if constexpr (Count) {
+        std::uint64_t op_cycles = CYCLES[opcode];
+        EACH(cpu->cycles[i] += op_cycles);
+    }
+}
+
+#undef EACH
+#undef REG
+#undef SET_REG
+#undef MOV
+#undef ALU
+#undef ALL_REGS
+#undef REG_OPS
+#undef PAIR_OPS
+
+// Operand of the instruction at pc, if it is all in shared pages
+// (so every lane at pc sees the same). Else false.
+static inline bool lane_shared_imm(const i8080_lanes_state* cpu, i8080_addr_t pc,
+    unsigned len, i8080_addr_t& imm)
+{
+    imm = 0;
+    for (unsigned k = 0; k < len; ++k) {
+        i8080_addr_t addr = i8080_addr_t(pc + k);
+        const i8080_word_t* page = cpu->shared_pages[addr >> I8080_PAGE_SHIFT];
+        if (!page) { return false; }
+        imm |= i8080_addr_t(page[addr & LANE_PAGE_MASK] << (8 * k));
+    }
+    return true;
+}
+
+#define NO_PC 0x10000u
+
+// The bus of the scalar core: Bus, for the lane it runs.
+template <class Bus>
+struct basic_i8080_lanes<Bus>::lane_bus
+{
+    static basic_i8080_lanes* lanes(i8080_state* cpu) {
+        return static_cast<basic_i8080_lanes*>(cpu->udata);
+    }
+    static i8080_word_t mem_read(i8080_state* cpu, i8080_addr_t addr) {
+        basic_i8080_lanes* l = lanes(cpu);
+        return Bus::mem_read(l, l->scalar_lane, addr);
+    }
+    static void mem_write(i8080_state* cpu, i8080_addr_t addr, i8080_word_t word) {
+        basic_i8080_lanes* l = lanes(cpu);
+        Bus::mem_write(l, l->scalar_lane, addr, word);
+    }
+    static bool io_read(i8080_state* cpu, i8080_word_t port, i8080_word_t& word) {
+        basic_i8080_lanes* l = lanes(cpu);
+        return Bus::io_read(l, l->scalar_lane, port, word);
+    }
+    static bool io_write(i8080_state* cpu, i8080_word_t port, i8080_word_t word) {
+        basic_i8080_lanes* l = lanes(cpu);
+        return Bus::io_write(l, l->scalar_lane, port, word);
+    }
+    static bool intr_read(i8080_state* cpu, i8080_word_t& opcode) {
+        basic_i8080_lanes* l = lanes(cpu);
+        return Bus::intr_read(l, l->scalar_lane, opcode);
+    }
+};
+
+template <class Bus>
+void basic_i8080_lanes<Bus>::interrupt_lane(int lane)
+{
+    i8080_word_t opcode;
+    if (!Bus::intr_read(this, lane, opcode)) {
+        exits[lane] = I8080_EXIT_NO_CALLBACK;
+        return;
+    }
+    int_en[lane] = 0;
+    int_rq[lane] = 0;
+    halt[lane] = 0;
+
+    /* Not from memory, only its operands are */
+    i8080_addr_t imm = 0;
+    unsigned len = LENGTHS[opcode] - 1u;
+    for (unsigned k = 0; k < len; ++k) {
+        imm |= i8080_addr_t(lane_read<Bus>(this, lane, i8080_addr_t(pc[lane] + k)) << (8 * k));
+    }
+    pc[lane] += i8080_addr_t(len);
+    exec<true>(opcode, imm, i8080_lane_list{ &lane, 1 });
+}
+
+// Run lanes, all at the same pc, while they stay together, in their
+// budget and behind every other lane (pc < next_pc).
+//
+// Ops that don't branch, do IO or halt move every lane's pc and
+// cycles the same way, so the group keeps those once (group_pc and
+// ahead) and only writes them to the lanes before one that does, or
+// when it stops. That leaves only the op itself to run per lane.
+template <class Bus>
+template <class Lanes>
+void basic_i8080_lanes<Bus>::run_group(Lanes lanes, int count, 
+    std::uint64_t until_cycle, std::uint32_t next_pc)
+{
+    constexpr bool vector = std::is_same_v<Lanes, i8080_all_lanes>;
+    const int first = lanes.first();
+    i8080_addr_t group_pc = pc[first];
+    std::uint64_t ahead = 0;
+    // Cycles left to the lane closest to the end of its budget.
+    std::uint64_t headroom = 0;
+    lanes([&](int i) { headroom = cycles[i] > headroom ? cycles[i] : headroom; });
+    headroom = until_cycle - headroom;
+
+    // Counted in a local: as far as the compiler knows, every byte
+    // stored to lane memory could change the members.
+    std::uint64_t num_steps = 0;
+
+    auto catch_up = [&]() {
+        lanes([&](int i) { pc[i] = group_pc; cycles[i] += ahead; });
+        ahead = 0;
+        steps += num_steps;
+        vector_steps += vector ? num_steps : 0;
+        lane_steps += num_steps * unsigned(count);
+        num_steps = 0;
+    };
+    for (;;)
+    {
+        i8080_word_t opcode;
+        i8080_addr_t imm;
+        unsigned len;
+        const i8080_word_t* page = shared_pages[group_pc >> I8080_PAGE_SHIFT];
+        unsigned offset = group_pc & LANE_PAGE_MASK;
+        bool shared = page != nullptr;
+        if (shared) {
+            opcode = page[offset];
+            len = LENGTHS[opcode];
+            if (offset + 2 < I8080_PAGE_SIZE) {
+                imm = i8080_addr_t(page[offset + 1] | page[offset + 2] << 8);
+                imm &= len == 3 ? 0xffff : len == 2 ? 0xff : 0;
+            } else {
+                shared = lane_shared_imm(this, i8080_addr_t(group_pc + 1), len - 1, imm);
+            }
+        }
+        if (!shared) {
+            // Code in lane memory, may differ between lanes.
+            // Run it for the first lane alone.
+            catch_up();
+            opcode = lane_read<Bus>(this, first, group_pc);
+            len = LENGTHS[opcode];
+            imm = 0;
+            for (unsigned k = 1; k < len; ++k) {
+                imm |= i8080_addr_t(lane_read<Bus>(this, first, i8080_addr_t(group_pc + k)) << (8 * (k - 1)));
+            }
+            pc[first] = i8080_addr_t(group_pc + len);
+            exec<true>(opcode, imm, i8080_lane_list{ &first, 1 });
+            steps++;
+            lane_steps++;
+            return;
+        }
+        const i8080_addr_t next = i8080_addr_t(group_pc + len);
+        num_steps++;
+
+        if (!ends_block(opcode)) {
+            exec<false>(opcode, imm, lanes);
+            group_pc = next;
+            ahead += CYCLES[opcode];
+            if (ahead >= headroom || group_pc >= next_pc) {
+                catch_up();
+                return;
+            }
+            continue;
+        }
+
+        group_pc = next;
+        catch_up();
+        exec<true>(opcode, imm, lanes);
+
+        group_pc = pc[first];
+        unsigned together = group_pc < next_pc;
+        std::uint64_t most = 0;
+        lanes([&](int i) {
+            together &= (pc[i] == group_pc) & (cycles[i] < until_cycle) &
+                (halt[i] == 0) & (exits[i] == I8080_EXIT_BUDGET);
+            most = cycles[i] > most ? cycles[i] : most;
+        });
+        if (!together) {
+            return;
+        }
+        headroom = until_cycle - most;
+    }
+}
+
+// Run lane on its own, on the scalar core with a block cache, until
+// it uses up its budget, halts or its bus fails. The block cache is
+// kept from lane to lane, all of them run the same shared code.
+template <class Bus>
+void basic_i8080_lanes<Bus>::run_lane(int lane, std::uint64_t until_cycle)
+{
+    if (!scalar_blocks) {
+        scalar_blocks = std::make_unique<i8080_block_cache>();
+        scalar.udata = this;
+        scalar.set_block_cache(scalar_blocks.get());
+    }
+    if (map_lane(lane, &scalar)) {
+        scalar.flush_blocks();
+    }
+    scalar_lane = lane;
+    get_lane(lane, &scalar);
+    std::uint64_t start_cycles = scalar.cycles;
+    i8080_exit exit = scalar.run(until_cycle);
+    set_lane(lane, &scalar);
+    exits[lane] = exit;
+    scalar_cycles += scalar.cycles - start_cycles;
+}
+
+template <class Bus>
+void basic_i8080_lanes<Bus>::run(std::uint64_t until_cycle)
+{
+    const int n = num_lanes;
+    auto running = [&](int i) {
+        return cycles[i] < until_cycle && !halt[i] && exits[i] == I8080_EXIT_BUDGET;
+    };
+    // Lanes still running, in order.
+    int active[I8080_MAX_LANES];
+    int num_active = 0;
+    for (int i = 0; i < n; ++i) {
+        exits[i] = I8080_EXIT_BUDGET;
+        if (int_rq[i] && cycles[i] < until_cycle) {
+            interrupt_lane(i);
+        }
+        if (running(i)) {
+            active[num_active++] = i;
+        }
+    }
+    int group[I8080_MAX_LANES];
+
+    // Run the lowest pc of the lanes still running, for every lane
+    // at it. Lanes behind in the code tend to catch up with the rest
+    // that way, and stay together after. A group too small to gain
+    // from that runs each of its lanes on the scalar core instead.
+    for (;;)
+    {
+        // In one pass, drop the lanes that stopped, and find the
+        // lanes at the lowest pc and the next lowest pc.
+        std::uint32_t lead_pc = NO_PC;
+        std::uint32_t next_pc = NO_PC;
+        int num_group = 0;
+        int num_left = 0;
+        for (int k = 0; k < num_active; ++k)
+        {
+            int i = active[k];
+            if (!running(i)) {
+                continue;
+            }
+            active[num_left++] = i;
+            std::uint32_t lane_pc = pc[i];
+            if (lane_pc > lead_pc) {
+                next_pc = lane_pc < next_pc ? lane_pc : next_pc;
+                continue;
+            }
+            if (lane_pc < lead_pc) {
+                next_pc = lead_pc;
+                lead_pc = lane_pc;
+                num_group = 0;
+            }
+            group[num_group++] = i;
+        }
+        num_active = num_left;
+        if (num_active == 0) {
+            break;
+        }
+
+        if (num_group < 2 || num_group * I8080_LANES_MIN_SHARE < n) {
+            for (int k = 0; k < num_group; ++k) {
+                run_lane(group[k], until_cycle);
+            }
+        } else if (num_group == n) {
+            run_group(i8080_all_lanes{ n }, n, until_cycle, next_pc);
+        } else {
+            run_group(i8080_lane_list{ group, num_group }, num_group, until_cycle, next_pc);
+        }
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (halt[i] && exits[i] == I8080_EXIT_BUDGET && cycles[i] < until_cycle) {
+            exits[i] = I8080_EXIT_HALT;
+        }
+    }
+}
+
+#undef NO_PC
+#undef LANE_M
+#undef LANE_SP
+#undef LANE_PAGE_MASK
+#undef LANE_INLINE
+#undef LANE_FLATTEN
+#undef lane_hl
+
+#endif /* I8080_LANES_IMPL_HPP */
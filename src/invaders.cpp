@@ -0,0 +1,128 @@
+
+#include <new>
+
+#include "machine.hpp"
+#include "invaders.h"
+
+static_assert(INVADERS_SCREEN_WIDTH == SCREEN_WIDTH && INVADERS_SCREEN_HEIGHT == SCREEN_HEIGHT);
+static_assert(INVADERS_NUM_SOUNDS == NUM_SOUNDS);
+
+#define BUTTONS_PORT1 (INVADERS_CREDIT | INVADERS_2P_START | INVADERS_1P_START | \
+    INVADERS_P1_FIRE | INVADERS_P1_LEFT | INVADERS_P1_RIGHT)
+#define BUTTONS_PORT2 (INVADERS_P2_FIRE | INVADERS_P2_LEFT | INVADERS_P2_RIGHT)
+#define DIPS_PORT2 (INVADERS_DIP_LIVES | INVADERS_DIP_BONUS_1000 | INVADERS_DIP_NO_COIN_INFO)
+
+static const uint32_t DEFAULT_PALETTE[NUM_SCREEN_COLORS] = {
+    0xFF000000, 0xFF1EFE1E, 0xFFFE1E1E, 0xFFFFFFFF
+};
+
+struct invaders
+{
+    machine m;
+    uint32_t sounds_started = 0;
+    uint32_t sounds_stopped = 0;
+};
+
+static void on_play_sound(void* udata, int idx, bool)
+{
+    static_cast<invaders*>(udata)->sounds_started |= 1u << idx;
+}
+
+static void on_stop_sound(void* udata, int idx)
+{
+    static_cast<invaders*>(udata)->sounds_stopped |= 1u << idx;
+}
+
+invaders* invaders_create(const char* rom_dir)
+{
+#ifndef DISABLE_EXCEPTIONS_AND_RTTI
+    try {
+#endif
+        invaders* inv = new (std::nothrow) invaders;
+        if (!inv) {
+            return nullptr;
+        }
+        if (inv->m.init(rom_dir) != 0) {
+            delete inv;
+            return nullptr;
+        }
+        inv->m.play_sound = on_play_sound;
+        inv->m.stop_sound = on_stop_sound;
+        inv->m.snd_udata = inv;
+        return inv;
+#ifndef DISABLE_EXCEPTIONS_AND_RTTI
+    }
+    catch (const std::bad_alloc&) {
+        logERROR("Out of memory");
+        return nullptr;
+    }
+#endif
+}
+
+void invaders_destroy(invaders* inv)
+{
+    delete inv;
+}
+
+void invaders_step_frame(invaders* inv)
+{
+    inv->sounds_started = 0;
+    inv->sounds_stopped = 0;
+    inv->m.run_frame();
+}
+
+uint64_t invaders_frame(const invaders* inv)
+{
+    return inv->m.frame_idx;
+}
+
+void invaders_set_inputs(invaders* inv, unsigned buttons)
+{
+    machine& m = inv->m;
+    m.in_port1 = i8080_word_t((m.in_port1 & ~BUTTONS_PORT1) | (buttons & BUTTONS_PORT1));
+    m.in_port2 = i8080_word_t((m.in_port2 & ~(BUTTONS_PORT2 >> 8)) | ((buttons & BUTTONS_PORT2) >> 8));
+}
+
+void invaders_set_dips(invaders* inv, unsigned dips)
+{
+    machine& m = inv->m;
+    m.in_port2 = i8080_word_t((m.in_port2 & ~DIPS_PORT2) | (dips & DIPS_PORT2));
+}
+
+void invaders_get_framebuffer(const invaders* inv,
+    uint32_t* pixels, size_t pitch, const uint32_t* palette)
+{
+    inv->m.draw_screen(pixels, unsigned(pitch), palette ? palette : DEFAULT_PALETTE);
+}
+
+uint32_t invaders_sounds_started(const invaders* inv)
+{
+    return inv->sounds_started;
+}
+
+uint32_t invaders_sounds_stopped(const invaders* inv)
+{
+    return inv->sounds_stopped;
+}
+
+size_t invaders_state_size(void)
+{
+    return MACHINE_SAVE_SIZE;
+}
+
+int invaders_save_state(const invaders* inv, void* buf, size_t size)
+{
+    return inv->m.save_state(buf, size);
+}
+
+int invaders_load_state(invaders* inv, const void* buf, size_t size)
+{
+    inv->sounds_started = 0;
+    inv->sounds_stopped = 0;
+    return inv->m.load_state(buf, size);
+}
+
+uint64_t invaders_state_hash(invaders* inv)
+{
+    return machine_hash(inv->m);
+}
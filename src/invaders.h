@@ -0,0 +1,116 @@
+/*
+ * The Space Invaders machine as a library, with a C API.
+ *
+ * Only the board itself: ROM, CPU, RAM, inputs, screen and sound
+ * pins, stepped a frame at a time. There is no window, audio or
+ * timing, so nothing needs SDL or a GPU. The caller draws the screen
+ * into its own buffer and plays the sounds, if it wants them.
+ * Machines are independent, each can run on its own thread.
+ *
+ * Built as the spaceinvaders-core target (see BUILD_CORE_LIB in
+ * CMakeLists.txt), static or shared as BUILD_SHARED_LIBS says.
+ *
+ * Example usage:
+ *
+ *     invaders* inv = invaders_create("assets/");
+ *     uint32_t pixels[INVADERS_SCREEN_WIDTH * INVADERS_SCREEN_HEIGHT];
+ *     while (playing) {
+ *         invaders_set_inputs(inv, INVADERS_P1_FIRE);
+ *         invaders_step_frame(inv);
+ *         invaders_get_framebuffer(inv, pixels, INVADERS_SCREEN_WIDTH, NULL);
+ *     }
+ *     invaders_destroy(inv);
+ */
+
+#ifndef INVADERS_H
+#define INVADERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(INVADERS_SHARED)
+    #ifdef INVADERS_BUILD
+        #define INVADERS_API __declspec(dllexport)
+    #else
+        #define INVADERS_API __declspec(dllimport)
+    #endif
+#elif defined(__GNUC__) && defined(INVADERS_SHARED)
+    #define INVADERS_API __attribute__((visibility("default")))
+#else
+    #define INVADERS_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INVADERS_SCREEN_WIDTH 224
+#define INVADERS_SCREEN_HEIGHT 256
+#define INVADERS_NUM_SOUNDS 10
+
+/* Buttons, for invaders_set_inputs(). */
+#define INVADERS_CREDIT   0x0001
+#define INVADERS_2P_START 0x0002
+#define INVADERS_1P_START 0x0004
+#define INVADERS_P1_FIRE  0x0010
+#define INVADERS_P1_LEFT  0x0020
+#define INVADERS_P1_RIGHT 0x0040
+#define INVADERS_P2_FIRE  0x1000
+#define INVADERS_P2_LEFT  0x2000
+#define INVADERS_P2_RIGHT 0x4000
+
+/* DIP switches, for invaders_set_dips(). Lives are 3 + the value
+ * of bits 0-1, the bonus life comes at 1000 points instead of 1500
+ * with bit 3, and bit 7 turns off the coin info in the demo. */
+#define INVADERS_DIP_LIVES        0x03
+#define INVADERS_DIP_BONUS_1000   0x08
+#define INVADERS_DIP_NO_COIN_INFO 0x80
+
+typedef struct invaders invaders;
+
+/* Load the ROM from rom_dir and reset. Returns NULL on error. */
+INVADERS_API invaders* invaders_create(const char* rom_dir);
+INVADERS_API void invaders_destroy(invaders* inv);
+
+/* Run one frame (~1/60 s) with the inputs set. */
+INVADERS_API void invaders_step_frame(invaders* inv);
+
+/* Frames run since reset. */
+INVADERS_API uint64_t invaders_frame(const invaders* inv);
+
+/* Buttons held from the next frame on, INVADERS_* buttons or'ed. */
+INVADERS_API void invaders_set_inputs(invaders* inv, unsigned buttons);
+INVADERS_API void invaders_set_dips(invaders* inv, unsigned dips);
+
+/* Draw the screen to pixels: INVADERS_SCREEN_HEIGHT rows of
+ * INVADERS_SCREEN_WIDTH pixels, pitch pixels apart. palette has the
+ * pixels for black, green, red and white. If it is NULL, they are
+ * 0xAARRGGBB. */
+INVADERS_API void invaders_get_framebuffer(const invaders* inv,
+    uint32_t* pixels, size_t pitch, const uint32_t* palette);
+
+/* Sounds (bit n is sound n) that started in the last frame, and
+ * looping ones that stopped. Sounds 0 and 9 loop until stopped,
+ * the others play once. After invaders_load_state(), the looping
+ * sounds it started or stopped to match the state. */
+INVADERS_API uint32_t invaders_sounds_started(const invaders* inv);
+INVADERS_API uint32_t invaders_sounds_stopped(const invaders* inv);
+
+/* Saved states hold everything that changes while running. A state
+ * is the same on every host, and only loads into the same version. */
+INVADERS_API size_t invaders_state_size(void);
+/* Returns 0 on success, -1 if size is too small. */
+INVADERS_API int invaders_save_state(const invaders* inv, void* buf, size_t size);
+/* Returns 0 on success, -1 (leaving inv as it was) if buf is not
+ * a state of this version. */
+INVADERS_API int invaders_load_state(invaders* inv, const void* buf, size_t size);
+
+/* 64-bit hash of the machine's state, cheap enough for every frame.
+ * Machines that hash the same ran the same. */
+INVADERS_API uint64_t invaders_state_hash(invaders* inv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1175 @@
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "i8080/i8080_impl.hpp"
+#include "i8080/i8080_lanes_impl.hpp"
+#include "machine.hpp"
+
+static inline machine* MACHINE(i8080_state* cpu) {
+    return static_cast<machine*>(cpu->udata);
+}
+
+// ROM and RAM are mapped into the CPU's page table, so the mem
+// functions only see unmapped accesses: writes to ROM, and
+// writes to RAM pages that are shared with a fork.
+
+i8080_word_t invaders_bus::mem_read(i8080_state* cpu, i8080_addr_t addr) {
+    return MACHINE(cpu)->read_mem(addr);
+}
+
+void invaders_bus::mem_write(i8080_state* cpu, i8080_addr_t addr, i8080_word_t word) {
+    addr %= MEM_SIZE;
+    if (addr >= RAM_START_ADDR) {
+        MACHINE(cpu)->write_ram(addr, word);
+    }
+    // else ROM, ignore
+}
+
+bool invaders_bus::io_read(i8080_state* cpu, i8080_word_t port, i8080_word_t& word) {
+    word = MACHINE(cpu)->io_read(port);
+    return true;
+}
+
+bool invaders_bus::io_write(i8080_state* cpu, i8080_word_t port, i8080_word_t word) {
+    MACHINE(cpu)->io_write(port, word);
+    return true;
+}
+
+bool invaders_bus::intr_read(i8080_state* cpu, i8080_word_t& opcode) {
+    opcode = MACHINE(cpu)->intr_opcode;
+    return true;
+}
+
+template struct basic_i8080<invaders_bus>;
+
+// The CPU is value-initialized, so its registers (which reset()
+// leaves alone) start at zero and every run starts the same.
+machine::machine() :
+    cpu(),
+    ram_owned(0),
+    ram_copies(0),
+    num_spare_ram(0),
+    ram_hashed(0),
+    ram_digest(),
+    in_port0(0),
+    in_port1(0),
+    in_port2(0),
+    intr_opcode(i8080_NOP),
+    shiftreg(0),
+    shiftreg_off(0),
+    ports(),
+    unmapped_reads(),
+    unmapped_writes(),
+    io_trace(nullptr),
+    play_sound(nullptr),
+    stop_sound(nullptr),
+    snd_udata(nullptr),
+    mute_sound(false),
+    idle_cycles_frame(0),
+    frame_idx(0),
+    frame_start(0)
+{}
+
+// Heap order, ties go to the lower event first.
+static bool event_after(const event_queue::entry& e1, const event_queue::entry& e2) {
+    return e1.cycle != e2.cycle ? e1.cycle > e2.cycle : e1.event > e2.event;
+}
+
+void event_queue::push(std::uint64_t cycle, machine_event event)
+{
+    heap[size++] = { cycle, event };
+    std::push_heap(heap, heap + size, event_after);
+}
+
+event_queue::entry event_queue::pop()
+{
+    std::pop_heap(heap, heap + size, event_after);
+    return heap[--size];
+}
+
+// Queue the events of the frame starting at frame_start.
+static void schedule_frame(event_queue& events, uint64_t frame_idx, uint64_t frame_start)
+{
+    uint64_t frame_cycles = FRAME_CYCLES + (frame_idx % FRAME_CYCLES_LONG_EVERY == 0);
+    events.push(frame_start + MIDSCREEN_CYCLES, EVENT_MIDSCREEN);
+    events.push(frame_start + frame_cycles, EVENT_VBLANK);
+}
+
+static int load_file(const fs::path& path, i8080_word_t* mem, unsigned size)
+{
+    file_ptr file = SAFE_FOPEN(path.c_str(), "rb");
+    if (!file) {
+        logERROR("Could not open file %s", path.string().c_str());
+        return -1;
+    }
+    if (std::fread(mem, 1, size, file.get()) != size) {
+        logERROR("Could not read %u bytes from file %s", size, path.string().c_str());
+        return -1;
+    }
+    std::fgetc(file.get()); // set eof
+    if (!std::feof(file.get())) {
+        logERROR("File %s is larger than %u bytes", path.string().c_str(), size);
+        return -1;
+    }
+    return 0;
+}
+
+static int load_rom(const fs::path& dir, i8080_word_t* mem)
+{
+    int e;
+    if (fs::exists(dir / "invaders.rom")) {
+        e = load_file(dir / "invaders.rom", mem, ROM_SIZE);
+        if (e) { return e; }
+        logMESSAGE("Loaded ROM");
+    }
+    else {
+        e = load_file(dir / "invaders.h", &mem[0], 2048);    if (e) { return e; }
+        e = load_file(dir / "invaders.g", &mem[2048], 2048); if (e) { return e; }
+        e = load_file(dir / "invaders.f", &mem[4096], 2048); if (e) { return e; }
+        e = load_file(dir / "invaders.e", &mem[6144], 2048); if (e) { return e; }
+
+        logMESSAGE("Loaded ROM files: invaders.e,f,g,h");
+    }
+    return 0;
+}
+
+int machine::init(const fs::path& romdir)
+{
+    mem = std::make_shared<i8080_word_t[]>(MEM_SIZE);
+    if (load_rom(romdir, mem.get()) != 0) {
+        return -1;
+    }
+
+    for (uint32_t base = 0; base < 0x10000; base += MEM_SIZE) {
+        cpu.map_mem(base, ROM_SIZE, &mem[0], I8080_MAP_READ);
+        cpu.map_mem(base + RAM_START_ADDR, RAM_SIZE, &mem[RAM_START_ADDR], I8080_MAP_RW);
+    }
+    // RAM pages point into mem, and keep all of it alive.
+    for (unsigned n = 0; n < RAM_PAGES; ++n) {
+        ram[n] = std::shared_ptr<i8080_word_t[]>(mem, &mem[RAM_START_ADDR + n * I8080_PAGE_SIZE]);
+    }
+    ram_owned = (1u << RAM_PAGES) - 1;
+    ram_hashed = 0;
+    blocks = std::make_shared<i8080_block_cache>();
+    cpu.set_block_cache(blocks.get());
+    cpu.udata = this;
+    cpu.reset();
+
+    in_port0 = 0x0e; // debug port
+    in_port1 = 0x08;
+    in_port2 = 0;
+    shiftreg = 0;
+    shiftreg_off = 0;
+    intr_opcode = i8080_NOP;
+    sndpins_last.reset();
+    map_ports();
+
+    frame_idx = 0;
+    frame_start = 0;
+    events.clear();
+    schedule_frame(events, frame_idx, frame_start);
+    return 0;
+}
+
+int machine::set_jit(bool enable)
+{
+    if (!enable) {
+        cpu.set_jit(nullptr);
+        return 0;
+    }
+    if (!jit) {
+        auto new_jit = std::make_unique<i8080_jit>();
+        if (new_jit->init() != 0) {
+            logERROR("CPU recompiler not supported on this host");
+            return -1;
+        }
+        jit = std::move(new_jit);
+    }
+    cpu.set_jit(jit.get());
+    return 0;
+}
+
+#ifdef INVADERS_AOT
+extern const i8080_aot_program invaders_aot; // generated
+#endif
+
+bool machine::has_aot()
+{
+#ifdef INVADERS_AOT
+    return true;
+#else
+    return false;
+#endif
+}
+
+int machine::set_aot(bool enable)
+{
+    if (!enable) {
+        cpu.set_aot(nullptr);
+        return 0;
+    }
+#ifdef INVADERS_AOT
+    if (!aot) {
+        aot = std::make_shared<i8080_aot>();
+    }
+    if (aot->load(invaders_aot, &cpu) != 0) {
+        logERROR("ROM does not match the precompiled code");
+        return -1;
+    }
+    cpu.set_aot(aot.get());
+    return 0;
+#else
+    logERROR("Not built with precompiled code (I8080_AOT)");
+    return -1;
+#endif
+}
+
+// High-level emulation of the ROM's hottest loops. Each function
+// runs whole iterations of its loop on host memory, in the same order
+// as the loop, then sets the flags of the last iteration with the
+// core's helpers. Loops that call the shift register use it directly.
+//
+// Only loop heads are intercepted, a routine's setup code before its
+// loop (and the first iteration, which doesn't start at a jump target)
+// runs in the interpreter.
+
+static inline i8080_dword_t reg_pair(i8080_word_t hi, i8080_word_t lo) {
+    return i8080_dword_t(hi << 8 | lo);
+}
+
+// Count n iterations out of the left the loop had, and leave
+// it for loop_end (the instruction after it) if that was all.
+static inline void hle_finish(i8080_state* cpu, uint32_t n, uint32_t left,
+    uint32_t iter_cycles, std::size_t loop_end)
+{
+    if (n == left) {
+        cpu->pc = i8080_addr_t(loop_end);
+    }
+    cpu->cycles += uint64_t(iter_cycles) * n;
+}
+
+// BlockCopy: copy B bytes from (DE) to (HL).
+// ldax d; mov m,a; inx h; inx d; dcr b; jnz 1a32
+static const i8080_word_t HLE_BLOCK_COPY[] = {
+    0x1a, 0x77, 0x23, 0x13, 0x05, 0xc2, 0x32, 0x1a
+};
+
+static bool hle_block_copy(i8080_state* cpu, uint64_t until_cycle)
+{
+    uint32_t left = cpu->b ? cpu->b : 256;
+    uint32_t n = i8080_hle_iters(cpu->cycles, until_cycle, 39, 29, left);
+    if (n == 0) { return false; }
+
+    i8080_dword_t de = reg_pair(cpu->d, cpu->e);
+    i8080_dword_t hl = reg_pair(cpu->h, cpu->l);
+    const i8080_word_t* src = i8080_hle_mem(cpu, de, n, I8080_MAP_READ);
+    i8080_word_t* dst = i8080_hle_mem(cpu, hl, n, I8080_MAP_WRITE);
+    if (!src || !dst) { return false; }
+
+    if (dst > src && dst < src + n) {
+        // forward copy repeats the overlapping bytes
+        for (uint32_t i = 0; i < n; ++i) { dst[i] = src[i]; }
+    }
+    else {
+        std::memmove(dst, src, n);
+    }
+    cpu->a = dst[n - 1];
+    de += n; hl += n;
+    cpu->d = i8080_word_t(de >> 8); cpu->e = i8080_word_t(de);
+    cpu->h = i8080_word_t(hl >> 8); cpu->l = i8080_word_t(hl);
+    cpu->b = i8080_dcr(cpu, i8080_word_t(cpu->b - (n - 1)));
+
+    hle_finish(cpu, n, left, 39, 0x1a32 + sizeof(HLE_BLOCK_COPY));
+    return true;
+}
+
+// ClearScreen: zero from HL to the end of VRAM.
+// mvi m,0; inx h; mov a,h; cpi 40h; jnz 1a5f
+static const i8080_word_t HLE_CLEAR_SCREEN[] = {
+    0x36, 0x00, 0x23, 0x7c, 0xfe, 0x40, 0xc2, 0x5f, 0x1a
+};
+
+static bool hle_clear_screen(i8080_state* cpu, uint64_t until_cycle)
+{
+    i8080_dword_t hl = reg_pair(cpu->h, cpu->l);
+    if (hl >= 0x4000) { return false; }
+    uint32_t left = 0x4000 - hl;
+    uint32_t n = i8080_hle_iters(cpu->cycles, until_cycle, 37, 27, left);
+    if (n == 0) { return false; }
+
+    i8080_word_t* dst = i8080_hle_mem(cpu, hl, n, I8080_MAP_WRITE);
+    if (!dst) { return false; }
+
+    std::memset(dst, 0, n);
+    hl += n;
+    cpu->h = i8080_word_t(hl >> 8); cpu->l = i8080_word_t(hl);
+    cpu->a = cpu->h;
+    i8080_cmp(cpu, 0x40);
+
+    hle_finish(cpu, n, left, 37, 0x1a5f + sizeof(HLE_CLEAR_SCREEN));
+    return true;
+}
+
+// Last iteration's DAD B (with BC = 20h) and DCR B of the sprite loops.
+static inline void hle_sprite_flags(i8080_state* cpu, i8080_dword_t last_hl, i8080_word_t last_b) {
+    cpu->h = i8080_word_t(last_hl >> 8); cpu->l = i8080_word_t(last_hl);
+    i8080_dad(cpu, 0x20);
+    cpu->b = i8080_dcr(cpu, last_b);
+}
+
+// DrawSimpSprite: B rows from (DE) to (HL), one row (32 bytes) apart.
+// push b; ldax d; mov m,a; inx d; lxi b,20h; dad b; pop b; dcr b; jnz 1439
+static const i8080_word_t HLE_DRAW_SIMP_SPRITE[] = {
+    0xc5, 0x1a, 0x77, 0x13, 0x01, 0x20, 0x00, 0x09, 0xc1, 0x05, 0xc2, 0x39, 0x14
+};
+
+static bool hle_draw_simp_sprite(i8080_state* cpu, uint64_t until_cycle)
+{
+    uint32_t left = cpu->b ? cpu->b : 256;
+    uint32_t n = i8080_hle_iters(cpu->cycles, until_cycle, 75, 65, left);
+    if (n == 0 || cpu->sp < 2) { return false; }
+
+    i8080_dword_t de = reg_pair(cpu->d, cpu->e);
+    i8080_dword_t hl = reg_pair(cpu->h, cpu->l);
+    i8080_word_t* stack = i8080_hle_mem(cpu, cpu->sp - 2, 2, I8080_MAP_WRITE);
+    const i8080_word_t* src = i8080_hle_mem(cpu, de, n, I8080_MAP_READ);
+    i8080_word_t* dst = i8080_hle_mem(cpu, hl, 32 * (n - 1) + 1, I8080_MAP_WRITE);
+    if (!stack || !src || !dst) { return false; }
+
+    i8080_word_t b = cpu->b;
+    for (uint32_t i = 0; i < n; ++i, --b) {
+        stack[1] = b;
+        stack[0] = cpu->c;
+        cpu->a = src[i];
+        dst[32 * i] = cpu->a;
+    }
+    de += n;
+    cpu->d = i8080_word_t(de >> 8); cpu->e = i8080_word_t(de);
+    hle_sprite_flags(cpu, i8080_dword_t(hl + 32 * (n - 1)), i8080_word_t(b + 1));
+
+    hle_finish(cpu, n, left, 75, 0x1439 + sizeof(HLE_DRAW_SIMP_SPRITE));
+    return true;
+}
+
+// EraseSimpleSprite: zero B rows of 2 bytes at (HL).
+// push b; push h; xra a; mov m,a; inx h; mov m,a; inx h; pop h;
+// lxi b,20h; dad b; pop b; dcr b; jnz 1427
+static const i8080_word_t HLE_ERASE_SIMPLE_SPRITE[] = {
+    0xc5, 0xe5, 0xaf, 0x77, 0x23, 0x77, 0x23, 0xe1,
+    0x01, 0x20, 0x00, 0x09, 0xc1, 0x05, 0xc2, 0x27, 0x14
+};
+
+static bool hle_erase_simple_sprite(i8080_state* cpu, uint64_t until_cycle)
+{
+    uint32_t left = cpu->b ? cpu->b : 256;
+    uint32_t n = i8080_hle_iters(cpu->cycles, until_cycle, 105, 95, left);
+    if (n == 0 || cpu->sp < 4) { return false; }
+
+    i8080_dword_t hl = reg_pair(cpu->h, cpu->l);
+    i8080_word_t* stack = i8080_hle_mem(cpu, cpu->sp - 4, 4, I8080_MAP_WRITE);
+    i8080_word_t* dst = i8080_hle_mem(cpu, hl, 32 * (n - 1) + 2, I8080_MAP_WRITE);
+    if (!stack || !dst) { return false; }
+
+    i8080_word_t b = cpu->b;
+    for (uint32_t i = 0; i < n; ++i, --b) {
+        i8080_dword_t row = i8080_dword_t(hl + 32 * i);
+        stack[3] = b;
+        stack[2] = cpu->c;
+        stack[1] = i8080_word_t(row >> 8);
+        stack[0] = i8080_word_t(row);
+        dst[32 * i] = 0;
+        dst[32 * i + 1] = 0;
+    }
+    cpu->a = 0;
+    hle_sprite_flags(cpu, i8080_dword_t(hl + 32 * (n - 1)), i8080_word_t(b + 1));
+
+    hle_finish(cpu, n, left, 105, 0x1427 + sizeof(HLE_ERASE_SIMPLE_SPRITE));
+    return true;
+}
+
+// DrawShiftedSprite and EraseShifted: B rows from (DE), shifted by
+// the shift register, ORed into (or cleared from) 2 bytes at (HL).
+// push b; push h; ldax d; out 4; in 3; [cma]; ora m / ana m; mov m,a;
+// inx h; inx d; xra a; out 4; in 3; [cma]; ora m / ana m; mov m,a;
+// pop h; lxi b,20h; dad b; pop b; dcr b; jnz 1405 / 1455
+static const i8080_word_t HLE_DRAW_SHIFTED_SPRITE[] = {
+    0xc5, 0xe5, 0x1a, 0xd3, 0x04, 0xdb, 0x03, 0xb6, 0x77, 0x23,
+    0x13, 0xaf, 0xd3, 0x04, 0xdb, 0x03, 0xb6, 0x77, 0xe1, 0x01,
+    0x20, 0x00, 0x09, 0xc1, 0x05, 0xc2, 0x05, 0x14
+};
+static const i8080_word_t HLE_ERASE_SHIFTED[] = {
+    0xc5, 0xe5, 0x1a, 0xd3, 0x04, 0xdb, 0x03, 0x2f, 0xa6, 0x77,
+    0x23, 0x13, 0xaf, 0xd3, 0x04, 0xdb, 0x03, 0x2f, 0xa6, 0x77,
+    0xe1, 0x01, 0x20, 0x00, 0x09, 0xc1, 0x05, 0xc2, 0x55, 0x14
+};
+
+template <bool Erase>
+static bool hle_shifted_sprite(i8080_state* cpu, uint64_t until_cycle)
+{
+    const uint32_t iter_cycles = Erase ? 174 : 166;
+    uint32_t left = cpu->b ? cpu->b : 256;
+    uint32_t n = i8080_hle_iters(cpu->cycles, until_cycle, iter_cycles, iter_cycles - 10, left);
+    if (n == 0 || cpu->sp < 4) { return false; }
+
+    machine* m = MACHINE(cpu);
+    i8080_dword_t de = reg_pair(cpu->d, cpu->e);
+    i8080_dword_t hl = reg_pair(cpu->h, cpu->l);
+    i8080_word_t* stack = i8080_hle_mem(cpu, cpu->sp - 4, 4, I8080_MAP_WRITE);
+    const i8080_word_t* src = i8080_hle_mem(cpu, de, n, I8080_MAP_READ);
+    i8080_word_t* dst = i8080_hle_mem(cpu, hl, 32 * (n - 1) + 2, I8080_MAP_WRITE);
+    if (!stack || !src || !dst) { return false; }
+
+    i8080_word_t b = cpu->b;
+    for (uint32_t i = 0; i < n; ++i, --b) {
+        i8080_dword_t row = i8080_dword_t(hl + 32 * i);
+        stack[3] = b;
+        stack[2] = cpu->c;
+        stack[1] = i8080_word_t(row >> 8);
+        stack[0] = i8080_word_t(row);
+        for (int j = 0; j < 2; ++j) {
+            m->io_write(4, j == 0 ? src[i] : 0);
+            i8080_word_t bits = m->io_read(3);
+            cpu->a = Erase ? i8080_word_t(~bits & dst[32 * i + j]) : i8080_word_t(bits | dst[32 * i + j]);
+            dst[32 * i + j] = cpu->a;
+        }
+    }
+    de += n;
+    cpu->d = i8080_word_t(de >> 8); cpu->e = i8080_word_t(de);
+    hle_sprite_flags(cpu, i8080_dword_t(hl + 32 * (n - 1)), i8080_word_t(b + 1));
+
+    hle_finish(cpu, n, left, iter_cycles, Erase ?
+        0x1455 + sizeof(HLE_ERASE_SHIFTED) : 0x1405 + sizeof(HLE_DRAW_SHIFTED_SPRITE));
+    return true;
+}
+
+#define HLE_ROUTINE(name, addr, code, fn) { name, addr, code, sizeof(code), fn }
+
+static const i8080_hle_routine HLE_ROUTINES[] = {
+    HLE_ROUTINE("BlockCopy", 0x1a32, HLE_BLOCK_COPY, hle_block_copy),
+    HLE_ROUTINE("ClearScreen", 0x1a5f, HLE_CLEAR_SCREEN, hle_clear_screen),
+    HLE_ROUTINE("DrawSimpSprite", 0x1439, HLE_DRAW_SIMP_SPRITE, hle_draw_simp_sprite),
+    HLE_ROUTINE("EraseSimpleSprite", 0x1427, HLE_ERASE_SIMPLE_SPRITE, hle_erase_simple_sprite),
+    HLE_ROUTINE("DrawShiftedSprite", 0x1405, HLE_DRAW_SHIFTED_SPRITE, hle_shifted_sprite<false>),
+    HLE_ROUTINE("EraseShifted", 0x1455, HLE_ERASE_SHIFTED, hle_shifted_sprite<true>)
+};
+
+#undef HLE_ROUTINE
+
+int machine::set_hle(bool enable)
+{
+    if (!enable) {
+        cpu.set_hle(nullptr);
+        return 0;
+    }
+    if (!hle) {
+        hle = std::make_shared<i8080_hle>();
+    }
+    if (hle->load(HLE_ROUTINES, sizeof(HLE_ROUTINES) / sizeof(HLE_ROUTINES[0]), &cpu) != 0) {
+        logERROR("ROM does not have the routines HLE replaces");
+        return -1;
+    }
+    cpu.set_hle(hle.get());
+    return 0;
+}
+
+void machine::run_until(uint64_t until_cycle)
+{
+    while (cpu.cycles < until_cycle)
+    {
+        switch (cpu.run(until_cycle))
+        {
+        case I8080_EXIT_BUDGET:
+            return;
+        case I8080_EXIT_HALT:
+            // halted CPU still uses up clock cycles
+            // until the next interrupt
+            cpu.cycles = until_cycle;
+            return;
+        case I8080_EXIT_BREAKPOINT:
+            // no debugger attached yet, carry on
+            break;
+        case I8080_EXIT_NO_CALLBACK:
+            logERROR("Bus failure at pc 0x%04x", unsigned(cpu.pc));
+            cpu.cycles = until_cycle;
+            return;
+        }
+    }
+}
+
+
+bool machine::run_event(machine_event event, uint64_t cycle)
+{
+    switch (event)
+    {
+    case EVENT_MIDSCREEN:
+        intr_opcode = i8080_RST_1;
+        cpu.interrupt();
+        return false;
+
+    case EVENT_VBLANK:
+        intr_opcode = i8080_RST_2;
+        cpu.interrupt();
+        // the next frame starts on time, extra
+        // cycles the CPU ran are taken from it
+        frame_start = cycle;
+        frame_idx++;
+        schedule_frame(events, frame_idx, frame_start);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+void machine::run_frame()
+{
+    uint64_t prev_idlecycles = blocks->idle_cycles;
+    for (;;)
+    {
+        event_queue::entry next = events.pop();
+        run_until(next.cycle);
+        if (run_event(next.event, next.cycle)) {
+            break;
+        }
+    }
+    idle_cycles_frame = blocks->idle_cycles - prev_idlecycles;
+}
+
+void machine::map_port(i8080_word_t port,
+    i8080_word_t(*read)(machine& m, i8080_word_t port),
+    void(*write)(machine& m, i8080_word_t port, i8080_word_t word))
+{
+    ports[port] = { read, write };
+}
+
+void machine::map_ports()
+{
+    for (io_port& port : ports) {
+        port = {};
+    }
+    std::fill(std::begin(unmapped_reads), std::end(unmapped_reads), 0);
+    std::fill(std::begin(unmapped_writes), std::end(unmapped_writes), 0);
+
+    // Inputs
+    map_port(0, [](machine& m, i8080_word_t) { return m.in_port0; }, nullptr);
+    map_port(1, [](machine& m, i8080_word_t) { return m.in_port1; }, nullptr);
+
+    // Shift register chip. Writes to 2 set the offset, writes to 4 
+    // shift in from the MSB, reads from 3 get the result.
+    map_port(2, 
+        [](machine& m, i8080_word_t) { return m.in_port2; },
+        [](machine& m, i8080_word_t, i8080_word_t word) { m.shiftreg_off = (word & 0x7); });
+    map_port(4, nullptr, [](machine& m, i8080_word_t, i8080_word_t word) {
+        m.shiftreg >>= 8;
+        m.shiftreg |= (i8080_dword_t(word) << 8);
+    });
+
+    // Also writes to the sound chip.
+    map_port(3, 
+        [](machine& m, i8080_word_t) { return i8080_word_t(m.shiftreg >> (8 - m.shiftreg_off)); },
+        [](machine& m, i8080_word_t, i8080_word_t word) {
+            for (int i = 0; i < 4; ++i) {
+                m.set_sound_pin(i, get_bit(word, i));
+            }
+            m.set_sound_pin(9, get_bit(word, 4));
+        });
+    map_port(5, nullptr, [](machine& m, i8080_word_t, i8080_word_t word) {
+        for (int i = 0; i < 5; ++i) {
+            m.set_sound_pin(i + 4, get_bit(word, i));
+        }
+    });
+
+    // Watchdog port. Resets machine if unresponsive, 
+    // not required for an emulator
+    map_port(6, nullptr, [](machine&, i8080_word_t, i8080_word_t) {});
+}
+
+void machine::log_unmapped_ports() const
+{
+    for (int port = 0; port < 256; ++port) {
+        if (unmapped_reads[port] || unmapped_writes[port]) {
+            logWARNING("IO port %d is unmapped, read %llu times, written %llu times", port,
+                (unsigned long long)unmapped_reads[port], (unsigned long long)unmapped_writes[port]);
+        }
+    }
+}
+
+// Pixel color after gel overlay
+// https://tcrf.net/images/a/af/SpaceInvadersArcColorUseTV.png
+static screen_color overlay_color(unsigned x, unsigned y)
+{
+    if ((y <= 15 && x > 24 && x < 136) || (y > 15 && y < 71)) {
+        return SCREEN_GREEN;
+    }
+    else if (y >= 192 && y < 223) {
+        return SCREEN_RED;
+    }
+    else { return SCREEN_WHITE; }
+}
+
+void machine::draw_screen(std::uint32_t* pixels, unsigned pitch, const std::uint32_t* palette) const
+{
+    unsigned VRAM_idx = VRAM_START_ADDR - RAM_START_ADDR;
+
+    // Unpack (8 on/off pixels per byte) and rotate counter-clockwise
+    for (unsigned x = 0; x < SCREEN_WIDTH; ++x)
+    {
+        for (unsigned y = 0; y < SCREEN_HEIGHT; y += 8)
+        {
+            i8080_word_t word = ram[VRAM_idx / I8080_PAGE_SIZE][VRAM_idx % I8080_PAGE_SIZE];
+            VRAM_idx++;
+
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                screen_color color = get_bit(word, bit) ? overlay_color(x, y) : SCREEN_BLACK;
+                pixels[pitch * (SCREEN_HEIGHT - y - bit - 1) + x] = palette[color];
+            }
+        }
+    }
+}
+
+static bool snd_is_looping(int idx)
+{
+    return idx == 0 || idx == 9;
+}
+
+// Saved states are little-endian, see machine::save_state().
+
+static unsigned char* put_le(unsigned char* p, uint64_t val, int num_bytes)
+{
+    for (int i = 0; i < num_bytes; ++i) {
+        *p++ = (unsigned char)(val >> (8 * i));
+    }
+    return p;
+}
+
+static uint64_t get_le(const unsigned char*& p, int num_bytes)
+{
+    uint64_t val = 0;
+    for (int i = 0; i < num_bytes; ++i) {
+        val |= uint64_t(*p++) << (8 * i);
+    }
+    return val;
+}
+
+// Pages RAM is mapped at, in every mirror.
+static constexpr uint64_t ram_pages()
+{
+    uint64_t pages = 0;
+    for (uint32_t addr = RAM_START_ADDR; addr < 0x10000; addr += I8080_PAGE_SIZE) {
+        if (addr % MEM_SIZE >= RAM_START_ADDR) {
+            pages |= uint64_t(1) << (addr >> I8080_PAGE_SHIFT);
+        }
+    }
+    return pages;
+}
+
+int machine::save_state(void* buf, std::size_t size) const
+{
+    if (size < MACHINE_SAVE_SIZE) {
+        return -1;
+    }
+    unsigned char* p = save_header(static_cast<unsigned char*>(buf));
+    for (unsigned n = 0; n < RAM_PAGES; ++n) {
+        std::memcpy(p + n * I8080_PAGE_SIZE, ram[n].get(), I8080_PAGE_SIZE);
+    }
+    return 0;
+}
+
+// Everything in a saved state but RAM, which follows it.
+unsigned char* machine::save_header(unsigned char* p) const
+{
+    std::memcpy(p, MACHINE_SAVE_MAGIC, 4);
+    p = put_le(p + 4, MACHINE_SAVE_VERSION, 4);
+
+    cpu.save_state(p);
+    p += I8080_SAVE_SIZE;
+
+    *p++ = in_port0;
+    *p++ = in_port1;
+    *p++ = in_port2;
+    *p++ = intr_opcode;
+    p = put_le(p, shiftreg, 2);
+    *p++ = shiftreg_off;
+    p = put_le(p, sndpins_last.to_ulong(), 2);
+
+    p = put_le(p, frame_idx, 8);
+    p = put_le(p, frame_start, 8);
+    // The heap as is, unused entries are zero.
+    *p++ = (unsigned char)events.size;
+    for (int i = 0; i < NUM_EVENTS; ++i) {
+        bool used = i < events.size;
+        p = put_le(p, used ? events.heap[i].cycle : 0, 8);
+        *p++ = (unsigned char)(used ? events.heap[i].event : 0);
+    }
+    return p;
+}
+
+int machine::load_state(const void* buf, std::size_t size)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(buf);
+    if (size < MACHINE_SAVE_SIZE || std::memcmp(p, MACHINE_SAVE_MAGIC, 4) != 0) {
+        logERROR("Not a saved state");
+        return -1;
+    }
+    p += 4;
+    uint64_t version = get_le(p, 4);
+    if (version != MACHINE_SAVE_VERSION) {
+        logERROR("Saved state is version %u, expected %u", unsigned(version), MACHINE_SAVE_VERSION);
+        return -1;
+    }
+    // Check the events before changing anything.
+    const unsigned char* ev = p + I8080_SAVE_SIZE + 9 + 16;
+    if (ev[0] > NUM_EVENTS) {
+        logERROR("Saved state is corrupt");
+        return -1;
+    }
+    for (int i = 0; i < ev[0]; ++i) {
+        if (ev[1 + 9 * i + 8] >= NUM_EVENTS) {
+            logERROR("Saved state is corrupt");
+            return -1;
+        }
+    }
+
+    cpu.load_state(p);
+    p += I8080_SAVE_SIZE;
+
+    in_port0 = *p++;
+    in_port1 = *p++;
+    in_port2 = *p++;
+    intr_opcode = *p++;
+    shiftreg = i8080_dword_t(get_le(p, 2));
+    shiftreg_off = *p++ & 0x7;
+    std::bitset<NUM_SOUNDS> sndpins(get_le(p, 2));
+
+    frame_idx = get_le(p, 8);
+    frame_start = get_le(p, 8);
+    events.size = *p++;
+    for (int i = 0; i < NUM_EVENTS; ++i) {
+        events.heap[i].cycle = get_le(p, 8);
+        events.heap[i].event = machine_event(*p++);
+    }
+
+    ram_hashed = 0;
+    for (unsigned n = 0; n < RAM_PAGES; ++n) {
+        std::memcpy(own_ram_page(n, false), p + n * I8080_PAGE_SIZE, I8080_PAGE_SIZE);
+        map_ram_page(n);
+    }
+    // Code cached from RAM may no longer be there.
+    if (cpu.code_pages & ram_pages()) {
+        cpu.flush_blocks();
+    }
+
+    // Looping sounds play for as long as their pin is on,
+    // one-shots already played when it went on.
+    for (int i = 0; i < NUM_SOUNDS; ++i) {
+        if (snd_is_looping(i) && sndpins[i] != sndpins_last[i]) {
+            set_sound_pin(i, sndpins[i]);
+        }
+    }
+    sndpins_last = sndpins;
+    return 0;
+}
+
+// Map RAM page n, for writes only if they can go straight to it.
+void machine::map_ram_page(unsigned n)
+{
+    i8080_word_t* page = ram[n].get();
+    i8080_word_t* wpage = ((ram_owned & ~ram_hashed) >> n) & 1 ? page : nullptr;
+    unsigned first = RAM_START_ADDR / I8080_PAGE_SIZE + n;
+    if (cpu.rpages[first] == page && cpu.wpages[first] == wpage) {
+        return;
+    }
+    if (cpu.jit) {
+        // Translations may have read from the old page.
+        if (cpu.rpages[first] != page) {
+            cpu.jit->flush();
+        }
+        cpu.jit->wpages_dirty = true;
+    }
+    // Directly, map_mem() would flush the block cache the forks share.
+    for (uint32_t base = 0; base < 0x10000; base += MEM_SIZE) {
+        unsigned i = (base + RAM_START_ADDR) / I8080_PAGE_SIZE + n;
+        cpu.rpages[i] = page;
+        cpu.wpages[i] = wpage;
+    }
+}
+
+i8080_word_t* machine::own_ram_page(unsigned n, bool copy)
+{
+    if (!(ram_owned & (1u << n))) {
+        std::shared_ptr<i8080_word_t[]> page;
+        if (num_spare_ram > 0) {
+            page = std::move(spare_ram[--num_spare_ram]);
+        }
+        else {
+            page = std::make_shared_for_overwrite<i8080_word_t[]>(I8080_PAGE_SIZE);
+        }
+        if (copy) {
+            std::memcpy(page.get(), ram[n].get(), I8080_PAGE_SIZE);
+            ram_copies++;
+        }
+        ram[n] = std::move(page);
+        ram_owned |= 1u << n;
+        map_ram_page(n);
+    }
+    return ram[n].get();
+}
+
+i8080_word_t machine::read_mem(i8080_addr_t addr) const
+{
+    addr %= MEM_SIZE;
+    if (addr < RAM_START_ADDR) {
+        return mem[addr];
+    }
+    addr -= RAM_START_ADDR;
+    return ram[addr / I8080_PAGE_SIZE][addr % I8080_PAGE_SIZE];
+}
+
+void machine::write_ram(i8080_addr_t addr, i8080_word_t word)
+{
+    addr = (addr % MEM_SIZE) - RAM_START_ADDR;
+    unsigned n = addr / I8080_PAGE_SIZE;
+    i8080_word_t* page = own_ram_page(n, true);
+    if (ram_hashed & (1u << n)) {
+        ram_hashed &= ~(1u << n);
+        map_ram_page(n);
+    }
+    page[addr % I8080_PAGE_SIZE] = word;
+}
+
+int machine::fork(machine& child)
+{
+    if (cpu.code_pages & ram_pages()) {
+        logERROR("Can't fork a machine that runs code from RAM");
+        return -1;
+    }
+    // From now on, both copy a page before writing to it.
+    if (ram_owned) {
+        ram_owned = 0;
+        for (unsigned n = 0; n < RAM_PAGES; ++n) {
+            map_ram_page(n);
+        }
+    }
+
+    // The page table and cached code come along with the registers.
+    child.cpu = cpu;
+    child.cpu.udata = &child;
+    child.cpu.jit = nullptr;
+    child.mem = mem;
+    child.blocks = blocks;
+    child.aot = aot;
+    child.hle = hle;
+    for (unsigned n = 0; n < RAM_PAGES; ++n) {
+        if (child.ram_owned & (1u << n)) {
+            child.spare_ram[child.num_spare_ram++] = std::move(child.ram[n]);
+        }
+        child.ram[n] = ram[n];
+    }
+    child.ram_owned = 0;
+    child.ram_copies = 0;
+    child.ram_hashed = ram_hashed;
+    std::copy(std::begin(ram_digest), std::end(ram_digest), child.ram_digest);
+
+    child.in_port0 = in_port0;
+    child.in_port1 = in_port1;
+    child.in_port2 = in_port2;
+    child.intr_opcode = intr_opcode;
+    child.shiftreg = shiftreg;
+    child.shiftreg_off = shiftreg_off;
+    std::copy(std::begin(ports), std::end(ports), child.ports);
+    child.io_trace = nullptr;
+
+    child.sndpins_last = sndpins_last;
+    child.play_sound = play_sound;
+    child.stop_sound = stop_sound;
+    child.snd_udata = snd_udata;
+    child.mute_sound = true;
+
+    child.idle_cycles_frame = idle_cycles_frame;
+    child.events = events;
+    child.frame_idx = frame_idx;
+    child.frame_start = frame_start;
+    return 0;
+}
+
+// A round and the final mix of xxHash64.
+static inline uint64_t hash_round(uint64_t h, uint64_t word)
+{
+    h += word * 0xc2b2ae3d27d4eb4full;
+    h = (h << 31) | (h >> 33);
+    return h * 0x9e3779b185ebca87ull;
+}
+
+static inline uint64_t hash_final(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xc2b2ae3d27d4eb4full;
+    h ^= h >> 29;
+    h *= 0x165667b19e3779f9ull;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t hash_bytes(const unsigned char* p, std::size_t size)
+{
+    uint64_t h = size;
+    for (; size >= 8; size -= 8) {
+        h = hash_round(h, get_le(p, 8));
+    }
+    if (size > 0) {
+        h = hash_round(h, get_le(p, int(size)));
+    }
+    return hash_final(h);
+}
+
+// Hash of a header (see save_header()) and the digests of each RAM page.
+static uint64_t hash_combine(const unsigned char* header, const uint64_t* digests)
+{
+    uint64_t h = hash_bytes(header, MACHINE_SAVE_HEADER_SIZE);
+    for (unsigned n = 0; n < RAM_PAGES; ++n) {
+        h = hash_round(h, digests[n]);
+    }
+    return hash_final(h);
+}
+
+std::uint64_t machine_hash(machine& m)
+{
+    // Pages not written since they were last hashed are mapped read-only,
+    // so the first write to one reaches write_ram() and clears its bit.
+    for (unsigned n = 0; n < RAM_PAGES; ++n) {
+        if (!(m.ram_hashed & (1u << n))) {
+            m.ram_digest[n] = hash_bytes(m.ram[n].get(), I8080_PAGE_SIZE);
+            m.ram_hashed |= 1u << n;
+            m.map_ram_page(n);
+        }
+    }
+    unsigned char header[MACHINE_SAVE_HEADER_SIZE];
+    m.save_header(header);
+    return hash_combine(header, m.ram_digest);
+}
+
+std::uint64_t machine_hash(const void* state)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(state);
+    uint64_t digests[RAM_PAGES];
+    for (unsigned n = 0; n < RAM_PAGES; ++n) {
+        digests[n] = hash_bytes(p + MACHINE_SAVE_HEADER_SIZE + n * I8080_PAGE_SIZE, I8080_PAGE_SIZE);
+    }
+    return hash_combine(p, digests);
+}
+
+i8080_word_t machine::io_read(i8080_word_t port)
+{
+    i8080_word_t word = 0;
+    if (ports[port].read) {
+        word = ports[port].read(*this, port);
+    }
+    else {
+        unmapped_reads[port]++;
+    }
+    if (io_trace) {
+        std::fprintf(io_trace, "%llu in %02x %02x\n", (unsigned long long)cpu.cycles, port, word);
+    }
+    return word;
+}
+
+// looping: repeat sound while pin is on.
+// non-looping: restart sound every positive edge (off->on)
+void machine::set_sound_pin(int idx, bool pin_on)
+{
+    if (pin_on) {
+        if (!sndpins_last[idx]) {
+            if (play_sound && !mute_sound) {
+                play_sound(snd_udata, idx, snd_is_looping(idx));
+            }
+            sndpins_last[idx] = true;
+        }
+    }
+    else {
+        if (snd_is_looping(idx) && stop_sound && !mute_sound) {
+            stop_sound(snd_udata, idx);
+        }
+        sndpins_last[idx] = false;
+    }
+}
+
+void machine::io_write(i8080_word_t port, i8080_word_t word)
+{
+    if (ports[port].write) {
+        ports[port].write(*this, port, word);
+    }
+    else {
+        unmapped_writes[port]++;
+    }
+    if (io_trace) {
+        std::fprintf(io_trace, "%llu out %02x %02x\n", (unsigned long long)cpu.cycles, port, word);
+    }
+}
+
+static inline machine_lanes* MACHINE_LANES(i8080_lanes_state* cpu) {
+    return static_cast<machine_lanes*>(cpu->udata);
+}
+
+// RAM and ROM are mapped, as for invaders_bus.
+
+i8080_word_t invaders_lanes_bus::mem_read(i8080_lanes_state* cpu, int lane, i8080_addr_t addr) {
+    addr %= MEM_SIZE;
+    machine_lanes* m = MACHINE_LANES(cpu);
+    return addr < RAM_START_ADDR ? m->rom[addr] : m->lane_ram(lane)[addr - RAM_START_ADDR];
+}
+
+void invaders_lanes_bus::mem_write(i8080_lanes_state* cpu, int lane, i8080_addr_t addr, i8080_word_t word) {
+    addr %= MEM_SIZE;
+    if (addr >= RAM_START_ADDR) {
+        MACHINE_LANES(cpu)->lane_ram(lane)[addr - RAM_START_ADDR] = word;
+    }
+    // else ROM, ignore
+}
+
+// Same ports as machine::map_ports(). Sound and the watchdog are ignored.
+bool invaders_lanes_bus::io_read(i8080_lanes_state* cpu, int lane, i8080_word_t port, i8080_word_t& word)
+{
+    machine_lanes* m = MACHINE_LANES(cpu);
+    switch (port)
+    {
+    case 0: word = m->in_port0[lane]; break;
+    case 1: word = m->in_port1[lane]; break;
+    case 2: word = m->in_port2[lane]; break;
+    case 3: word = i8080_word_t(m->shiftreg[lane] >> (8 - m->shiftreg_off[lane])); break;
+    default: word = 0; break;
+    }
+    return true;
+}
+
+bool invaders_lanes_bus::io_write(i8080_lanes_state* cpu, int lane, i8080_word_t port, i8080_word_t word)
+{
+    machine_lanes* m = MACHINE_LANES(cpu);
+    switch (port)
+    {
+    case 2:
+        m->shiftreg_off[lane] = (word & 0x7);
+        break;
+    case 4:
+        m->shiftreg[lane] >>= 8;
+        m->shiftreg[lane] |= (i8080_dword_t(word) << 8);
+        break;
+    default: 
+        break;
+    }
+    return true;
+}
+
+bool invaders_lanes_bus::intr_read(i8080_lanes_state* cpu, int, i8080_word_t& opcode) {
+    opcode = MACHINE_LANES(cpu)->intr_opcode;
+    return true;
+}
+
+template struct basic_i8080_lanes<invaders_lanes_bus>;
+
+machine_lanes::machine_lanes() :
+    in_port0(),
+    in_port1(),
+    in_port2(),
+    intr_opcode(i8080_NOP),
+    shiftreg(),
+    shiftreg_off(),
+    frame_idx(0),
+    frame_start(0)
+{}
+
+int machine_lanes::init(const fs::path& romdir, int num_lanes)
+{
+    if (num_lanes < 1 || num_lanes > I8080_MAX_LANES) {
+        logERROR("Number of lanes must be from 1 to %d", I8080_MAX_LANES);
+        return -1;
+    }
+    rom = std::make_unique<i8080_word_t[]>(ROM_SIZE);
+    ram = std::make_unique<i8080_word_t[]>(std::size_t(num_lanes) * RAM_SIZE);
+    if (load_rom(romdir, rom.get()) != 0) {
+        return -1;
+    }
+
+    cpu.num_lanes = num_lanes;
+    for (int i = 0; i < num_lanes; ++i) {
+        cpu.lane_mem[i] = lane_ram(i);
+    }
+    for (uint32_t base = 0; base < 0x10000; base += MEM_SIZE) {
+        cpu.map_shared(base, ROM_SIZE, rom.get());
+        cpu.map_lanes(base + RAM_START_ADDR, RAM_SIZE, 0, I8080_MAP_RW);
+    }
+    cpu.udata = this;
+    cpu.reset();
+
+    for (int i = 0; i < num_lanes; ++i) {
+        in_port0[i] = 0x0e; // debug port
+        in_port1[i] = 0x08;
+        in_port2[i] = 0;
+        shiftreg[i] = 0;
+        shiftreg_off[i] = 0;
+    }
+    intr_opcode = i8080_NOP;
+
+    frame_idx = 0;
+    frame_start = 0;
+    events.clear();
+    schedule_frame(events, frame_idx, frame_start);
+    return 0;
+}
+
+void machine_lanes::run_until(uint64_t until_cycle)
+{
+    cpu.run(until_cycle);
+    for (int i = 0; i < cpu.num_lanes; ++i)
+    {
+        switch (cpu.exits[i])
+        {
+        case I8080_EXIT_HALT:
+            // as in machine::run_until()
+            cpu.cycles[i] = until_cycle;
+            break;
+        case I8080_EXIT_NO_CALLBACK:
+            logERROR("Bus failure at pc 0x%04x in lane %d", unsigned(cpu.pc[i]), i);
+            cpu.cycles[i] = until_cycle;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+bool machine_lanes::run_event(machine_event event, uint64_t cycle)
+{
+    switch (event)
+    {
+    case EVENT_MIDSCREEN:
+        intr_opcode = i8080_RST_1;
+        for (int i = 0; i < cpu.num_lanes; ++i) { cpu.interrupt(i); }
+        return false;
+
+    case EVENT_VBLANK:
+        intr_opcode = i8080_RST_2;
+        for (int i = 0; i < cpu.num_lanes; ++i) { cpu.interrupt(i); }
+        frame_start = cycle;
+        frame_idx++;
+        schedule_frame(events, frame_idx, frame_start);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+void machine_lanes::run_frame()
+{
+    for (;;)
+    {
+        event_queue::entry next = events.pop();
+        run_until(next.cycle);
+        if (run_event(next.event, next.cycle)) {
+            break;
+        }
+    }
+}
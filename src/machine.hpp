@@ -0,0 +1,337 @@
+
+#ifndef MACHINE_HPP
+#define MACHINE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <bitset>
+
+#include "i8080/i8080.hpp"
+#include "i8080/i8080_aot.hpp"
+#include "i8080/i8080_hle.hpp"
+#include "i8080/i8080_jit.hpp"
+#include "i8080/i8080_lanes.hpp"
+#include "base.hpp"
+
+// 8K ROM followed by 8K RAM. Only A0-A13 are decoded,
+// so this repeats every 16K over the address space.
+#define ROM_SIZE 0x2000
+#define RAM_START_ADDR 0x2000
+#define RAM_SIZE 0x2000
+#define MEM_SIZE 0x4000
+#define RAM_PAGES (RAM_SIZE / I8080_PAGE_SIZE)
+
+// todo: these assume a compatible ROM
+#define VRAM_START_ADDR 0x2400
+#define GAMEMODE_ADDR 0x20ef
+#define HISCORE_START_ADDR 0x20f4
+
+#define NUM_SOUNDS 10
+
+// The screen as it is seen: the monitor is mounted on its side.
+#define SCREEN_WIDTH 224
+#define SCREEN_HEIGHT 256
+
+// Colors through the gel overlay, see machine::draw_screen().
+enum screen_color : std::uint8_t
+{
+    SCREEN_BLACK,
+    SCREEN_GREEN,
+    SCREEN_RED,
+    SCREEN_WHITE,
+    NUM_SCREEN_COLORS
+};
+
+// Saved states, see machine::save_state(). Bump the version
+// whenever the layout changes, older states are then rejected.
+#define MACHINE_SAVE_MAGIC "SINV"
+#define MACHINE_SAVE_VERSION 1
+#define MACHINE_SAVE_HEADER_SIZE (8 + I8080_SAVE_SIZE + 9 + 16 + 1 + 9 * NUM_EVENTS)
+#define MACHINE_SAVE_SIZE (MACHINE_SAVE_HEADER_SIZE + RAM_SIZE)
+// Where in_port0-2 are in a saved state, in that order.
+#define MACHINE_SAVE_INPUTS_OFFSET (8 + I8080_SAVE_SIZE)
+
+// 2 MHz CPU and 60 Hz video: 33333.33 cycles a frame, so every
+// third frame (starting with the first) is one cycle longer.
+#define FRAME_CYCLES 33333
+#define FRAME_CYCLES_LONG_EVERY 3
+// The beam is halfway down the screen (line 96 of 224) this many
+// cycles into a frame. 14286 = (96/224) * (16667us/0.5us)
+#define MIDSCREEN_CYCLES 14286
+
+struct machine;
+
+// Handlers for an IO port, see machine::map_port().
+// Either is null if the port can't be read/written.
+struct io_port
+{
+    i8080_word_t(*read)(machine& m, i8080_word_t port);
+    void(*write)(machine& m, i8080_word_t port, i8080_word_t word);
+};
+
+// Things the board does at a given CPU cycle.
+enum machine_event : int
+{
+    EVENT_MIDSCREEN, // RST 1 from the video chip
+    EVENT_VBLANK,    // RST 2 from the video chip, ends the frame
+    NUM_EVENTS
+};
+
+// Pending events, earliest first. Each event is pending at most
+// once, so this is a binary min-heap in a fixed array.
+struct event_queue
+{
+    struct entry
+    {
+        std::uint64_t cycle;
+        machine_event event;
+    };
+    entry heap[NUM_EVENTS];
+    int size = 0;
+
+    bool empty() const { return size == 0; }
+    const entry& top() const { return heap[0]; }
+
+    void clear() { size = 0; }
+    void push(std::uint64_t cycle, machine_event event);
+    entry pop();
+};
+
+// The board as seen by the CPU. Resolved at compile 
+// time, so everything inlines into the interpreter.
+struct invaders_bus
+{
+    static i8080_word_t mem_read(i8080_state* cpu, i8080_addr_t addr);
+    static void mem_write(i8080_state* cpu, i8080_addr_t addr, i8080_word_t word);
+
+    static bool io_read(i8080_state* cpu, i8080_word_t port, i8080_word_t& word);
+    static bool io_write(i8080_state* cpu, i8080_word_t port, i8080_word_t word);
+    static bool intr_read(i8080_state* cpu, i8080_word_t& opcode);
+};
+
+extern template struct basic_i8080<invaders_bus>;
+
+// Space Invaders arcade board, without any frontend.
+struct machine
+{
+    basic_i8080<invaders_bus> cpu;
+    // ROM followed by RAM, MEM_SIZE bytes. RAM is in ram[] instead
+    // once the machine has been forked (see fork()), read it with
+    // read_mem() if that can happen.
+    std::shared_ptr<i8080_word_t[]> mem;
+    // Shared with forks, see fork().
+    std::shared_ptr<i8080_block_cache> blocks;
+    std::unique_ptr<i8080_jit> jit; // null unless enabled
+    std::shared_ptr<i8080_aot> aot; // null unless enabled
+    std::shared_ptr<i8080_hle> hle; // null unless enabled
+
+    // RAM, by page. Pages are shared with forks until written.
+    std::shared_ptr<i8080_word_t[]> ram[RAM_PAGES];
+    unsigned ram_owned; // bit n set if ram[n] is not shared
+    std::uint64_t ram_copies; // pages copied on write
+    // Pages this machine had before it was last forked into,
+    // to copy into instead of allocating.
+    std::shared_ptr<i8080_word_t[]> spare_ram[RAM_PAGES];
+    unsigned num_spare_ram;
+    // Digests of RAM pages, see machine_hash(). Bit n of ram_hashed
+    // is set if ram_digest[n] is up to date.
+    unsigned ram_hashed;
+    std::uint64_t ram_digest[RAM_PAGES];
+
+    i8080_word_t in_port0;
+    i8080_word_t in_port1;
+    i8080_word_t in_port2;
+
+    // Video chip interrupts
+    i8080_word_t intr_opcode;
+
+    // Shift register chip
+    i8080_dword_t shiftreg;
+    i8080_word_t shiftreg_off;
+
+    // IO ports, by number. Accesses to ports without a handler
+    // are counted instead, see log_unmapped_ports().
+    io_port ports[256];
+    std::uint64_t unmapped_reads[256];
+    std::uint64_t unmapped_writes[256];
+    // If not null, every IN/OUT is written here, one per line.
+    std::FILE* io_trace;
+
+    // Sound chip. The frontend plays the sounds,
+    // hooks may be null.
+    std::bitset<NUM_SOUNDS> sndpins_last;
+    void(*play_sound)(void* udata, int idx, bool loop);
+    void(*stop_sound)(void* udata, int idx);
+    void* snd_udata;
+    // If set, sound pins still change but the hooks aren't called
+    // (eg. for frames that are run and then thrown away).
+    bool mute_sound;
+
+    // CPU cycles the last frame skipped in idle loops,
+    // see basic_i8080::run(). Counted in cpu.cycles.
+    std::uint64_t idle_cycles_frame;
+
+    // The CPU runs straight up to the next event, then it is run.
+    event_queue events;
+    std::uint64_t frame_idx;   // frames started since reset
+    std::uint64_t frame_start; // cycle the current frame started at
+
+    machine();
+
+    // Allocate memory, load ROM from dir and reset.
+    // Returns 0 on success, -1 on error.
+    int init(const fs::path& romdir);
+
+    // Run one frame (~1/60s), up to and including its VBLANK event.
+    void run_frame();
+
+    // Turn the CPU recompiler on or off. Can be called between frames.
+    // Returns -1 if it is not supported on this host.
+    int set_jit(bool enable);
+
+    // Turn the ROM's precompiled code on or off (see I8080_AOT in
+    // CMakeLists.txt). Returns -1 if it was not built in, or the
+    // loaded ROM is not the one it was built from.
+    int set_aot(bool enable);
+
+    // True if the precompiled code was built in, so set_aot() can
+    // be tried without it logging an error.
+    static bool has_aot();
+
+    // Turn native versions of the ROM's copy, clear and sprite
+    // loops on or off (see i8080_hle.hpp). They give the same
+    // results as running the loops. Returns -1 if the loaded ROM
+    // doesn't have them.
+    int set_hle(bool enable);
+
+    // Set port's handlers, replacing any it had.
+    void map_port(i8080_word_t port, 
+        i8080_word_t(*read)(machine& m, i8080_word_t port),
+        void(*write)(machine& m, i8080_word_t port, i8080_word_t word));
+
+    // Make child a copy of this machine that shares its ROM, RAM and
+    // caches. Either one copies a RAM page the first time it writes
+    // to it after this, so each sees only its own writes. child may
+    // be reused, what it held before is dropped. Takes well under a
+    // microsecond, for searching through many possible futures.
+    //
+    // The child runs without the JIT, has no IO trace and is muted.
+    // A machine with the JIT flushes it whenever it copies a page.
+    // Machines forked from each other share a block cache, so run
+    // them on one thread at a time. That cache is only right while
+    // no code runs from RAM (true for the Space Invaders ROM).
+    // Returns -1 if some already has.
+    int fork(machine& child);
+
+    // Read memory as the CPU would.
+    i8080_word_t read_mem(i8080_addr_t addr) const;
+
+    // Write RAM as the CPU would, addr must be in RAM.
+    void write_ram(i8080_addr_t addr, i8080_word_t word);
+
+    // Log how often each unmapped port was accessed, if any were.
+    void log_unmapped_ports() const;
+
+    // Draw the screen upright, through the gel overlay, to pixels:
+    // SCREEN_HEIGHT rows of SCREEN_WIDTH, pitch pixels apart. palette
+    // has a pixel for each screen_color.
+    void draw_screen(std::uint32_t* pixels, unsigned pitch, const std::uint32_t* palette) const;
+
+    // Write everything that changes while running (CPU, RAM, devices,
+    // pending events) to buf, in MACHINE_SAVE_SIZE bytes. ROM, hooks
+    // and caches are left out. Call between frames or from a hook,
+    // not during cpu.run(). Returns -1 if size is too small.
+    int save_state(void* buf, std::size_t size) const;
+
+    // Restore a state from save_state(). Looping sounds are started
+    // or stopped to match it. Returns -1, leaving the machine as it
+    // was, if buf does not hold a state of this version.
+    int load_state(const void* buf, std::size_t size);
+
+    i8080_word_t io_read(i8080_word_t port);
+    void io_write(i8080_word_t port, i8080_word_t word);
+
+private:
+    // Run the CPU until cycles >= until_cycle,
+    // handling every reason run() can stop for.
+    void run_until(std::uint64_t until_cycle);
+
+    // Run event, due at cycle. Returns true if it ends the frame.
+    bool run_event(machine_event event, std::uint64_t cycle);
+
+    void map_ports();
+    void set_sound_pin(int idx, bool pin_on);
+
+    // RAM page n, unshared first. Its contents are copied
+    // over, unless they are about to be overwritten.
+    i8080_word_t* own_ram_page(unsigned n, bool copy);
+    void map_ram_page(unsigned n);
+    unsigned char* save_header(unsigned char* p) const;
+
+    friend std::uint64_t machine_hash(machine& m);
+};
+
+// 64-bit hash of everything in m's saved state (see save_state()),
+// the same on every host. Machines that hash the same ran the same.
+// RAM is hashed by page, and only pages written since the last call
+// are hashed again, so this is cheap to call every frame.
+std::uint64_t machine_hash(machine& m);
+
+// The same for a saved state, hashing all of it.
+std::uint64_t machine_hash(const void* state);
+
+// The board as seen by each lane of machine_lanes.
+struct invaders_lanes_bus
+{
+    static i8080_word_t mem_read(i8080_lanes_state* cpu, int lane, i8080_addr_t addr);
+    static void mem_write(i8080_lanes_state* cpu, int lane, i8080_addr_t addr, i8080_word_t word);
+
+    static bool io_read(i8080_lanes_state* cpu, int lane, i8080_word_t port, i8080_word_t& word);
+    static bool io_write(i8080_lanes_state* cpu, int lane, i8080_word_t port, i8080_word_t word);
+    static bool intr_read(i8080_lanes_state* cpu, int lane, i8080_word_t& opcode);
+};
+
+extern template struct basic_i8080_lanes<invaders_lanes_bus>;
+
+// Many boards with the same ROM, run in lockstep (see i8080_lanes.hpp).
+// Each lane has its own RAM, inputs and shift register, and all see
+// the same video interrupts. Headless, so there is no sound.
+struct machine_lanes
+{
+    basic_i8080_lanes<invaders_lanes_bus> cpu;
+    std::unique_ptr<i8080_word_t[]> rom;
+    std::unique_ptr<i8080_word_t[]> ram; // RAM_SIZE bytes per lane
+
+    i8080_word_t in_port0[I8080_MAX_LANES];
+    i8080_word_t in_port1[I8080_MAX_LANES];
+    i8080_word_t in_port2[I8080_MAX_LANES];
+
+    // Video chip interrupts
+    i8080_word_t intr_opcode;
+
+    // Shift register chips
+    i8080_dword_t shiftreg[I8080_MAX_LANES];
+    i8080_word_t shiftreg_off[I8080_MAX_LANES];
+
+    event_queue events;
+    std::uint64_t frame_idx;
+    std::uint64_t frame_start;
+
+    machine_lanes();
+
+    // Allocate memory for num_lanes boards (at most I8080_MAX_LANES),
+    // load ROM from dir and reset. Returns 0 on success, -1 on error.
+    int init(const fs::path& romdir, int num_lanes);
+
+    // Run one frame on every lane, see machine::run_frame().
+    void run_frame();
+
+    i8080_word_t* lane_ram(int lane) { return &ram[std::size_t(lane) * RAM_SIZE]; }
+
+private:
+    void run_until(std::uint64_t until_cycle);
+    bool run_event(machine_event event, std::uint64_t cycle);
+};
+
+#endif
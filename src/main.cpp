@@ -34,7 +34,31 @@ static int do_main(int argc, char* argv[])
             cxxopts::value<std::string>()->default_value("assets/"), "<dir>")
         ("r,renderer", "Render backend to use. See SDL_HINT_RENDER_DRIVER. If not provided, "
             "will be determined automatically.", cxxopts::value<std::string>(), "<rend>")
-        ("disable-menu", "Disable menu bar.");
+        ("disable-menu", "Disable menu bar.")
+        ("headless", "Run without a window, sound or settings, then log how fast it ran "
+            "and the final state hash.")
+        ("frames", "Frames to run with --headless.",
+            cxxopts::value<uint64_t>()->default_value("3600"), "<frames>")
+        ("uncapped", "With --headless, run as fast as possible instead of at 60 fps.")
+        ("headless-render", "With --headless, also draw every frame (to memory).")
+        ("trace-io", "Write every IN/OUT to a file.", cxxopts::value<std::string>(), "<file>")
+        ("hash-log", "Write a hash of the machine's state to a file after every frame (not ones run ahead or predicted).",
+            cxxopts::value<std::string>(), "<file>")
+        ("record", "Record the game to a movie file.", cxxopts::value<std::string>(), "<file>")
+        ("replay", "Play back a movie file.", cxxopts::value<std::string>(), "<file>")
+        ("replay-from", "Frame to start playing back from.",
+            cxxopts::value<uint64_t>()->default_value("0"), "<frame>")
+        ("netplay", "Play over the network as player 1 or 2.", cxxopts::value<int>(), "<player>")
+        ("netplay-port", "Local UDP port for netplay.",
+            cxxopts::value<int>()->default_value(XSTR(NETPLAY_DEFAULT_PORT)), "<port>")
+        ("netplay-peer", "Address of the other player.",
+            cxxopts::value<std::string>()->default_value("127.0.0.1:" XSTR(NETPLAY_DEFAULT_PORT)), "<host:port>")
+        ("netplay-delay", "Frames of input delay, player 1's is used.",
+            cxxopts::value<int>()->default_value("1"), "<frames>")
+        ("netplay-test-latency", "For testing netplay, delay sent packets by this much.",
+            cxxopts::value<int>()->default_value("0"), "<ms>")
+        ("netplay-test-loss", "For testing netplay, drop this many sent packets.",
+            cxxopts::value<double>()->default_value("0"), "<percent>");
         
     auto args = opts.parse(argc, argv);
 
@@ -52,15 +76,62 @@ static int do_main(int argc, char* argv[])
         return 0;
     }
 
+    bool headless = args["headless"].as<bool>();
     emu emu(
         args["asset-dir"].as<std::string>(), 
         args["renderer"].count() == 0 ? "" : args["renderer"].as<std::string>(),
-        !args["disable-menu"].as<bool>());
+        !args["disable-menu"].as<bool>(),
+        headless);
 #endif
 
     if (!emu.ok()) {
         return -1;
     }
+#ifndef __EMSCRIPTEN__
+    if (args["trace-io"].count() != 0 && 
+        emu.trace_io(args["trace-io"].as<std::string>()) != 0) {
+        return -1;
+    }
+    if (args["hash-log"].count() != 0 &&
+        emu.log_hashes(args["hash-log"].as<std::string>()) != 0) {
+        return -1;
+    }
+    if (args["record"].count() != 0 && args["replay"].count() != 0) {
+        logERROR("--record and --replay can't be used together");
+        return -1;
+    }
+    if (args["record"].count() != 0 &&
+        emu.record_movie(args["record"].as<std::string>()) != 0) {
+        return -1;
+    }
+    if (args["replay"].count() != 0 &&
+        emu.replay_movie(args["replay"].as<std::string>(), args["replay-from"].as<uint64_t>()) != 0) {
+        return -1;
+    }
+    if (args["netplay"].count() != 0)
+    {
+        netplay_config cfg;
+        cfg.player = args["netplay"].as<int>();
+        cfg.local_port = uint16_t(args["netplay-port"].as<int>());
+        cfg.input_delay = args["netplay-delay"].as<int>();
+        cfg.send_latency_ms = args["netplay-test-latency"].as<int>();
+        cfg.send_loss = args["netplay-test-loss"].as<double>() / 100;
+
+        std::string peer = args["netplay-peer"].as<std::string>();
+        std::size_t colon = peer.rfind(':');
+        if (colon == std::string::npos) {
+            logERROR("--netplay-peer must be <host:port>");
+            return -1;
+        }
+        cfg.peer_host = peer.substr(0, colon);
+        cfg.peer_port = uint16_t(std::atoi(peer.c_str() + colon + 1));
+        emu.set_netplay(cfg);
+    }
+    if (headless) {
+        return emu.run_headless(args["frames"].as<uint64_t>(),
+            args["uncapped"].as<bool>(), args["headless-render"].as<bool>());
+    }
+#endif
     // Start!
     return emu.run();
 }
@@ -88,6 +159,9 @@ int main(int argc, char* argv[])
 #endif
         int err = log_init();
         if (err != 0) {
+            // can't log an error, show a message box
+            SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,
+                "Error", "Could not create log file", NULL);
             return on_exit(err, false);
         }
 
@@ -0,0 +1,372 @@
+
+#include <algorithm>
+#include <cstring>
+
+#include "movie.hpp"
+
+#define HEADER_SIZE 16
+#define TRAILER_SIZE 12
+#define MOVIE_MAGIC "SIMV"
+#define TRAILER_MAGIC "SIMX"
+
+#define CHUNK_TAG_KEY 'K'
+#define CHUNK_TAG_INPUT 'I'
+#define CHUNK_TAG_END 'E'
+
+static unsigned char* put_le(unsigned char* p, uint64_t val, int num_bytes)
+{
+    for (int i = 0; i < num_bytes; ++i) {
+        *p++ = (unsigned char)(val >> (8 * i));
+    }
+    return p;
+}
+
+static uint64_t get_le(const unsigned char* p, int num_bytes)
+{
+    uint64_t val = 0;
+    for (int i = 0; i < num_bytes; ++i) {
+        val |= uint64_t(p[i]) << (8 * i);
+    }
+    return val;
+}
+
+static void get_ports(const machine& m, i8080_word_t* ports)
+{
+    ports[0] = m.in_port0;
+    ports[1] = m.in_port1;
+    ports[2] = m.in_port2;
+}
+
+movie_recorder::~movie_recorder()
+{
+    close();
+}
+
+int movie_recorder::open(const fs::path& path, std::uint32_t every)
+{
+    close();
+    if (every == 0) {
+        logERROR("Movie keyframes must be at least a frame apart");
+        return -1;
+    }
+    file = std::fopen(path.string().c_str(), "wb");
+    if (!file) {
+        logERROR("Could not open %s", path.string().c_str());
+        return -1;
+    }
+    keyframe_every = every;
+    offset = 0;
+    frames = keyframes = input_changes = 0;
+    index.clear();
+    state = std::make_unique<unsigned char[]>(MACHINE_SAVE_SIZE);
+
+    unsigned char header[HEADER_SIZE];
+    std::memcpy(header, MOVIE_MAGIC, 4);
+    put_le(header + 4, MOVIE_VERSION, 4);
+    put_le(header + 8, keyframe_every, 4);
+    put_le(header + 12, MACHINE_SAVE_SIZE, 4);
+    write(header, sizeof(header));
+    return 0;
+}
+
+void movie_recorder::write(const void* data, std::size_t size)
+{
+    std::fwrite(data, 1, size, file);
+    offset += size;
+}
+
+void movie_recorder::frame(const machine& m)
+{
+    if (!file) {
+        return;
+    }
+    i8080_word_t ports[3];
+    get_ports(m, ports);
+
+    if (frames % keyframe_every == 0)
+    {
+        index.push_back(frames);
+        index.push_back(offset);
+        unsigned char head[9];
+        head[0] = CHUNK_TAG_KEY;
+        put_le(head + 1, frames, 8);
+        m.save_state(state.get(), MACHINE_SAVE_SIZE);
+        write(head, sizeof(head));
+        write(state.get(), MACHINE_SAVE_SIZE);
+        last_chunk_frame = frames;
+        std::memcpy(last_ports, ports, sizeof(ports));
+        keyframes++;
+    }
+    else
+    {
+        unsigned mask = 0;
+        for (int i = 0; i < 3; ++i) {
+            mask |= unsigned(ports[i] != last_ports[i]) << i;
+        }
+        if (mask != 0)
+        {
+            unsigned char chunk[1 + 10 + 1 + 3];
+            unsigned char* p = chunk;
+            *p++ = CHUNK_TAG_INPUT;
+            uint64_t delta = frames - last_chunk_frame;
+            while (delta >= 0x80) {
+                *p++ = (unsigned char)(delta | 0x80);
+                delta >>= 7;
+            }
+            *p++ = (unsigned char)delta;
+            *p++ = (unsigned char)mask;
+            for (int i = 0; i < 3; ++i) {
+                if (mask & (1u << i)) {
+                    *p++ = ports[i];
+                }
+            }
+            write(chunk, std::size_t(p - chunk));
+            last_chunk_frame = frames;
+            std::memcpy(last_ports, ports, sizeof(ports));
+            input_changes++;
+        }
+    }
+    frames++;
+}
+
+int movie_recorder::close()
+{
+    if (!file) {
+        return 0;
+    }
+    uint64_t end_offset = offset;
+    std::vector<unsigned char> end(1 + 8 + 4 + 8 * index.size() + TRAILER_SIZE);
+    unsigned char* p = end.data();
+    *p++ = CHUNK_TAG_END;
+    p = put_le(p, frames, 8);
+    p = put_le(p, index.size() / 2, 4);
+    for (uint64_t word : index) {
+        p = put_le(p, word, 8);
+    }
+    p = put_le(p, end_offset, 8);
+    std::memcpy(p, TRAILER_MAGIC, 4);
+    write(end.data(), end.size());
+
+    int err = std::ferror(file) ? -1 : 0;
+    if (std::fclose(file) != 0) {
+        err = -1;
+    }
+    file = nullptr;
+    if (err) {
+        logERROR("Could not write movie");
+    }
+    return err;
+}
+
+movie_player::~movie_player()
+{
+    if (file) {
+        std::fclose(file);
+    }
+}
+
+bool movie_player::read(void* data, std::size_t size)
+{
+    return std::fread(data, 1, size, file) == size;
+}
+
+// Read the chunk at the file position. Returns false, with
+// chunk set to CHUNK_NONE, at the end or if it is cut off.
+bool movie_player::read_chunk()
+{
+    chunk = CHUNK_NONE;
+    unsigned char buf[9];
+    if (!read(buf, 1)) {
+        return false;
+    }
+    if (buf[0] == CHUNK_TAG_KEY)
+    {
+        if (!read(buf, 8) || !read(state.get(), MACHINE_SAVE_SIZE)) {
+            return false;
+        }
+        chunk_frame = get_le(buf, 8);
+        chunk = CHUNK_KEY;
+    }
+    else if (buf[0] == CHUNK_TAG_INPUT)
+    {
+        uint64_t delta = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (shift > 63 || !read(buf, 1)) {
+                return false;
+            }
+            delta |= uint64_t(buf[0] & 0x7f) << shift;
+            if (!(buf[0] & 0x80)) { break; }
+        }
+        if (!read(buf, 1)) {
+            return false;
+        }
+        chunk_mask = buf[0] & 0x7;
+        for (int i = 0; i < 3; ++i) {
+            if ((chunk_mask & (1u << i)) && !read(&chunk_ports[i], 1)) {
+                return false;
+            }
+        }
+        chunk_frame += delta;
+        chunk = CHUNK_INPUT;
+    }
+    return chunk != CHUNK_NONE;
+}
+
+int movie_player::open(const fs::path& path)
+{
+    if (file) {
+        std::fclose(file);
+    }
+    chunk = CHUNK_NONE;
+    total_frames = 0;
+    file = std::fopen(path.string().c_str(), "rb");
+    if (!file) {
+        logERROR("Could not open %s", path.string().c_str());
+        return -1;
+    }
+    if (!state) {
+        state = std::make_unique<unsigned char[]>(MACHINE_SAVE_SIZE);
+        scratch = std::make_unique<unsigned char[]>(MACHINE_SAVE_SIZE);
+    }
+    index.clear();
+    frame = 0;
+    desyncs = 0;
+
+    unsigned char header[HEADER_SIZE];
+    if (!read(header, sizeof(header)) || std::memcmp(header, MOVIE_MAGIC, 4) != 0) {
+        logERROR("%s is not a movie", path.string().c_str());
+        return -1;
+    }
+    if (get_le(header + 4, 4) != MOVIE_VERSION || get_le(header + 12, 4) != MACHINE_SAVE_SIZE) {
+        logERROR("%s is from another version", path.string().c_str());
+        return -1;
+    }
+    keyframe_every = uint32_t(get_le(header + 8, 4));
+
+    // The index at the end, if the movie was closed.
+    unsigned char trailer[TRAILER_SIZE];
+    unsigned char end[1 + 8 + 4];
+    if (std::fseek(file, -TRAILER_SIZE, SEEK_END) == 0 && read(trailer, sizeof(trailer)) &&
+        std::memcmp(trailer + 8, TRAILER_MAGIC, 4) == 0 &&
+        std::fseek(file, long(get_le(trailer, 8)), SEEK_SET) == 0 &&
+        read(end, sizeof(end)) && end[0] == CHUNK_TAG_END)
+    {
+        total_frames = get_le(end + 1, 8);
+        // each keyframe takes up more than a state
+        uint64_t num_keys = get_le(end + 9, 4);
+        if (num_keys <= get_le(trailer, 8) / MACHINE_SAVE_SIZE) {
+            unsigned char entry[16];
+            for (uint64_t i = 0; i < num_keys && read(entry, sizeof(entry)); ++i) {
+                index.push_back(get_le(entry, 8));
+                index.push_back(get_le(entry + 8, 8));
+            }
+            if (index.size() != 2 * num_keys) {
+                index.clear();
+            }
+        }
+    }
+    // Else rebuild it, up to where the movie was cut off.
+    if (index.empty())
+    {
+        std::fseek(file, HEADER_SIZE, SEEK_SET);
+        chunk_frame = 0;
+        total_frames = 0;
+        for (long pos = std::ftell(file); read_chunk(); pos = std::ftell(file))
+        {
+            if (chunk == CHUNK_KEY) {
+                index.push_back(chunk_frame);
+                index.push_back(uint64_t(pos));
+            }
+            total_frames = chunk_frame + 1;
+        }
+        if (!index.empty()) {
+            logWARNING("%s was not closed, playing its first %llu frames",
+                path.string().c_str(), (unsigned long long)total_frames);
+        }
+    }
+    if (index.empty() || index[0] != 0 || keyframe_every == 0) {
+        logERROR("%s is corrupt", path.string().c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int movie_player::seek(machine& m, std::uint64_t f)
+{
+    if (!file || f > total_frames) {
+        logERROR("Can't seek to frame %llu of the movie", (unsigned long long)f);
+        return -1;
+    }
+    // Keyframes are keyframe_every apart, unless it was cut off.
+    std::size_t num_keys = index.size() / 2;
+    std::size_t k = std::size_t(std::min<uint64_t>(f / keyframe_every, num_keys - 1));
+    while (k > 0 && index[2 * k] > f) {
+        k--;
+    }
+    if (std::fseek(file, long(index[2 * k + 1]), SEEK_SET) != 0 || !read_chunk() ||
+        chunk != CHUNK_KEY || chunk_frame != index[2 * k]) {
+        logERROR("Movie is corrupt at frame %llu", (unsigned long long)index[2 * k]);
+        return -1;
+    }
+    bool muted = m.mute_sound;
+    m.mute_sound = true;
+    if (m.load_state(state.get(), MACHINE_SAVE_SIZE) != 0) {
+        m.mute_sound = muted;
+        return -1;
+    }
+    frame = chunk_frame;
+    read_chunk();
+    while (frame < f) {
+        if (!step(m)) { // strict and it differs
+            m.mute_sound = muted;
+            return -1;
+        }
+    }
+    apply_inputs(m);
+    m.mute_sound = muted;
+    return 0;
+}
+
+bool movie_player::step(machine& m)
+{
+    if (frame >= total_frames) {
+        return false;
+    }
+    apply_inputs(m);
+    if (strict && desyncs != 0) {
+        return false;
+    }
+    m.run_frame();
+    frame++;
+    return true;
+}
+
+// Apply the chunks up to and including frame.
+void movie_player::apply_inputs(machine& m)
+{
+    for (; chunk != CHUNK_NONE && chunk_frame <= frame; read_chunk())
+    {
+        if (chunk == CHUNK_INPUT) {
+            if (chunk_mask & 0x1) { m.in_port0 = chunk_ports[0]; }
+            if (chunk_mask & 0x2) { m.in_port1 = chunk_ports[1]; }
+            if (chunk_mask & 0x4) { m.in_port2 = chunk_ports[2]; }
+            continue;
+        }
+        // the keyframe has this frame's inputs
+        const unsigned char* ports = &state[MACHINE_SAVE_INPUTS_OFFSET];
+        m.in_port0 = ports[0];
+        m.in_port1 = ports[1];
+        m.in_port2 = ports[2];
+        m.save_state(scratch.get(), MACHINE_SAVE_SIZE);
+        if (std::memcmp(scratch.get(), state.get(), MACHINE_SAVE_SIZE) != 0) {
+            if (desyncs++ == 0 && !strict) {
+                logWARNING("Movie playback differs from the recording at frame %llu",
+                    (unsigned long long)frame);
+            }
+            if (strict) {
+                return;
+            }
+            m.load_state(state.get(), MACHINE_SAVE_SIZE);
+        }
+    }
+}
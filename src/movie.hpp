@@ -0,0 +1,152 @@
+//
+// Input movies: a recording of a game that plays back exactly.
+//
+// A movie is a starting state followed by every change to the input
+// ports (in_port0-2, which hold the DIP switches too), each tagged
+// with the frame it applied to. A whole saved state (a keyframe) is
+// also stored every keyframe_every frames, and an index of them is
+// written at the end, so playback can seek to any frame by loading
+// the keyframe before it and running at most keyframe_every - 1
+// frames. Machines are deterministic, so this gives back the same
+// frames that were recorded.
+//
+// File layout, little-endian:
+//
+//     header   "SIMV", u32 version, u32 keyframe_every, u32 state size
+//     chunks   'K' u64 frame, saved state (see machine::save_state())
+//              'I' varint frames since the last chunk, u8 mask of
+//                  ports that changed (bit n is in_port<n>), their values
+//     end      'E' u64 frames, u32 keyframes, (u64 frame, u64 offset)
+//                  for each keyframe
+//     trailer  u64 offset of 'E', "SIMX"
+//
+// A keyframe holds the inputs of its frame, so it is never followed
+// by an 'I' for the same frame. The first chunk is the keyframe for
+// frame 0. Movies are written as they are recorded, if one was never
+// closed (eg. after a crash), its index is rebuilt when it is opened.
+//
+// Example usage:
+//
+//     movie_recorder rec;
+//     rec.open("game.movie");
+//     while (playing) {
+//         set_inputs(m);
+//         rec.frame(m);
+//         m.run_frame();
+//     }
+//     rec.close();
+//
+//     movie_player player;
+//     player.open("game.movie");
+//     player.seek(m, 3600);
+//     while (player.step(m)) {}
+//
+
+#ifndef MOVIE_HPP
+#define MOVIE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "machine.hpp"
+
+#define MOVIE_VERSION 1
+// 10 seconds at 60 fps: a seek runs at most that much, ~10 ms.
+#define MOVIE_DEFAULT_KEYFRAME_EVERY 600
+
+struct movie_recorder
+{
+    movie_recorder() = default;
+    ~movie_recorder();
+
+    movie_recorder(const movie_recorder&) = delete;
+    movie_recorder& operator=(const movie_recorder&) = delete;
+
+    // Start a movie at path, replacing any file there.
+    // Returns 0 on success, -1 on error.
+    int open(const fs::path& path, std::uint32_t keyframe_every = MOVIE_DEFAULT_KEYFRAME_EVERY);
+
+    // Record the next frame, starting from m's state: call right before
+    // every m.run_frame(), once its inputs are set. The first call
+    // stores the starting state.
+    void frame(const machine& m);
+
+    // Write the index and close the file. Returns -1 if anything
+    // could not be written.
+    int close();
+
+    bool is_open() const { return file != nullptr; }
+
+    std::uint64_t frames = 0; // recorded so far
+    std::uint64_t keyframes = 0;
+    std::uint64_t input_changes = 0;
+
+private:
+    void write(const void* data, std::size_t size);
+
+    std::FILE* file = nullptr;
+    std::uint64_t offset = 0; // bytes written
+    std::uint32_t keyframe_every = 0;
+    std::uint64_t last_chunk_frame = 0;
+    i8080_word_t last_ports[3] = {};
+    std::vector<std::uint64_t> index; // frame, offset of each keyframe
+    std::unique_ptr<unsigned char[]> state;
+};
+
+struct movie_player
+{
+    movie_player() = default;
+    ~movie_player();
+
+    movie_player(const movie_player&) = delete;
+    movie_player& operator=(const movie_player&) = delete;
+
+    // Open a movie, reading its index. Call seek() next. A player
+    // can open one movie after another, reusing its buffers.
+    // Returns 0 on success, -1 on error.
+    int open(const fs::path& path);
+
+    // Frames in the movie.
+    std::uint64_t num_frames() const { return total_frames; }
+
+    // Put m in its state from right before frame f (num_frames() for
+    // the end), with the inputs for f set. The frames run to get there
+    // are muted. Returns -1 on error, leaving m as it was if the
+    // keyframe can't be read.
+    int seek(machine& m, std::uint64_t f);
+
+    // Set m's inputs for the next frame and run it. Returns false,
+    // without running anything, at the end of the movie.
+    //
+    // Keyframes played past are compared with m. If one differs, it
+    // is counted in desyncs and loaded, so playback carries on from
+    // what was recorded. Unless strict is set, then playback stops
+    // there instead, since the movie doesn't reproduce.
+    bool step(machine& m);
+
+    std::uint64_t frame = 0; // next frame to run
+    std::uint64_t desyncs = 0;
+    std::uint32_t keyframe_every = 0;
+    bool strict = false;
+
+private:
+    bool read(void* data, std::size_t size);
+    bool read_chunk();
+    void apply_inputs(machine& m);
+
+    std::FILE* file = nullptr;
+    std::uint64_t total_frames = 0;
+    std::vector<std::uint64_t> index; // frame, offset of each keyframe
+
+    // The next chunk, or none at the end.
+    enum { CHUNK_NONE, CHUNK_KEY, CHUNK_INPUT } chunk = CHUNK_NONE;
+    std::uint64_t chunk_frame = 0;
+    unsigned chunk_mask = 0;
+    i8080_word_t chunk_ports[3] = {};
+    std::unique_ptr<unsigned char[]> state; // of a CHUNK_KEY
+    std::unique_ptr<unsigned char[]> scratch;
+};
+
+#endif
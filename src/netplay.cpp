@@ -0,0 +1,421 @@
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "netplay.hpp"
+
+#ifdef _WIN32
+using socket_t = SOCKET;
+#define close_socket closesocket
+#else
+using socket_t = int;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#endif
+
+// Packets start with a magic, a version and a type.
+//
+// HELLO: player, input delay, in_port0, in_port2 (DIP switches).
+// Sent until the peer's inputs arrive.
+//
+// INPUTS: ack, start, count, count inputs. The sender's inputs
+// from frame start on, and ack is how many of the receiver's it has.
+// Every packet repeats every input the peer hasn't acked (up to
+// MAX_INPUTS_PER_PACKET), so lost packets need no resending.
+#define PACKET_MAGIC "SINP"
+#define PACKET_VERSION 1
+#define PACKET_HELLO 1
+#define PACKET_INPUTS 2
+#define HEADER_SIZE 6
+#define HELLO_SIZE (HEADER_SIZE + 4)
+#define INPUTS_HEADER_SIZE (HEADER_SIZE + 9)
+#define MAX_INPUTS_PER_PACKET 64
+
+// DIP switch bits of in_port0 and in_port2, see emu::set_switch().
+#define PORT0_DIP_MASK 0x01
+#define PORT2_DIP_MASK 0x8b
+
+static_assert(MAX_INPUTS_PER_PACKET + 2 * (NETPLAY_MAX_ROLLBACK + NETPLAY_MAX_INPUT_DELAY)
+    < NETPLAY_RING_SIZE, "netplay ring too small");
+
+struct netplay::udp_socket
+{
+    socket_t fd = INVALID_SOCKET;
+    sockaddr_in peer{};
+#ifdef _WIN32
+    bool wsa_started = false;
+#endif
+
+    ~udp_socket()
+    {
+        if (fd != INVALID_SOCKET) {
+            close_socket(fd);
+        }
+#ifdef _WIN32
+        if (wsa_started) {
+            WSACleanup();
+        }
+#endif
+    }
+
+    int open(std::uint16_t local_port, const std::string& peer_host, std::uint16_t peer_port)
+    {
+#ifdef _WIN32
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+            logERROR("WSAStartup() failed");
+            return -1;
+        }
+        wsa_started = true;
+#endif
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* res = nullptr;
+        std::string port_str = std::to_string(peer_port);
+        if (getaddrinfo(peer_host.c_str(), port_str.c_str(), &hints, &res) != 0 || !res) {
+            logERROR("Netplay: could not resolve %s", peer_host.c_str());
+            return -1;
+        }
+        std::memcpy(&peer, res->ai_addr, sizeof(peer));
+        freeaddrinfo(res);
+
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd == INVALID_SOCKET) {
+            logERROR("Netplay: could not create socket");
+            return -1;
+        }
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        local.sin_port = htons(local_port);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+            logERROR("Netplay: could not bind to port %u", unsigned(local_port));
+            return -1;
+        }
+#ifdef _WIN32
+        u_long nonblocking = 1;
+        if (ioctlsocket(fd, FIONBIO, &nonblocking) != 0) {
+#else
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != 0) {
+#endif
+            logERROR("Netplay: could not make socket non-blocking");
+            return -1;
+        }
+        return 0;
+    }
+
+    void send(const unsigned char* buf, std::size_t size)
+    {
+        // a failed send is a lost packet
+        sendto(fd, reinterpret_cast<const char*>(buf), int(size), 0,
+            reinterpret_cast<const sockaddr*>(&peer), sizeof(peer));
+    }
+
+    // Returns the size of the next packet from the peer, or -1 if none.
+    int receive(unsigned char* buf, std::size_t size)
+    {
+        for (;;)
+        {
+            sockaddr_in from{};
+            socklen_t from_len = sizeof(from);
+            int n = int(recvfrom(fd, reinterpret_cast<char*>(buf), int(size), 0,
+                reinterpret_cast<sockaddr*>(&from), &from_len));
+            if (n < 0) {
+                return -1;
+            }
+            if (from.sin_addr.s_addr == peer.sin_addr.s_addr && from.sin_port == peer.sin_port) {
+                return n;
+            }
+        }
+    }
+};
+
+static inline void put_u32(unsigned char* p, std::uint64_t val)
+{
+    p[0] = (unsigned char)val; p[1] = (unsigned char)(val >> 8);
+    p[2] = (unsigned char)(val >> 16); p[3] = (unsigned char)(val >> 24);
+}
+
+static inline std::uint32_t get_u32(const unsigned char* p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | std::uint32_t(p[3]) << 24;
+}
+
+static inline unsigned char* put_header(unsigned char* p, int type)
+{
+    std::memcpy(p, PACKET_MAGIC, 4);
+    p[4] = PACKET_VERSION;
+    p[5] = (unsigned char)type;
+    return p + HEADER_SIZE;
+}
+
+netplay::netplay() = default;
+netplay::~netplay() = default;
+
+int netplay::start(const netplay_config& cfg, machine& m)
+{
+    if (cfg.player != 1 && cfg.player != 2) {
+        logERROR("Netplay: player must be 1 or 2");
+        return -1;
+    }
+    config = cfg;
+    config.input_delay = std::clamp(config.input_delay, 0, NETPLAY_MAX_INPUT_DELAY);
+
+    sock = std::make_unique<udp_socket>();
+    if (sock->open(config.local_port, config.peer_host, config.peer_port) != 0) {
+        sock.reset();
+        return -1;
+    }
+    states = std::make_unique<unsigned char[]>(std::size_t(MACHINE_SAVE_SIZE) * (NETPLAY_MAX_ROLLBACK + 1));
+    rng.seed(unsigned(config.player));
+
+    connected = peer_connected = false;
+    frame = remote_end = local_end = peer_ack = rollback_to = 0;
+    std::fill(std::begin(local), std::end(local), 0);
+    std::fill(std::begin(remote), std::end(remote), 0);
+    std::fill(std::begin(remote_used), std::end(remote_used), 0);
+    delayed.clear();
+
+    logMESSAGE("Netplay: player %d on port %u, waiting for %s:%u", config.player,
+        unsigned(config.local_port), config.peer_host.c_str(), unsigned(config.peer_port));
+    poll(m);
+    return 0;
+}
+
+std::uint64_t netplay::confirmed_frames() const
+{
+    return std::min({ frame, remote_end, rollback_to });
+}
+
+netplay_input netplay::input(int p, std::uint64_t f) const
+{
+    return p == config.player ? local[f % NETPLAY_RING_SIZE] : remote_used[f % NETPLAY_RING_SIZE];
+}
+
+bool netplay::frame_hash(machine& m, std::uint64_t f, std::uint64_t& hash) const
+{
+    // as saved before running frame f + 1, or m if it hasn't yet
+    std::size_t num_states = NETPLAY_MAX_ROLLBACK + 1;
+    if (f + 1 == frame) {
+        hash = machine_hash(m);
+        return true;
+    }
+    if (f + 1 > frame || frame - (f + 1) >= num_states) {
+        return false;
+    }
+    hash = machine_hash(&states[((f + 1) % num_states) * MACHINE_SAVE_SIZE]);
+    return true;
+}
+
+// Set the input ports for frame f, guessing the remote inputs if
+// they aren't known yet. Player 2 shares port 1 for credit/start.
+void netplay::set_ports(machine& m, std::uint64_t f)
+{
+    netplay_input mine = local[f % NETPLAY_RING_SIZE];
+    netplay_input theirs = 0;
+    if (f < remote_end) {
+        theirs = remote[f % NETPLAY_RING_SIZE];
+    }
+    else if (remote_end > 0) {
+        theirs = remote[(remote_end - 1) % NETPLAY_RING_SIZE];
+    }
+    remote_used[f % NETPLAY_RING_SIZE] = theirs;
+
+    netplay_input p1 = config.player == 1 ? mine : theirs;
+    netplay_input p2 = config.player == 1 ? theirs : mine;
+    m.in_port1 = i8080_word_t(0x08 | (p1 & NETPLAY_INPUT_MASK) | (p2 & 0x07));
+    m.in_port2 = i8080_word_t((m.in_port2 & ~0x70) | (p2 & 0x70));
+}
+
+void netplay::handle_packet(machine& m, const unsigned char* buf, std::size_t size)
+{
+    if (size < HEADER_SIZE || std::memcmp(buf, PACKET_MAGIC, 4) != 0 || buf[4] != PACKET_VERSION) {
+        return;
+    }
+    const unsigned char* p = buf + HEADER_SIZE;
+
+    if (buf[5] == PACKET_HELLO && size >= HELLO_SIZE && !connected)
+    {
+        if (p[0] == config.player) {
+            logERROR("Netplay: both hosts are player %d", config.player);
+            return;
+        }
+        if (config.player == 2) {
+            // player 1's settings
+            config.input_delay = std::min<int>(p[1], NETPLAY_MAX_INPUT_DELAY);
+            m.in_port0 = i8080_word_t((m.in_port0 & ~PORT0_DIP_MASK) | (p[2] & PORT0_DIP_MASK));
+            m.in_port2 = i8080_word_t((m.in_port2 & ~PORT2_DIP_MASK) | (p[3] & PORT2_DIP_MASK));
+        }
+        // the first frames have no inputs
+        local_end = remote_end = config.input_delay;
+        connected = true;
+        logMESSAGE("Netplay: connected to player %d, %d frames input delay",
+            int(p[0]), config.input_delay);
+    }
+    else if (buf[5] == PACKET_INPUTS && size >= INPUTS_HEADER_SIZE && connected)
+    {
+        peer_connected = true;
+        peer_ack = std::max<std::uint64_t>(peer_ack, std::min<std::uint64_t>(get_u32(p), local_end));
+        std::uint64_t start = get_u32(p + 4);
+        std::size_t count = std::min<std::size_t>(p[8], size - INPUTS_HEADER_SIZE);
+        const unsigned char* inputs = p + 9;
+
+        // only take the next ones in order, later ones come again
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::uint64_t f = start + i;
+            if (f < remote_end) { continue; }
+            if (f > remote_end || f >= frame + NETPLAY_RING_SIZE / 2) { break; }
+
+            netplay_input in = inputs[i] & NETPLAY_INPUT_MASK;
+            remote[f % NETPLAY_RING_SIZE] = in;
+            if (f < frame && remote_used[f % NETPLAY_RING_SIZE] != in) {
+                rollback_to = std::min(rollback_to, f);
+            }
+            remote_end++;
+        }
+    }
+}
+
+void netplay::receive(machine& m)
+{
+    unsigned char buf[512];
+    int n;
+    while ((n = sock->receive(buf, sizeof(buf))) >= 0) {
+        packets_received++;
+        handle_packet(m, buf, std::size_t(n));
+    }
+}
+
+// Go back to the first frame run with a wrong guess, and run the
+// frames since then again.
+void netplay::rollback(machine& m)
+{
+    if (rollback_to >= frame) {
+        return;
+    }
+    bool was_muted = m.mute_sound;
+    m.mute_sound = true;
+
+    std::size_t num_states = NETPLAY_MAX_ROLLBACK + 1;
+    m.load_state(&states[(rollback_to % num_states) * MACHINE_SAVE_SIZE], MACHINE_SAVE_SIZE);
+    for (std::uint64_t f = rollback_to; f < frame; ++f)
+    {
+        m.save_state(&states[(f % num_states) * MACHINE_SAVE_SIZE], MACHINE_SAVE_SIZE);
+        set_ports(m, f);
+        m.run_frame();
+    }
+    m.mute_sound = was_muted;
+
+    rollbacks++;
+    frames_rerun += frame - rollback_to;
+    rollback_to = frame;
+}
+
+void netplay::send(const unsigned char* buf, std::size_t size)
+{
+    if (config.send_loss > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < config.send_loss) {
+        packets_dropped++;
+        return;
+    }
+    if (config.send_latency_ms > 0) {
+        int ms = config.send_latency_ms + std::uniform_int_distribution<int>(0, config.send_latency_ms)(rng);
+        delayed.push_back({ clk::now() + tim::milliseconds(ms), std::vector<unsigned char>(buf, buf + size) });
+        return;
+    }
+    sock->send(buf, size);
+    packets_sent++;
+}
+
+void netplay::flush_sends()
+{
+    clk::time_point now = clk::now();
+    auto due = std::stable_partition(delayed.begin(), delayed.end(),
+        [now](const delayed_packet& pkt) { return pkt.due <= now; });
+    for (auto it = delayed.begin(); it != due; ++it) {
+        sock->send(it->data.data(), it->data.size());
+        packets_sent++;
+    }
+    delayed.erase(delayed.begin(), due);
+}
+
+void netplay::send_packets(const machine& m)
+{
+    unsigned char buf[INPUTS_HEADER_SIZE + MAX_INPUTS_PER_PACKET];
+    if (!peer_connected)
+    {
+        unsigned char* p = put_header(buf, PACKET_HELLO);
+        p[0] = (unsigned char)config.player;
+        p[1] = (unsigned char)config.input_delay;
+        p[2] = m.in_port0 & PORT0_DIP_MASK;
+        p[3] = m.in_port2 & PORT2_DIP_MASK;
+        send(buf, HELLO_SIZE);
+    }
+    if (connected)
+    {
+        std::uint64_t start = std::max(peer_ack, local_end > MAX_INPUTS_PER_PACKET ?
+            local_end - MAX_INPUTS_PER_PACKET : 0);
+        std::size_t count = std::size_t(local_end - start);
+
+        unsigned char* p = put_header(buf, PACKET_INPUTS);
+        put_u32(p, remote_end);
+        put_u32(p + 4, start);
+        p[8] = (unsigned char)count;
+        for (std::size_t i = 0; i < count; ++i) {
+            p[9 + i] = local[(start + i) % NETPLAY_RING_SIZE];
+        }
+        send(buf, INPUTS_HEADER_SIZE + count);
+    }
+    flush_sends();
+}
+
+void netplay::poll(machine& m)
+{
+    if (!sock) {
+        return;
+    }
+    receive(m);
+    rollback(m);
+    send_packets(m);
+}
+
+bool netplay::advance(machine& m, netplay_input local_input)
+{
+    if (!sock) {
+        return false;
+    }
+    receive(m);
+    rollback(m);
+
+    if (!connected || frame >= remote_end + NETPLAY_MAX_ROLLBACK) {
+        waits++;
+        send_packets(m);
+        return false;
+    }
+    local[local_end % NETPLAY_RING_SIZE] = local_input & NETPLAY_INPUT_MASK;
+    local_end++;
+
+    std::size_t num_states = NETPLAY_MAX_ROLLBACK + 1;
+    m.save_state(&states[(frame % num_states) * MACHINE_SAVE_SIZE], MACHINE_SAVE_SIZE);
+    set_ports(m, frame);
+    m.run_frame();
+    frame++;
+    rollback_to = frame;
+
+    send_packets(m);
+    return true;
+}
@@ -0,0 +1,159 @@
+//
+// Two-player netplay over UDP, with rollback.
+//
+// Each host runs the whole machine. Every frame, each one sends its
+// own player's inputs to the other. Frames whose remote inputs haven't
+// arrived yet are run with a guess, the last remote inputs that did
+// arrive. When the real ones turn out to be different, the machine
+// goes back to the state saved before the first wrong frame and runs
+// the frames since then again, muted, with what is now known (as in
+// GGPO). If the remote inputs fall more than NETPLAY_MAX_ROLLBACK
+// frames behind, advance() waits for them instead.
+//
+// Both machines must start out the same: call start() right after
+// machine::init() on both hosts. Player 1's DIP switches and input
+// delay are used by both.
+//
+// For testing on one host, packets can be delayed and dropped at
+// random on the way out, see netplay_config and src/nettest.cpp.
+//
+// Example usage:
+//
+//     netplay net;
+//     net.start(cfg, m);
+//     while (running) {
+//         if (net.advance(m, my_inputs)) {
+//             draw(m);
+//         }
+//         wait_for_next_frame();
+//     }
+//
+
+#ifndef NETPLAY_HPP
+#define NETPLAY_HPP
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "machine.hpp"
+
+// Frames that can be run ahead of the remote inputs.
+#define NETPLAY_MAX_ROLLBACK 8
+#define NETPLAY_MAX_INPUT_DELAY 8
+#define NETPLAY_DEFAULT_PORT 7000
+
+// Inputs kept per player, enough for every frame
+// between the two hosts and the rollback window.
+#define NETPLAY_RING_SIZE 128
+
+// Inputs of one player for one frame, laid out as in_port1:
+// bit 0 credit, 1 2P start, 2 1P start, 4 fire, 5 left, 6 right.
+using netplay_input = std::uint8_t;
+
+#define NETPLAY_INPUT_MASK 0x77
+
+struct netplay_config
+{
+    int player = 1; // local player, 1 or 2
+    std::uint16_t local_port = NETPLAY_DEFAULT_PORT;
+    std::string peer_host = "127.0.0.1";
+    std::uint16_t peer_port = NETPLAY_DEFAULT_PORT;
+
+    // Frames local inputs are held back by, so they reach the peer
+    // in time more often. At most NETPLAY_MAX_INPUT_DELAY, player
+    // 1's is used.
+    int input_delay = 1;
+
+    // For testing: delay every packet sent by this many ms
+    // (plus up to as much again at random), and drop this
+    // fraction of them.
+    int send_latency_ms = 0;
+    double send_loss = 0;
+};
+
+struct netplay
+{
+    netplay();
+    ~netplay();
+
+    // Open the socket and start looking for the peer.
+    // Returns 0 on success, -1 on error.
+    int start(const netplay_config& config, machine& m);
+
+    // Handle packets from the peer (rolling back if they correct
+    // a guess), then run the next frame with local_input, unless
+    // the peer is too far behind. Returns true if a frame was run.
+    bool advance(machine& m, netplay_input local_input);
+
+    // Handle packets from the peer and resend local inputs, without
+    // running a new frame. For waiting until frames are confirmed.
+    void poll(machine& m);
+
+    // All frames before this were run with both players' real inputs.
+    std::uint64_t confirmed_frames() const;
+
+    // Inputs frame was (last) run with, for the last 
+    // NETPLAY_MAX_ROLLBACK frames or so. player is 1 or 2.
+    netplay_input input(int player, std::uint64_t frame) const;
+
+    // machine_hash() of m as it was after running frame, for the
+    // last NETPLAY_MAX_ROLLBACK frames or so. m is the machine
+    // advance() runs. Returns false if frame isn't kept (anymore).
+    bool frame_hash(machine& m, std::uint64_t frame, std::uint64_t& hash) const;
+
+    netplay_config config;
+
+    bool connected = false; // got the peer's hello
+    std::uint64_t frame = 0; // frames run so far
+
+    std::uint64_t rollbacks = 0;
+    std::uint64_t frames_rerun = 0;
+    std::uint64_t waits = 0;           // advance() calls that waited
+    std::uint64_t packets_sent = 0;
+    std::uint64_t packets_dropped = 0; // by send_loss
+    std::uint64_t packets_received = 0;
+
+private:
+    void receive(machine& m);
+    void handle_packet(machine& m, const unsigned char* buf, std::size_t size);
+    void send_packets(const machine& m);
+    void send(const unsigned char* buf, std::size_t size);
+    void flush_sends();
+    void set_ports(machine& m, std::uint64_t frame);
+    void rollback(machine& m);
+
+    struct udp_socket;
+    std::unique_ptr<udp_socket> sock;
+
+    bool peer_connected = false; // got the peer's inputs, so it has our hello
+
+    // Remote inputs are known for frames before remote_end,
+    // local ones before local_end (frame + input delay).
+    std::uint64_t remote_end = 0;
+    std::uint64_t local_end = 0;
+    // Local inputs the peer has, as of its last packet.
+    std::uint64_t peer_ack = 0;
+    // First frame that was run with a wrong guess, or frame.
+    std::uint64_t rollback_to = 0;
+
+    // Rings, by frame.
+    netplay_input local[NETPLAY_RING_SIZE];
+    netplay_input remote[NETPLAY_RING_SIZE];
+    netplay_input remote_used[NETPLAY_RING_SIZE]; // real or guessed, as last run
+    // Saved before each of the last NETPLAY_MAX_ROLLBACK + 1 frames.
+    std::unique_ptr<unsigned char[]> states;
+
+    // Packets held back by send_latency_ms.
+    struct delayed_packet
+    {
+        clk::time_point due;
+        std::vector<unsigned char> data;
+    };
+    std::vector<delayed_packet> delayed;
+    std::mt19937 rng;
+};
+
+#endif
@@ -0,0 +1,164 @@
+//
+// Netplay test, one process per player.
+//
+// Both players play a scripted game over netplay at 60 fps: player 1
+// inserts two coins and starts a two-player game, then both move and
+// fire at random. Packets can be delayed and dropped on the way out.
+// Once every frame is confirmed, the machine is checked against one
+// that ran the same frames offline with the real inputs, and the hash
+// of its state is printed. Both processes should print the same hash.
+//
+// usage: spaceinvaders-nettest <asset-dir> <player> <local-port> <peer-port>
+//            [frames] [latency-ms] [loss-percent] [input-delay]
+//
+// eg. on 127.0.0.1, with 30-60 ms latency and 10% loss each way:
+//
+//     spaceinvaders-nettest assets 1 7001 7002 1800 30 10 &
+//     spaceinvaders-nettest assets 2 7002 7001 1800 30 10
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "netplay.hpp"
+
+#define DEFAULT_FRAMES 1800
+#define FRAME_TIME tim::microseconds(16667)
+#define CONNECT_TIMEOUT tim::seconds(10)
+#define CONFIRM_TIMEOUT tim::seconds(10)
+// Keep answering the peer for a while after finishing,
+// it may still be waiting for inputs or acks.
+#define LINGER_TIME tim::seconds(1)
+
+static netplay_input script_input(int player, uint64_t frame)
+{
+    netplay_input in = 0;
+    if (player == 1) {
+        if ((frame >= 60 && frame < 65) || (frame >= 80 && frame < 85)) {
+            in |= 0x01; // credit
+        }
+        if (frame >= 200 && frame < 205) {
+            in |= 0x02; // 2P start
+        }
+    }
+    if (frame >= 260) {
+        uint64_t x = (uint64_t(player) << 32 | frame / 8) * 0x9e3779b97f4a7c15ull;
+        in |= netplay_input((x >> 59) & 0x30) | netplay_input((x >> 55) & 0x40); // fire, left, right
+    }
+    return in;
+}
+
+// What netplay should have run frame with, see netplay::advance().
+static netplay_input real_input(int player, uint64_t frame, int input_delay)
+{
+    return frame >= uint64_t(input_delay) ? script_input(player, frame - input_delay) : 0;
+}
+
+static uint64_t state_hash(const std::vector<unsigned char>& state)
+{
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+    for (unsigned char c : state) {
+        hash = (hash ^ c) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static void poll_for(netplay& net, machine& m, clk::duration time)
+{
+    clk::time_point end = clk::now() + time;
+    while (clk::now() < end) {
+        net.poll(m);
+        std::this_thread::sleep_for(tim::milliseconds(2));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 5) {
+        std::printf("usage: spaceinvaders-nettest <asset-dir> <player> <local-port> <peer-port> "
+            "[frames] [latency-ms] [loss-percent] [input-delay]\n");
+        return 1;
+    }
+    const char* assetdir = argv[1];
+    netplay_config cfg;
+    cfg.player = std::atoi(argv[2]);
+    cfg.local_port = uint16_t(std::atoi(argv[3]));
+    cfg.peer_port = uint16_t(std::atoi(argv[4]));
+    uint64_t num_frames = argc > 5 ? std::strtoull(argv[5], nullptr, 10) : DEFAULT_FRAMES;
+    cfg.send_latency_ms = argc > 6 ? std::atoi(argv[6]) : 0;
+    cfg.send_loss = argc > 7 ? std::atof(argv[7]) / 100 : 0;
+    cfg.input_delay = argc > 8 ? std::atoi(argv[8]) : 1;
+
+    auto m = std::make_unique<machine>();
+    netplay net;
+    if (m->init(assetdir) != 0 || net.start(cfg, *m) != 0) {
+        return 1;
+    }
+
+    clk::time_point t_start = clk::now();
+    while (!net.connected) {
+        if (clk::now() - t_start > CONNECT_TIMEOUT) {
+            std::printf("Error: no reply from peer\n");
+            return 1;
+        }
+        poll_for(net, *m, tim::milliseconds(10));
+    }
+
+    // 60 fps, like the frontend
+    clk::duration max_advance{};
+    clk::time_point next_frame = clk::now();
+    while (net.frame < num_frames)
+    {
+        clk::time_point t = clk::now();
+        net.advance(*m, script_input(cfg.player, net.frame));
+        max_advance = std::max(max_advance, clk::now() - t);
+
+        next_frame += FRAME_TIME;
+        std::this_thread::sleep_until(next_frame);
+    }
+
+    t_start = clk::now();
+    while (net.confirmed_frames() < num_frames) {
+        if (clk::now() - t_start > CONFIRM_TIMEOUT) {
+            std::printf("Error: only %llu of %llu frames confirmed\n",
+                (unsigned long long)net.confirmed_frames(), (unsigned long long)num_frames);
+            return 1;
+        }
+        poll_for(net, *m, tim::milliseconds(10));
+    }
+    poll_for(net, *m, LINGER_TIME);
+
+    std::printf("player %d: %llu frames, %llu rollbacks (%llu frames run again), %llu waits, "
+        "slowest frame %.2f ms\n", cfg.player, (unsigned long long)net.frame,
+        (unsigned long long)net.rollbacks, (unsigned long long)net.frames_rerun,
+        (unsigned long long)net.waits, tim::duration<double, std::milli>(max_advance).count());
+    std::printf("player %d: %llu packets sent, %llu dropped, %llu received\n", cfg.player,
+        (unsigned long long)net.packets_sent, (unsigned long long)net.packets_dropped,
+        (unsigned long long)net.packets_received);
+
+    // Offline, with the inputs both players really had.
+    auto m_offline = std::make_unique<machine>();
+    if (m_offline->init(assetdir) != 0) {
+        return 1;
+    }
+    for (uint64_t f = 0; f < num_frames; ++f) {
+        netplay_input p1 = real_input(1, f, net.config.input_delay);
+        netplay_input p2 = real_input(2, f, net.config.input_delay);
+        m_offline->in_port1 = i8080_word_t(0x08 | p1 | (p2 & 0x07));
+        m_offline->in_port2 = i8080_word_t((m_offline->in_port2 & ~0x70) | (p2 & 0x70));
+        m_offline->run_frame();
+    }
+    std::vector<unsigned char> state(MACHINE_SAVE_SIZE), offline(MACHINE_SAVE_SIZE);
+    m->save_state(state.data(), state.size());
+    m_offline->save_state(offline.data(), offline.size());
+    if (state != offline) {
+        std::printf("Error: player %d differs from an offline run of the same inputs!\n", cfg.player);
+        return 1;
+    }
+    std::printf("player %d: matches offline run, state hash %016llx\n",
+        cfg.player, (unsigned long long)state_hash(state));
+    return 0;
+}
@@ -0,0 +1,213 @@
+
+#include <cstring>
+
+#include "rewind.hpp"
+
+// Saved states are compared and encoded 8 bytes at a time,
+// the scratch buffers are padded with zeros to a whole word.
+#define STATE_WORDS ((MACHINE_SAVE_SIZE + 7) / 8)
+
+// A delta is a list of runs, each [skip][count][count words]:
+// skip unchanged words, then XOR the next count words with the
+// keyframe. skip and count are 16-bit little-endian.
+#define RUN_HEADER_SIZE 4
+#define MAX_DELTA_SIZE (STATE_WORDS * (RUN_HEADER_SIZE + 8))
+
+static_assert(STATE_WORDS < 0x10000, "run lengths are 16 bits");
+
+static inline uint64_t load_word(const unsigned char* p, std::size_t i)
+{
+    uint64_t word;
+    std::memcpy(&word, p + 8 * i, 8);
+    return word;
+}
+
+static inline void store_word(unsigned char* p, std::size_t i, uint64_t word)
+{
+    std::memcpy(p + 8 * i, &word, 8);
+}
+
+int rewind_buffer::init(std::size_t frames, std::size_t size)
+{
+    if (frames < 2 || size < 2 * MACHINE_SAVE_SIZE || size > UINT32_MAX) {
+        logERROR("Rewind buffer of %zu bytes for %zu frames is too small", size, frames);
+        return -1;
+    }
+    arena = std::make_unique<unsigned char[]>(size);
+    arena_size = size;
+    index = std::make_unique<entry[]>(frames);
+    max_frames = frames;
+
+    key_state = std::make_unique<unsigned char[]>(STATE_WORDS * 8);
+    state = std::make_unique<unsigned char[]>(STATE_WORDS * 8);
+    encoded = std::make_unique<unsigned char[]>(MAX_DELTA_SIZE);
+    clear();
+    keyframes = 0;
+    deltas = 0;
+    return 0;
+}
+
+void rewind_buffer::clear()
+{
+    first_seq = end_seq = 0;
+}
+
+std::size_t rewind_buffer::bytes_used() const
+{
+    std::size_t bytes = 0;
+    for (uint64_t seq = first_seq; seq < end_seq; ++seq) {
+        bytes += at(seq).size;
+    }
+    return bytes;
+}
+
+// Encode state against key_state into encoded, returns its size.
+std::size_t rewind_buffer::encode_delta(const unsigned char* cur)
+{
+    const unsigned char* key = key_state.get();
+    unsigned char* out = encoded.get();
+    std::size_t i = 0;
+    for (;;)
+    {
+        std::size_t run_start = i;
+        while (i < STATE_WORDS && load_word(cur, i) == load_word(key, i)) {
+            ++i;
+        }
+        if (i == STATE_WORDS) {
+            break;
+        }
+        std::size_t skip = i - run_start;
+        unsigned char* header = out;
+        out += RUN_HEADER_SIZE;
+
+        std::size_t count = 0;
+        uint64_t diff;
+        while (i < STATE_WORDS && (diff = load_word(cur, i) ^ load_word(key, i)) != 0) {
+            store_word(out, count++, diff);
+            ++i;
+        }
+        out += 8 * count;
+        header[0] = (unsigned char)skip; header[1] = (unsigned char)(skip >> 8);
+        header[2] = (unsigned char)count; header[3] = (unsigned char)(count >> 8);
+    }
+    return std::size_t(out - encoded.get());
+}
+
+// Decode frame seq into out, and make its keyframe the current one.
+void rewind_buffer::decode(uint64_t seq, unsigned char* out)
+{
+    const entry& e = at(seq);
+    if (key_seq != e.key) {
+        std::memcpy(key_state.get(), &arena[at(e.key).offset], MACHINE_SAVE_SIZE);
+        key_seq = e.key;
+    }
+    std::memcpy(out, key_state.get(), STATE_WORDS * 8);
+    if (e.key == seq) {
+        return;
+    }
+    const unsigned char* p = &arena[e.offset];
+    const unsigned char* end = p + e.size;
+    std::size_t i = 0;
+    while (p < end)
+    {
+        i += p[0] | p[1] << 8;
+        std::size_t count = p[2] | p[3] << 8;
+        p += RUN_HEADER_SIZE;
+        for (std::size_t j = 0; j < count; ++j, ++i) {
+            store_word(out, i, load_word(out, i) ^ load_word(p, j));
+        }
+        p += 8 * count;
+    }
+}
+
+// Drop the oldest keyframe and the frames that depend on it.
+void rewind_buffer::drop_oldest()
+{
+    do {
+        first_seq++;
+    } while (first_seq < end_seq && at(first_seq).key != first_seq);
+}
+
+// Find room for size bytes after the newest frame,
+// dropping the oldest frames until there is.
+bool rewind_buffer::alloc(uint32_t size, uint32_t& offset)
+{
+    if (size > arena_size) {
+        return false;
+    }
+    while (first_seq != end_seq)
+    {
+        const entry& oldest = at(first_seq);
+        const entry& newest = at(end_seq - 1);
+        std::size_t head = newest.offset + newest.size;
+        if (newest.offset >= oldest.offset) {
+            // free from head to the end, and from the start to oldest
+            if (arena_size - head >= size) { offset = uint32_t(head); return true; }
+            if (oldest.offset >= size) { offset = 0; return true; }
+        }
+        else if (oldest.offset - head >= size) {
+            offset = uint32_t(head);
+            return true;
+        }
+        drop_oldest();
+    }
+    offset = 0;
+    return true;
+}
+
+void rewind_buffer::push(const machine& m)
+{
+    m.save_state(state.get(), MACHINE_SAVE_SIZE);
+
+    if (num_frames() == max_frames) {
+        drop_oldest();
+    }
+    bool have_key = key_seq >= first_seq && key_seq < end_seq;
+    bool is_key = !have_key || end_seq - key_seq >= REWIND_KEYFRAME_EVERY;
+    std::size_t size = MACHINE_SAVE_SIZE;
+    if (!is_key) {
+        size = encode_delta(state.get());
+        is_key = size >= MACHINE_SAVE_SIZE;
+    }
+
+    uint32_t offset;
+    for (;;)
+    {
+        if (!alloc(uint32_t(is_key ? MACHINE_SAVE_SIZE : size), offset)) {
+            return; // can't happen, see init()
+        }
+        // making room may have dropped the keyframe
+        if (is_key || key_seq >= first_seq) {
+            break;
+        }
+        is_key = true;
+    }
+
+    entry& e = at(end_seq);
+    e.offset = offset;
+    if (is_key) {
+        e.size = MACHINE_SAVE_SIZE;
+        e.key = end_seq;
+        std::memcpy(&arena[offset], state.get(), MACHINE_SAVE_SIZE);
+        std::memcpy(key_state.get(), state.get(), MACHINE_SAVE_SIZE);
+        key_seq = end_seq;
+        keyframes++;
+    }
+    else {
+        e.size = uint32_t(size);
+        e.key = key_seq;
+        std::memcpy(&arena[offset], encoded.get(), size);
+        deltas++;
+    }
+    end_seq++;
+}
+
+int rewind_buffer::step_back(machine& m)
+{
+    if (num_frames() < 2) {
+        return -1;
+    }
+    end_seq--;
+    decode(end_seq - 1, state.get());
+    return m.load_state(state.get(), MACHINE_SAVE_SIZE);
+}
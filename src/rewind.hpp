@@ -0,0 +1,88 @@
+
+#ifndef REWIND_HPP
+#define REWIND_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "machine.hpp"
+
+// A full state is stored at least this often, see rewind_buffer.
+#define REWIND_KEYFRAME_EVERY 60
+
+// 60 seconds at 60 fps in 16 MB.
+#define REWIND_DEFAULT_FRAMES (60 * 60)
+#define REWIND_DEFAULT_ARENA (16u << 20)
+
+// The last few seconds of a machine's states, one per frame, to step
+// back through while a key is held.
+//
+// States live in a fixed-size arena used as a ring, so memory use is
+// set up front. A keyframe is a whole saved state (see
+// machine::save_state()). Every other frame is its state XORed with the
+// last keyframe and run-length encoded: runs of unchanged 8 byte words
+// are skipped, the rest are stored. Most of RAM doesn't change from
+// one second to the next, so these are a few hundred bytes each. When
+// the arena or the frame index is full, the oldest keyframe is dropped
+// along with the frames that depend on it.
+struct rewind_buffer
+{
+    rewind_buffer() = default;
+
+    // Hold up to max_frames frames in arena_size bytes.
+    // Returns 0 on success, -1 on error.
+    int init(std::size_t max_frames, std::size_t arena_size);
+
+    // Drop every frame.
+    void clear();
+
+    // Store m's state as the newest frame. Call once after every frame.
+    void push(const machine& m);
+
+    // Drop the newest frame and load the one before it into m.
+    // Returns -1 (leaving m as is) if there is nothing to go back to.
+    int step_back(machine& m);
+
+    std::size_t num_frames() const { return std::size_t(end_seq - first_seq); }
+    std::size_t bytes_used() const;
+
+    // Frames stored whole or as deltas, since init().
+    std::uint64_t keyframes = 0;
+    std::uint64_t deltas = 0;
+
+private:
+    struct entry
+    {
+        std::uint32_t offset; // into arena
+        std::uint32_t size;
+        std::uint64_t key;    // seq of its keyframe, its own if it is one
+    };
+
+    entry& at(std::uint64_t seq) { return index[seq % max_frames]; }
+    const entry& at(std::uint64_t seq) const { return index[seq % max_frames]; }
+
+    std::size_t encode_delta(const unsigned char* state);
+    void decode(std::uint64_t seq, unsigned char* state);
+    bool alloc(std::uint32_t size, std::uint32_t& offset);
+    void drop_oldest();
+
+    std::unique_ptr<unsigned char[]> arena;
+    std::size_t arena_size = 0;
+    std::unique_ptr<entry[]> index;
+    std::size_t max_frames = 0;
+
+    // Frames first_seq to end_seq - 1 are stored.
+    std::uint64_t first_seq = 0;
+    std::uint64_t end_seq = 0;
+
+    // Decoded copy of the keyframe new frames are deltas against,
+    // valid if key_seq is stored.
+    std::unique_ptr<unsigned char[]> key_state;
+    std::uint64_t key_seq = 0;
+
+    std::unique_ptr<unsigned char[]> state;   // scratch saved state
+    std::unique_ptr<unsigned char[]> encoded; // scratch delta
+};
+
+#endif
@@ -0,0 +1,353 @@
+//
+// High score verification: replays movies (see movie.hpp) and checks
+// that they reproduce the scores claimed for them.
+//
+// Reads a list of claims, one per line:
+//
+//     <movie-file> <score> [<state-hash>]
+//
+// and prints a verdict for each, in the same order. A movie is accepted
+// if it
+//
+// - starts from a machine that was just reset, with only the high
+//   score put in, as the frontend records them,
+// - plays back the same as it was recorded (every keyframe matches),
+// - ends with score in the high score table, higher than at the start,
+// - and, if given, ends in the state with that hash (machine_hash(),
+//   the frontend logs it when it stops recording).
+//
+// DIP switches are inputs like any other, they aren't checked.
+//
+// Movies are played on every core, with no window or sound. Each
+// thread has its own pair of machines for all of its movies, and
+// works through its own range of the list. A thread that runs out
+// takes the back half of the biggest range left, so long movies
+// don't hold up the rest.
+//
+// usage: spaceinvaders-verify <asset-dir> <claims-file> [threads]
+//
+// Exits with 0 if every claim was accepted, 1 otherwise.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "movie.hpp"
+
+struct claim
+{
+    std::string path;
+    unsigned score = 0;
+    bool has_hash = false;
+    std::uint64_t hash = 0;
+};
+
+enum verdict_code
+{
+    VERDICT_OK,
+    VERDICT_UNREADABLE,
+    VERDICT_BAD_START,
+    VERDICT_DESYNC,
+    VERDICT_NOT_SET,
+    VERDICT_WRONG_SCORE,
+    VERDICT_WRONG_HASH
+};
+
+struct verdict
+{
+    verdict_code code = VERDICT_UNREADABLE;
+    std::uint64_t frames = 0; // played, or up to the desync
+    unsigned score = 0;
+    std::uint64_t hash = 0;
+};
+
+// Jobs [begin, end) of a thread, packed so that both can be
+// changed at once: begin << 32 | end.
+struct job_range
+{
+    std::atomic<std::uint64_t> range{0};
+};
+
+static std::uint64_t pack_range(std::uint32_t begin, std::uint32_t end)
+{
+    return std::uint64_t(begin) << 32 | end;
+}
+
+// Take the first job of r.
+static bool take_job(job_range& r, std::uint32_t& job)
+{
+    std::uint64_t cur = r.range.load();
+    for (;;) {
+        std::uint32_t begin = std::uint32_t(cur >> 32), end = std::uint32_t(cur);
+        if (begin >= end) {
+            return false;
+        }
+        if (r.range.compare_exchange_weak(cur, pack_range(begin + 1, end))) {
+            job = begin;
+            return true;
+        }
+    }
+}
+
+// Move the back half of the biggest range left into (empty) own.
+static bool steal_jobs(std::vector<job_range>& ranges, job_range& own)
+{
+    for (;;) {
+        job_range* victim = nullptr;
+        std::uint64_t cur = 0;
+        std::uint32_t most = 0;
+        for (job_range& r : ranges) {
+            std::uint64_t val = r.range.load();
+            std::uint32_t left = std::uint32_t(val) - std::min(std::uint32_t(val >> 32), std::uint32_t(val));
+            if (left > most) {
+                victim = &r;
+                cur = val;
+                most = left;
+            }
+        }
+        if (!victim) {
+            return false;
+        }
+        std::uint32_t begin = std::uint32_t(cur >> 32), end = std::uint32_t(cur);
+        std::uint32_t mid = end - (most + 1) / 2;
+        if (victim->range.compare_exchange_strong(cur, pack_range(begin, mid))) {
+            // nobody takes from an empty range, so this can't race
+            own.range.store(pack_range(mid, end));
+            return true;
+        }
+    }
+}
+
+// The high score table's entry, as a number. It is stored in BCD.
+static unsigned hiscore(const machine& m)
+{
+    unsigned bcd = m.read_mem(HISCORE_START_ADDR) |
+        unsigned(m.read_mem(HISCORE_START_ADDR + 1)) << 8;
+    unsigned score = 0;
+    for (int shift = 12; shift >= 0; shift -= 4) {
+        score = score * 10 + ((bcd >> shift) & 0xf);
+    }
+    return score;
+}
+
+struct verifier
+{
+    const unsigned char* boot_state; // of a machine just reset
+    machine m;
+    machine m_ref;
+    movie_player player;
+    std::unique_ptr<unsigned char[]> state = std::make_unique<unsigned char[]>(MACHINE_SAVE_SIZE);
+    std::unique_ptr<unsigned char[]> ref_state = std::make_unique<unsigned char[]>(MACHINE_SAVE_SIZE);
+
+    int init(const char* assetdir, const unsigned char* boot)
+    {
+        boot_state = boot;
+        if (m.init(assetdir) != 0 || m_ref.init(assetdir) != 0) {
+            return -1;
+        }
+        // the fastest there is, they all run the same
+        if (!machine::has_aot() || m.set_aot(true) != 0) {
+            m.set_jit(true);
+        }
+        m.set_hle(true);
+        player.strict = true;
+        return 0;
+    }
+
+    // The first frame of a movie comes right after the frontend's
+    // first, and after it puts the saved high score in. Do the same
+    // from a reset machine, with the movie's inputs.
+    bool good_start()
+    {
+        m_ref.load_state(boot_state, MACHINE_SAVE_SIZE);
+        m_ref.in_port0 = m.in_port0;
+        m_ref.in_port1 = m.in_port1;
+        m_ref.in_port2 = m.in_port2;
+        m_ref.run_frame();
+        m_ref.write_ram(HISCORE_START_ADDR, m.read_mem(HISCORE_START_ADDR));
+        m_ref.write_ram(HISCORE_START_ADDR + 1, m.read_mem(HISCORE_START_ADDR + 1));
+        m.save_state(state.get(), MACHINE_SAVE_SIZE);
+        m_ref.save_state(ref_state.get(), MACHINE_SAVE_SIZE);
+        return std::memcmp(state.get(), ref_state.get(), MACHINE_SAVE_SIZE) == 0;
+    }
+
+    verdict run(const claim& c)
+    {
+        verdict v;
+        if (player.open(c.path) != 0 || player.seek(m, 0) != 0) {
+            return v;
+        }
+        if (!good_start()) {
+            v.code = VERDICT_BAD_START;
+            return v;
+        }
+        unsigned start_score = hiscore(m);
+        while (player.step(m)) {}
+        v.frames = player.frame;
+        if (player.desyncs != 0) {
+            v.code = VERDICT_DESYNC;
+            return v;
+        }
+        v.score = hiscore(m);
+        v.hash = machine_hash(m);
+        if (v.score <= start_score) {
+            v.code = VERDICT_NOT_SET;
+        }
+        else if (v.score != c.score) {
+            v.code = VERDICT_WRONG_SCORE;
+        }
+        else if (c.has_hash && v.hash != c.hash) {
+            v.code = VERDICT_WRONG_HASH;
+        }
+        else {
+            v.code = VERDICT_OK;
+        }
+        return v;
+    }
+};
+
+static int read_claims(const char* path, std::vector<claim>& claims)
+{
+    std::FILE* file = std::fopen(path, "r");
+    if (!file) {
+        std::printf("Error: could not open %s\n", path);
+        return -1;
+    }
+    char line[4096];
+    for (int line_num = 1; std::fgets(line, sizeof(line), file); ++line_num)
+    {
+        char movie[4096];
+        unsigned score = 0;
+        char hash[32] = "";
+        if (line[0] == '#') {
+            continue;
+        }
+        int num = std::sscanf(line, "%4095s %u %31s", movie, &score, hash);
+        if (num <= 0) {
+            continue;
+        }
+        claim c;
+        c.path = movie;
+        c.score = score;
+        char* hash_end = hash;
+        if (num == 3) {
+            c.hash = std::strtoull(hash, &hash_end, 16);
+            c.has_hash = true;
+        }
+        if (num < 2 || score > 9999 || *hash_end != '\0') {
+            std::printf("Error: %s:%d: expected <movie-file> <score> [<state-hash>]\n", path, line_num);
+            std::fclose(file);
+            return -1;
+        }
+        claims.push_back(std::move(c));
+    }
+    std::fclose(file);
+    return 0;
+}
+
+static void print_verdict(const claim& c, const verdict& v)
+{
+    switch (v.code)
+    {
+    case VERDICT_OK:
+        std::printf("%s: accepted, score %u in %llu frames, state hash %016llx\n", c.path.c_str(),
+            v.score, (unsigned long long)v.frames, (unsigned long long)v.hash);
+        break;
+    case VERDICT_UNREADABLE:
+        std::printf("%s: rejected, not a movie that can be played\n", c.path.c_str());
+        break;
+    case VERDICT_BAD_START:
+        std::printf("%s: rejected, does not start from a reset machine\n", c.path.c_str());
+        break;
+    case VERDICT_DESYNC:
+        std::printf("%s: rejected, differs from its recording at frame %llu\n",
+            c.path.c_str(), (unsigned long long)v.frames);
+        break;
+    case VERDICT_NOT_SET:
+        std::printf("%s: rejected, the high score %u was not set in it\n", c.path.c_str(), v.score);
+        break;
+    case VERDICT_WRONG_SCORE:
+        std::printf("%s: rejected, ends with high score %u, not %u\n",
+            c.path.c_str(), v.score, c.score);
+        break;
+    case VERDICT_WRONG_HASH:
+        std::printf("%s: rejected, ends with state hash %016llx, not %016llx\n", c.path.c_str(),
+            (unsigned long long)v.hash, (unsigned long long)c.hash);
+        break;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::printf("usage: spaceinvaders-verify <asset-dir> <claims-file> [threads]\n");
+        return 1;
+    }
+    const char* assetdir = argv[1];
+    log_quiet(true); // not a "Loaded ROM" per machine
+    std::vector<claim> claims;
+    if (read_claims(argv[2], claims) != 0) {
+        return 1;
+    }
+    unsigned num_threads = argc > 3 ? unsigned(std::atoi(argv[3])) : std::thread::hardware_concurrency();
+    num_threads = std::clamp<unsigned>(num_threads, 1, std::max<unsigned>(unsigned(claims.size()), 1));
+
+    auto boot = std::make_unique<machine>();
+    auto boot_state = std::make_unique<unsigned char[]>(MACHINE_SAVE_SIZE);
+    if (boot->init(assetdir) != 0) {
+        return 1;
+    }
+    boot->save_state(boot_state.get(), MACHINE_SAVE_SIZE);
+
+    std::vector<verdict> verdicts(claims.size());
+    std::vector<job_range> ranges(num_threads);
+    for (unsigned i = 0; i < num_threads; ++i) {
+        ranges[i].range.store(pack_range(std::uint32_t(claims.size() * i / num_threads),
+            std::uint32_t(claims.size() * (i + 1) / num_threads)));
+    }
+    std::vector<std::unique_ptr<verifier>> verifiers(num_threads);
+    for (auto& ver : verifiers) {
+        ver = std::make_unique<verifier>();
+        if (ver->init(assetdir, boot_state.get()) != 0) {
+            return 1;
+        }
+    }
+
+    clk::time_point t_start = clk::now();
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&, i]() {
+            std::uint32_t job;
+            for (;;) {
+                if (take_job(ranges[i], job)) {
+                    verdicts[job] = verifiers[i]->run(claims[job]);
+                }
+                else if (!steal_jobs(ranges, ranges[i])) {
+                    break;
+                }
+            }
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    double secs = tim::duration<double>(clk::now() - t_start).count();
+
+    std::uint64_t total_frames = 0;
+    std::size_t num_accepted = 0;
+    for (std::size_t i = 0; i < claims.size(); ++i) {
+        print_verdict(claims[i], verdicts[i]);
+        total_frames += verdicts[i].frames;
+        num_accepted += verdicts[i].code == VERDICT_OK;
+    }
+    std::printf("%zu of %zu accepted, %llu frames in %.2f s on %u threads (%.0f frames/s)\n",
+        num_accepted, claims.size(), (unsigned long long)total_frames, secs, num_threads,
+        total_frames / std::max(secs, 1e-9));
+    return num_accepted == claims.size() ? 0 : 1;
+}
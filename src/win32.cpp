@@ -6,7 +6,7 @@
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
-#include "utils.hpp"
+#include "base.hpp"
 #include "win32.hpp"
 
 